@@ -0,0 +1,81 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "buttons.h"
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static uint32_t count0, count1; // Vertical 2-bit counter, one bit per button
+static uint32_t debounced; // Buttons currently held
+static volatile uint32_t presses; // Presses not yet taken by the main loop
+
+//------------------------------------------------------------------------------
+// Interrupt Handlers
+//------------------------------------------------------------------------------
+void SysTick_Handler(void) {
+    uint32_t sample, delta, changes;
+    TRACE_ENTER(TRACE_SYSTICK);
+
+    sample = ~GPIOA->IDR & BUTTON_MASK; // Pressed buttons read low
+    delta = sample ^ debounced;
+
+    // Count samples that disagree with the debounced state, clearing the
+    // count of any button that agrees. A wrap to zero accepts the change.
+    count1 = (count1 ^ count0) & delta;
+    count0 = ~count0 & delta;
+    changes = delta & ~(count0 | count1);
+
+    debounced ^= changes;
+    presses |= changes & debounced;
+
+    // Everything released and settled, wait for the next edge
+    if (!debounced && !delta) {
+        SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+    }
+    TRACE_EXIT(TRACE_SYSTICK);
+}
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void buttonsInit() {
+    count0 = 0;
+    count1 = 0;
+    debounced = 0;
+    presses = 0;
+
+    // Lowest priority, enabled but not counting until an edge arrives
+    SysTick_Config(SystemCoreClock / DEBOUNCE_HZ);
+    SysTick->CTRL &= ~SysTick_CTRL_ENABLE_Msk;
+}
+
+// Called from the EXTI handlers on any button edge
+void buttonsWake() {
+    if (!(SysTick->CTRL & SysTick_CTRL_ENABLE_Msk)) {
+        SysTick->VAL = 0;
+        SysTick->CTRL |= SysTick_CTRL_ENABLE_Msk;
+    }
+}
+
+int buttonsPending() {
+    return presses != 0;
+}
+
+// SysTick stops in Stop mode, so the core may only sleep lightly
+int buttonsSampling() {
+    return (SysTick->CTRL & SysTick_CTRL_ENABLE_Msk) != 0;
+}
+
+// Take the presses queued since the last call
+uint32_t buttonsPoll() {
+    uint32_t taken;
+    __disable_irq();
+    taken = presses;
+    presses = 0;
+    __enable_irq();
+
+    return taken;
+}
@@ -0,0 +1,34 @@
+//------------------------------------------------------------------------------
+// Buttons
+//
+// PA0-3 are sampled from SysTick and debounced together with a vertical
+// counter. An EXTI edge starts sampling; it stops again once every button is
+// released and settled. Clean presses are queued for the main loop.
+//------------------------------------------------------------------------------
+#ifndef BUTTONS_H
+#define BUTTONS_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define BUTTON_SONG     0x00000001 // PA0
+#define BUTTON_MODE     0x00000002 // PA1
+#define BUTTON_PLAY     0x00000004 // PA2
+#define BUTTON_STOP     0x00000008 // PA3
+#define BUTTON_MASK     0x0000000F
+#define DEBOUNCE_HZ     1000 // Four equal samples in a row accept a change
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void SysTick_Handler(void);
+
+void buttonsInit(void);
+void buttonsWake(void);
+int buttonsPending(void);
+int buttonsSampling(void);
+uint32_t buttonsPoll(void);
+
+#endif
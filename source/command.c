@@ -0,0 +1,112 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "command.h"
+#include "live.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define DIGITS_MAX      5
+#define DROPPED         -1 // The line so far is not a command
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static int digits; // Of the line so far, or DROPPED
+static int command; // Its letter's, or 0 before the first byte
+static int value;
+static int given; // Command of the last line parsed
+static volatile int pending; // Command for the main loop, 0 when there is none
+static volatile int pendingValue;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// PA10 is set up by liveInit(); only the USART changes between the modes
+void commandStart() {
+    digits = 0;
+    command = 0;
+    value = 0;
+    pending = 0;
+
+    RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
+    USART1->BRR = SystemCoreClock / LIVE_BAUD;
+    USART1->CR3 = 0;
+    USART1->CR1 = USART_CR1_UE | USART_CR1_RE | USART_CR1_RXNEIE;
+}
+
+void commandStop() {
+    USART1->CR1 = 0;
+    RCC->APB2ENR &= ~RCC_APB2ENR_USART1EN;
+    pending = 0;
+}
+
+// Called from the USART1 interrupt for each byte. A byte with a line error
+// drops its line.
+void commandReceive() {
+    uint32_t flags = USART1->SR;
+    uint8_t byte;
+
+    if (!(flags & USART_SR_RXNE)) {
+        return;
+    }
+    byte = (uint8_t) USART1->DR;
+    if (flags & (USART_SR_ORE | USART_SR_NE | USART_SR_FE)) {
+        digits = DROPPED;
+    }
+
+    if (commandParse(byte)) {
+        pending = given;
+        pendingValue = value;
+    }
+}
+
+int commandPending() {
+    return pending != 0;
+}
+
+// Returns the command given since the last call, its number in value, or 0
+int commandPoll(int* number) {
+    int given;
+
+    __disable_irq();
+    given = pending;
+    *number = pendingValue;
+    pending = 0;
+    __enable_irq();
+    return given;
+}
+
+// Returns 1 when the byte ended a line holding a command, left in given and
+// value
+int commandParse(uint8_t byte) {
+    int done;
+
+    if (byte == '\r' || byte == '\n') {
+        done = digits > 0;
+        digits = 0;
+        given = command;
+        command = 0;
+        return done;
+    }
+    if (digits == DROPPED) {
+        return 0;
+    }
+    if (!command) {
+        command = byte == 'g' ? COMMAND_SEEK : byte == 'a' ? COMMAND_LOOP_FROM :
+            byte == 'b' ? COMMAND_LOOP_TO : byte == 's' ? COMMAND_SONG : COMMAND_SPEED;
+        if (command != COMMAND_SPEED) {
+            return 0;
+        }
+    }
+    if (byte < '0' || byte > '9' || digits == DIGITS_MAX) {
+        digits = DROPPED;
+        return 0;
+    }
+
+    value = digits ? value * 10 + (byte - '0') : byte - '0';
+    digits++;
+    return 0;
+}
@@ -0,0 +1,41 @@
+//------------------------------------------------------------------------------
+// Serial Commands
+//
+// Takes commands from a terminal while a song plays in mode 0 or 3. They
+// arrive on USART1 (RX only, PA10, 8N1 at LIVE_BAUD) as ASCII lines ended by
+// CR or LF:
+//   150    play at 150% of the written tempo, see setSpeed()
+//   g12    play on from bar 12, see playerSeek()
+//   a5     loop from bar 5 once a last bar is given, see playerLoop()
+//   b8     loop up to the end of bar 8; a0 or b0 stops looping
+//   s7     play song 7 from its start, counted from 0 as the Song button
+//          steps through them, paused if the song was
+// Each byte is parsed in its interrupt in bounded time and the command waits
+// for the main loop. Lines with anything else, or more than five digits, are
+// dropped.
+//------------------------------------------------------------------------------
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define COMMAND_SPEED   1 // Digits alone
+#define COMMAND_SEEK    2 // 'g'
+#define COMMAND_LOOP_FROM 3 // 'a'
+#define COMMAND_LOOP_TO 4 // 'b'
+#define COMMAND_SONG    5 // 's'
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void commandStart(void);
+void commandStop(void);
+void commandReceive(void);
+int commandPending(void);
+int commandPoll(int* value);
+int commandParse(uint8_t byte);
+
+#endif
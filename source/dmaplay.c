@@ -0,0 +1,384 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "dmaplay.h"
+#include "keys.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+
+#ifndef KEY_CHAIN
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define HALF_SLOTS      (DMA_PLAY_SLOTS / 2)
+#define WORD_TRANSFER   (DMA_CCR1_MSIZE_1 | DMA_CCR1_PSIZE_1 | DMA_CCR1_MINC | \
+                        DMA_CCR1_CIRC | DMA_CCR1_DIR)
+#define CHANNEL_FLAGS   (DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3 | DMA_IFCR_CGIF6)
+#define ENTRY_CYCLES    12 // Exception entry, not seen by DWT in the handler
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct DmaEdge {
+    uint32_t time; // Microseconds since schedStart()
+    uint32_t portB; // BSRR words
+    uint32_t portC;
+    int filler; // Only spaces out a gap too long for one reload
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+struct DmaPlayStats dmaPlayStats;
+
+// Slot n is written at edge n: its ports, and the reload that spaces the two
+// edges after it, since ARR is preloaded one update ahead
+static uint32_t portB[DMA_PLAY_SLOTS];
+static uint32_t portC[DMA_PLAY_SLOTS];
+static uint32_t reloads[DMA_PLAY_SLOTS];
+static uint32_t times[DMA_PLAY_SLOTS]; // Of each slot's edge, for dmaPlayRetime()
+static uint8_t fillers[DMA_PLAY_SLOTS];
+
+static struct DmaEdge ahead[3]; // The next edge to compile and the two after it
+static struct DmaEdge held; // Taken from the player, further off than one reload
+static int holding;
+static int ended; // The player has no edges left
+static int endArmed;
+static uint32_t endTime; // Of the last edge taken from the player
+static int retimed; // The timer may have fallen behind the scheduler
+static struct DmaEdge startEdge; // Due at time zero, before the timer can reach it
+static int atStart;
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static void pull(struct DmaEdge* edge, uint32_t after);
+static void compile(int first);
+static void armEnd(void);
+static uint32_t edgeAfter(int slot, int compiled, int k);
+static uint32_t stretch(uint32_t time, uint32_t last, uint32_t pivot, uint32_t ratio);
+
+//------------------------------------------------------------------------------
+// Interrupt Handlers
+//------------------------------------------------------------------------------
+// Half of the buffers has been played and the DMA is in the other half. If
+// that one ends too before this returns, the timer replays stale slots.
+void DMA1_Channel3_IRQHandler(void) {
+    uint32_t start = DWT->CYCCNT;
+    uint32_t flags = DMA1->ISR;
+    uint32_t cycles;
+
+    if (flags & (DMA_ISR_HTIF3 | DMA_ISR_TCIF3)) {
+        powerMarkRefill(TIM3->CNT);
+        DMA1->IFCR = DMA_IFCR_CGIF3;
+        if (flags & DMA_ISR_HTIF3) {
+            compile(0);
+        }
+        if (flags & DMA_ISR_TCIF3) {
+            compile(HALF_SLOTS);
+        }
+        if ((flags & DMA_ISR_HTIF3) && (flags & DMA_ISR_TCIF3)) {
+            dmaPlayStats.underruns++;
+        }
+        if (DMA1->ISR & (DMA_ISR_HTIF3 | DMA_ISR_TCIF3)) {
+            dmaPlayStats.underruns++;
+        }
+        dmaPlayStats.windows++;
+        armEnd();
+
+        cycles = DWT->CYCCNT - start + ENTRY_CYCLES;
+        if (cycles > dmaPlayStats.worstRefill) {
+            dmaPlayStats.worstRefill = cycles;
+        }
+    }
+
+    NVIC_ClearPendingIRQ(DMA1_Channel3_IRQn);
+}
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void dmaPlayInit() {
+    RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+    RCC->APB1ENR |= RCC_APB1ENR_TIM3EN;
+
+    // Same 1 MHz as the scheduler. Channels 1 and 3 are frozen output
+    // compares at zero with no pin, so they match with each update.
+    TIM3->CR1 = 0;
+    TIM3->DIER = 0;
+    TIM3->PSC = (SystemCoreClock / SCHED_TICK_HZ) - 1;
+    TIM3->CCMR1 = 0;
+    TIM3->CCMR2 = 0;
+    TIM3->CCR1 = 0;
+    TIM3->CCR3 = 0;
+
+    DMA1_Channel3->CCR = 0;
+    DMA1_Channel3->CPAR = (uintptr_t) &GPIOB->BSRR;
+    DMA1_Channel3->CMAR = (uintptr_t) portB;
+    DMA1_Channel6->CCR = 0;
+    DMA1_Channel6->CPAR = (uintptr_t) &GPIOC->BSRR;
+    DMA1_Channel6->CMAR = (uintptr_t) portC;
+    DMA1_Channel2->CCR = 0;
+    DMA1_Channel2->CPAR = (uintptr_t) &TIM3->ARR;
+    DMA1_Channel2->CMAR = (uintptr_t) reloads;
+
+    // Same level as the buttons, below the TIM2 deadlines
+    NVIC_SetPriority(DMA1_Channel3_IRQn, 1);
+    NVIC_ClearPendingIRQ(DMA1_Channel3_IRQn);
+    NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+}
+
+// Compiles the first window with the timer stopped. The player has queued
+// its first edges; dmaPlayResume() starts the timer just after schedStart().
+void dmaPlayStart() {
+    uint32_t first, preload;
+
+    dmaPlayStop();
+    dmaPlayStats.windows = 0;
+    dmaPlayStats.underruns = 0;
+    dmaPlayStats.worstRefill = 0;
+    holding = 0;
+    ended = 0;
+    endArmed = 0;
+    retimed = 0;
+
+    pull(&ahead[0], 0);
+    atStart = ahead[0].time == 0;
+    if (atStart) {
+        startEdge = ahead[0];
+        pull(&ahead[0], 0);
+    }
+    pull(&ahead[1], ahead[0].time);
+    pull(&ahead[2], ahead[1].time);
+    first = ahead[0].time;
+    preload = ahead[1].time - ahead[0].time - 1;
+    compile(0);
+    compile(HALF_SLOTS);
+
+    // ARR loaded at once and the prescaler latched, without a DMA request as
+    // URS is set. Starting the count at one keeps the compares at zero from
+    // matching before the first update, which comes first ticks later.
+    TIM3->CR1 = TIM_CR1_URS;
+    TIM3->ARR = first;
+    TIM3->EGR = TIM_EGR_UG;
+    TIM3->CNT = 1;
+    TIM3->CR1 = TIM_CR1_URS | TIM_CR1_ARPE;
+    TIM3->ARR = preload;
+    TIM3->SR = 0;
+    TIM3->DIER = TIM_DIER_UDE | TIM_DIER_CC1DE | TIM_DIER_CC3DE;
+
+    DMA1->IFCR = CHANNEL_FLAGS;
+    DMA1_Channel3->CNDTR = DMA_PLAY_SLOTS;
+    DMA1_Channel3->CCR = WORD_TRANSFER | DMA_CCR1_HTIE | DMA_CCR1_TCIE | DMA_CCR1_EN;
+    DMA1_Channel6->CNDTR = DMA_PLAY_SLOTS;
+    DMA1_Channel6->CCR = WORD_TRANSFER | DMA_CCR1_EN;
+    DMA1_Channel2->CNDTR = DMA_PLAY_SLOTS;
+    DMA1_Channel2->CCR = WORD_TRANSFER | DMA_CCR1_EN;
+}
+
+void dmaPlayPause() {
+    TIM3->CR1 &= ~TIM_CR1_CEN;
+}
+
+// Also starts the song, writing an edge due at time zero straight away
+void dmaPlayResume() {
+    if (atStart) {
+        atStart = 0;
+        GPIOB->BSRR = startEdge.portB;
+        GPIOC->BSRR = startEdge.portC;
+    }
+    TIM3->CR1 |= TIM_CR1_CEN;
+    armEnd();
+}
+
+void dmaPlayStop() {
+    TIM3->CR1 = 0;
+    TIM3->DIER = 0;
+    DMA1_Channel2->CCR = 0;
+    DMA1_Channel3->CCR = 0;
+    DMA1_Channel6->CCR = 0;
+    DMA1->IFCR = CHANNEL_FLAGS;
+    NVIC_ClearPendingIRQ(DMA1_Channel3_IRQn);
+    atStart = 0;
+}
+
+// Holds off the refill while the player's timeline changes under it, without
+// masking the TIM2 deadlines above it
+void dmaPlayLock() {
+    NVIC_DisableIRQ(DMA1_Channel3_IRQn);
+}
+
+void dmaPlayUnlock() {
+    NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+}
+
+// Moves the edges not yet played by RETIME() from the next one the player
+// handed over, which keeps its time, as setSpeed() does the player's own.
+// Fillers before it keep theirs. The timer is held while the reloads are
+// rewritten, then moved on by the time that took, so only an edge falling
+// due in those few microseconds is late. Sets pivot, and taken to the time
+// the last edge taken from the player moved to. Call between dmaPlayLock()
+// and dmaPlayUnlock(). Returns 0 with no song compiled.
+int dmaPlayRetime(uint32_t ratio, uint32_t* pivot, uint32_t* taken) {
+    uint32_t running = TIM3->CR1 & TIM_CR1_CEN;
+    uint32_t count, stopped, late, room, last, end;
+    int slot, compiled, k, s;
+
+    if (!(DMA1_Channel2->CCR & DMA_CCR1_EN)) {
+        return 0;
+    }
+    TIM3->CR1 &= ~TIM_CR1_CEN;
+    count = TIM3->CNT;
+    stopped = schedNow();
+
+    // The slot of the next update, then those compiled after it. The half
+    // played before it is stale until its refill runs.
+    slot = (DMA_PLAY_SLOTS - DMA1_Channel2->CNDTR) % DMA_PLAY_SLOTS;
+    compiled = DMA_PLAY_SLOTS - slot % HALF_SLOTS;
+    if (DMA1->ISR & (DMA_ISR_HTIF3 | DMA_ISR_TCIF3)) {
+        compiled -= HALF_SLOTS;
+    }
+
+    for (k = 0; k < compiled && fillers[(slot + k) % DMA_PLAY_SLOTS]; k++) {
+    }
+    if (k < compiled) {
+        *pivot = times[(slot + k) % DMA_PLAY_SLOTS];
+    } else {
+        for (k = 0; k < 3 && ahead[k].filler; k++) {
+        }
+        *pivot = k < 3 ? ahead[k].time : holding ? held.time : times[slot];
+    }
+
+    // The next slot is at or before the pivot, so keeps its time
+    last = times[slot];
+    end = endTime;
+    for (k = 1; k < compiled; k++) {
+        s = (slot + k) % DMA_PLAY_SLOTS;
+        last = stretch(times[s], last, *pivot, ratio);
+        if (times[s] == endTime) {
+            end = last;
+        }
+        times[s] = last;
+    }
+    for (k = 0; k < 3; k++) {
+        last = stretch(ahead[k].time, last, *pivot, ratio);
+        if (ahead[k].time == endTime) {
+            end = last;
+        }
+        ahead[k].time = last;
+    }
+    if (holding) {
+        held.time = stretch(held.time, last, *pivot, ratio);
+        end = held.time;
+    }
+
+    // The preloaded reload spaces the next two edges, each slot's the two
+    // after it
+    for (k = 0; k < compiled; k++) {
+        reloads[(slot + k) % DMA_PLAY_SLOTS] = edgeAfter(slot, compiled, k + 2) -
+            edgeAfter(slot, compiled, k + 1) - 1;
+    }
+    TIM3->ARR = edgeAfter(slot, compiled, 1) - times[slot] - 1;
+
+    // The count is kept a tick or two short of the update in case the two
+    // timers are that far apart
+    if (running) {
+        late = schedNow() - stopped;
+        room = times[slot] - stopped;
+        if ((int32_t) room < 2) {
+            room = 2;
+        }
+        TIM3->CNT = count + (late < room - 2 ? late : room - 2);
+        TIM3->CR1 |= TIM_CR1_CEN;
+        retimed = 1;
+    }
+    endTime = end;
+    if (endArmed) {
+        schedAt(endTime + DMA_PLAY_GAP);
+    }
+    *taken = end;
+    return 1;
+}
+
+// The next edge after the one at after. Gaps one reload cannot span get
+// empty edges, as long rests get empty events in a song, none closer than
+// PLAYER_EDGE_GAP to the edge it waits for so no reload is zero.
+static void pull(struct DmaEdge* edge, uint32_t after) {
+    struct KeySet onKeys, offKeys;
+
+    if (!holding && !ended) {
+        if (playerNextEdge(&held.time, &onKeys, &offKeys)) {
+            keysBsrr(&onKeys, &offKeys, &held.portB, &held.portC);
+            holding = 1;
+            endTime = held.time;
+        } else {
+            ended = 1;
+        }
+    }
+
+    if (holding && held.time - after <= DMA_PLAY_GAP) {
+        *edge = held;
+        edge->filler = 0;
+        holding = 0;
+    } else {
+        edge->time = after + DMA_PLAY_GAP;
+        if (holding && held.time - edge->time < PLAYER_EDGE_GAP) {
+            edge->time = held.time - PLAYER_EDGE_GAP;
+        }
+        edge->portB = 0;
+        edge->portC = 0;
+        edge->filler = 1;
+    }
+}
+
+// Fill half of the buffers, from slot first on
+static void compile(int first) {
+    int s;
+
+    for (s = first; s < first + HALF_SLOTS; s++) {
+        times[s] = ahead[0].time;
+        fillers[s] = (uint8_t) ahead[0].filler;
+        portB[s] = ahead[0].portB;
+        portC[s] = ahead[0].portC;
+        reloads[s] = ahead[2].time - ahead[1].time - 1;
+        ahead[0] = ahead[1];
+        ahead[1] = ahead[2];
+        pull(&ahead[2], ahead[1].time);
+    }
+}
+
+// Time of the kth edge from slot on, past the compiled slots from ahead
+static uint32_t edgeAfter(int slot, int compiled, int k) {
+    if (k < compiled) {
+        return times[(slot + k) % DMA_PLAY_SLOTS];
+    }
+    return ahead[k - compiled].time;
+}
+
+// Only times after the pivot move, and none closer than PLAYER_EDGE_GAP to
+// the edge at last. Two edges rounded onto one tick would leave the timer a
+// tick behind its slots for the rest of the song, and a tick apart would
+// give a reload of zero, which blocks it.
+static uint32_t stretch(uint32_t time, uint32_t last, uint32_t pivot, uint32_t ratio) {
+    if ((int32_t) (time - pivot) > 0) {
+        time = RETIME(time, pivot, ratio);
+    }
+    return (int32_t) (time - last) >= PLAYER_EDGE_GAP ? time : last + PLAYER_EDGE_GAP;
+}
+
+// Once the last edge is compiled the scheduler wakes the main loop at its
+// time, so playerStep() can stop the song as it would have anyway. The timer
+// loses part of a tick each time dmaPlayRetime() holds it, or more when an
+// update fell due meanwhile, so after that it is given a reload's grace.
+static void armEnd() {
+    if (ended && !endArmed) {
+        endArmed = 1;
+        schedAt(endTime + (retimed ? DMA_PLAY_GAP : 0));
+    }
+}
+
+#endif
@@ -0,0 +1,77 @@
+//------------------------------------------------------------------------------
+// DMA Playback Engine
+//
+// Plays a song without the CPU touching a single edge. The player's edges are
+// compiled a window at a time into three word buffers: the BSRR word for port
+// B, the one for port C and the timer reload that spaces the edges after it.
+// TIM3 counts microseconds alongside the scheduler, and each update event has
+// DMA1 write one word of each buffer: channel 3 (TIM3_UP) to GPIOB->BSRR,
+// channel 6 (TIM3_CH1) to GPIOC->BSRR and channel 2 (TIM3_CH3) to the
+// preloaded TIM3->ARR, both compares sitting at zero so they fire with the
+// update. Edges are exact to the timer clock, the two ports a few bus cycles
+// apart, while the core sleeps. The half and full transfer interrupts of
+// channel 3 compile the half just played.
+//
+// Only songs in the internal flash use it, and only with the keys on the
+// ports: the refill would have to wait on the stream's own SPI interrupts,
+// and the KEY_CHAIN backend owns channel 3. Other songs, or every song with
+// playerUseDma cleared, are stepped from the scheduler as before.
+//------------------------------------------------------------------------------
+#ifndef DMAPLAY_H
+#define DMAPLAY_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define DMA_PLAY_SLOTS  128 // Edges in the buffers, refilled a half at a time
+#define DMA_PLAY_GAP    4000 // Most microseconds between edges, so slowing a song
+                             // from PLAYER_SPEED_MAX to PLAYER_SPEED_MIN still
+                             // fits a reload, rounding and all
+
+#ifdef KEY_CHAIN
+#define DMA_PLAY_ENGINE 0
+#define dmaPlayInit()
+#define dmaPlayStart()
+#define dmaPlayPause()
+#define dmaPlayResume()
+#define dmaPlayStop()
+#define dmaPlayLock()
+#define dmaPlayUnlock()
+#define dmaPlayRetime(ratio, pivot, taken) 0
+#else
+#define DMA_PLAY_ENGINE 1
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Read them from the debugger watch window; cleared when a song starts
+struct DmaPlayStats {
+    uint32_t windows; // Halves compiled while playing
+    uint32_t underruns; // Halves played before they were compiled
+    uint32_t worstRefill; // Most cycles taken to compile a half
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+extern struct DmaPlayStats dmaPlayStats;
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void DMA1_Channel3_IRQHandler(void);
+
+void dmaPlayInit(void);
+void dmaPlayStart(void);
+void dmaPlayPause(void);
+void dmaPlayResume(void);
+void dmaPlayStop(void);
+void dmaPlayLock(void);
+void dmaPlayUnlock(void);
+int dmaPlayRetime(uint32_t ratio, uint32_t* pivot, uint32_t* taken);
+
+#endif
+#endif
@@ -0,0 +1,208 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "keys.h"
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#ifdef KEY_CHAIN
+#define CHAIN_BYTES     (KEY_CHAIN_BITS / 8)
+#endif
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+// Calibration, one { pull, release } pair per key in microseconds. Measure a
+// key by filming the relay and the keyboard output together, or with a
+// microphone on the keyboard and a scope on the coil. Zero turns
+// compensation off for that edge.
+struct KeyDelay keyDelays[NUM_KEYS] = {
+    { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, // Keys 0-5
+    { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, // Keys 6-11
+    { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, // Keys 12-17
+    { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }, { 0, 0 }  // Keys 18-23
+};
+
+#ifdef KEY_CHAIN
+volatile uint32_t keyChainWorst;
+
+static struct KeySet outputs; // As last asked for
+static uint8_t frame[CHAIN_BYTES]; // Being shifted out, farthest latch first
+static volatile int sending;
+static volatile int dirty; // outputs changed since the frame was built
+static uint32_t frameSince; // Cycle of the oldest update in the frame
+static uint32_t dirtySince; // Cycle of the oldest update not in it
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static void changed(void);
+static void sendFrame(void);
+
+//------------------------------------------------------------------------------
+// Interrupt Handlers
+//------------------------------------------------------------------------------
+// The channel is done once the last byte is in the SPI, so wait for it to
+// leave before the latch pulse. Updates made while the frame was on the wire
+// go out in the next one.
+void DMA1_Channel3_IRQHandler(void) {
+    uint32_t latency;
+
+    if (DMA1->ISR & DMA_ISR_TCIF3) {
+        DMA1->IFCR = DMA_IFCR_CGIF3;
+        DMA1_Channel3->CCR = 0;
+        while (!(SPI1->SR & SPI_SR_TXE) || (SPI1->SR & SPI_SR_BSY)) {
+        }
+
+        GPIOB->BSRR = KEY_CHAIN_LATCH;
+        GPIOB->BSRR = KEY_CHAIN_LATCH << 16;
+        GPIOB->BSRR = KEY_CHAIN_OE << 16;
+
+        latency = DWT->CYCCNT - frameSince;
+        if (latency > keyChainWorst) {
+            keyChainWorst = latency;
+        }
+        sending = 0;
+        if (dirty) {
+            dirty = 0;
+            frameSince = dirtySince;
+            sendFrame();
+        }
+    }
+
+    NVIC_ClearPendingIRQ(DMA1_Channel3_IRQn);
+}
+#endif
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+#ifdef KEY_CHAIN
+// Called after setup() has made every PB pin an output
+void keysInit() {
+    RCC->AHBENR |= RCC_AHBENR_GPIOBEN | RCC_AHBENR_DMA1EN;
+    RCC->APB2ENR |= RCC_APB2ENR_SPI1EN;
+
+    // /OE high until the first frame is latched, then PB3 and PB5 alternate
+    // function 5 at 40 MHz and PB6-7 outputs
+    GPIOB->BSRR = KEY_CHAIN_OE | (KEY_CHAIN_LATCH << 16);
+    GPIOB->MODER &= ~(0x0000FCC0);
+    GPIOB->MODER |= (0x00005880);
+    GPIOB->OTYPER &= ~(0x000000E8);
+    GPIOB->OSPEEDR |= (0x0000FCC0);
+    GPIOB->PUPDR &= ~(0x0000FCC0);
+    GPIOB->AFR[0] &= ~(0x00F0F000);
+    GPIOB->AFR[0] |= (0x00505000);
+
+    // Master, mode 0, MSB first, PCLK2 / 4 = 8 MHz, well inside what the
+    // 74HC595 takes at 3.3 V. Transmit only; what comes back is never read.
+    SPI1->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_0 | SPI_CR1_SPE;
+    SPI1->CR2 = SPI_CR2_TXDMAEN;
+
+    DMA1_Channel3->CCR = 0;
+    DMA1_Channel3->CPAR = (uintptr_t) &SPI1->DR;
+    DMA1_Channel3->CMAR = (uintptr_t) frame;
+
+    // The latch pulse is part of a key edge, so it shares the deadline level
+    NVIC_SetPriority(DMA1_Channel3_IRQn, 0);
+    NVIC_ClearPendingIRQ(DMA1_Channel3_IRQn);
+    NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+
+    keyChainWorst = 0;
+    sending = 0;
+    dirty = 0;
+    deactivateAllKeys();
+}
+
+// The whole chain is rewritten and latched at once, so a chord lands
+// together wherever its keys are. A key in both sets is released.
+void updateKeys(const struct KeySet* onKeys, const struct KeySet* offKeys) {
+    uint32_t primask = __get_PRIMASK();
+    TRACE_ENTER(TRACE_KEYS);
+
+    __disable_irq();
+    keySetUnion(&outputs, onKeys);
+    keySetDifference(&outputs, offKeys);
+    changed();
+    __set_PRIMASK(primask);
+    TRACE_EXIT(TRACE_KEYS);
+}
+
+void deactivateAllKeys() {
+    uint32_t primask = __get_PRIMASK();
+    TRACE_ENTER(TRACE_KEYS_OFF);
+
+    __disable_irq();
+    keySetClear(&outputs);
+    changed();
+    __set_PRIMASK(primask);
+    TRACE_EXIT(TRACE_KEYS_OFF);
+}
+
+// Call with interrupts masked. A frame on the wire is left to finish.
+static void changed() {
+    if (!sending) {
+        frameSince = DWT->CYCCNT;
+        sendFrame();
+    } else if (!dirty) {
+        dirty = 1;
+        dirtySince = DWT->CYCCNT;
+    }
+}
+
+// The first byte out ends up in the farthest latch
+static void sendFrame() {
+    int i;
+
+    for (i = 0; i < CHAIN_BYTES; i++) {
+        frame[CHAIN_BYTES - 1 - i] = (uint8_t) (outputs.words[i / 4] >> (8 * (i % 4)));
+    }
+
+    sending = 1;
+    DMA1_Channel3->CNDTR = CHAIN_BYTES;
+    DMA1_Channel3->CCR = DMA_CCR1_DIR | DMA_CCR1_MINC | DMA_CCR1_TCIE | DMA_CCR1_EN;
+}
+#else
+// Each port gets a single BSRR write, so every edge of a chord lands together
+// and nothing can interleave a read-modify-write. BSRR favours set over reset,
+// so a key in both sets is dropped from the set half to keep release winning.
+void updateKeys(const struct KeySet* onKeys, const struct KeySet* offKeys) {
+    uint32_t portB, portC;
+    TRACE_ENTER(TRACE_KEYS);
+
+    keysBsrr(onKeys, offKeys, &portB, &portC);
+    GPIOB->BSRR = portB;
+    GPIOC->BSRR = portC;
+    TRACE_EXIT(TRACE_KEYS);
+}
+
+void keysBsrr(const struct KeySet* onKeys, const struct KeySet* offKeys, uint32_t* portB,
+    uint32_t* portC) {
+    struct KeySet set = *onKeys;
+
+    keySetDifference(&set, offKeys);
+    *portB = (KEYSET_PORT(offKeys, 0) << 16) | KEYSET_PORT(&set, 0);
+    *portC = (KEYSET_PORT(offKeys, 12) << 16) | KEYSET_PORT(&set, 12);
+}
+
+void deactivateAllKeys() {
+    TRACE_ENTER(TRACE_KEYS_OFF);
+    GPIOB->BSRR = (0x0FFF0000); // PB12-15 belong to the SPI flash
+    GPIOC->BSRR = (0xFFFF0000);
+    TRACE_EXIT(TRACE_KEYS_OFF);
+}
+#endif
+
+void updateOutput(int output, int on) {
+    struct KeySet set, none;
+
+    if (output < 0 || output >= KEY_OUTPUTS) {
+        return;
+    }
+    keySetOutput(&set, output);
+    keySetClear(&none);
+    updateKeys(on ? &set : &none, on ? &none : &set);
+}
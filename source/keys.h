@@ -0,0 +1,166 @@
+//------------------------------------------------------------------------------
+// Key Outputs
+//
+// Two backends, chosen at build time. By default keys 0-11 are driven from
+// PB0-11 and keys 12-23 from PC0-11. Built with KEY_CHAIN defined, the relays
+// hang off KEY_CHAIN_BITS outputs of chained 74HC595 latches instead: DMA1
+// channel 3 shifts the whole frame out of SPI1 (PB3 SCK, PB5 MOSI) and one
+// pulse on PB6 (RCLK) latches every output at once. PB7 drives /OE and keeps
+// the outputs off until the first frame is latched, since the latches power
+// up in any state. Output 0 is QA of the latch nearest the board.
+//
+// Only MIDI input (mode 2) reaches all KEY_OUTPUTS. Songs, phrase code and
+// live frames keep their 24-bit key fields, so in every build they play
+// NUM_KEYS keys, two octaves, which drive outputs KEY_BASE up; KEY_BASE
+// picks the two octaves. Reaching further with them needs wider formats.
+//
+// Outputs are passed around as a KeySet, one bit per output. Its operations
+// are unrolled by the preprocessor over the few words it takes, so a chord of
+// any size costs the same handful of word-wide instructions.
+//
+// Each relay takes its own time to pull a key down and to let it go;
+// keyDelays holds those times so the player can drive each coil early by its
+// own amount.
+//------------------------------------------------------------------------------
+#ifndef KEYS_H
+#define KEYS_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define NUM_KEYS    24
+
+#ifdef KEY_CHAIN
+#ifndef KEY_CHAIN_BITS
+#define KEY_CHAIN_BITS  96 // Eight per 74HC595, 88 keys from MIDI input
+#endif
+#ifndef KEY_BASE
+#define KEY_BASE        24 // Song key 0 on middle C of a 61-key keyboard
+#endif
+#define KEY_OUTPUTS     KEY_CHAIN_BITS
+#define KEY_CHAIN_LATCH 0x00000040 // PB6
+#define KEY_CHAIN_OE    0x00000080 // PB7
+#else
+#define KEY_BASE        0
+#define KEY_OUTPUTS     NUM_KEYS
+#endif
+
+#if KEY_OUTPUTS % 8 || KEY_BASE + NUM_KEYS > KEY_OUTPUTS
+#error "The song keys must fit the outputs, which come in whole latches"
+#endif
+
+#define KEY_BITS        ((1UL << NUM_KEYS) - 1)
+#define KEYSET_WORDS    ((KEY_OUTPUTS + 31) / 32)
+#define KEYSET_BASE     (KEY_BASE % 32) // Song key 0 in its word
+
+// Repeats op(word) for each word of a KeySet
+#if KEYSET_WORDS == 1
+#define KEYSET_UNROLL(op)   op(0)
+#elif KEYSET_WORDS == 2
+#define KEYSET_UNROLL(op)   op(0) op(1)
+#elif KEYSET_WORDS == 3
+#define KEYSET_UNROLL(op)   op(0) op(1) op(2)
+#elif KEYSET_WORDS == 4
+#define KEYSET_UNROLL(op)   op(0) op(1) op(2) op(3)
+#else
+#error "A KeySet holds at most 128 outputs"
+#endif
+
+// Twelve outputs from first up, as one port's pins. They must not straddle
+// a word.
+#define KEYSET_PORT(set, first) \
+    (((set)->words[(first) / 32] >> ((first) % 32)) & 0x00000FFF)
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Output n is bit n % 32 of word n / 32
+struct KeySet {
+    uint32_t words[KEYSET_WORDS];
+
+};
+
+struct KeyDelay {
+    uint16_t pull; // Microseconds from coil on to the note sounding
+    uint16_t release; // Microseconds from coil off to the note stopping
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+// Read when a song starts, so edits from the debugger apply to the next song
+extern struct KeyDelay keyDelays[NUM_KEYS];
+
+#ifdef KEY_CHAIN
+// Worst cycles from a key update to the latch pulse that shows it. Read it
+// from the debugger watch window.
+extern volatile uint32_t keyChainWorst;
+#endif
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+#ifdef KEY_CHAIN
+void DMA1_Channel3_IRQHandler(void);
+
+void keysInit(void);
+#else
+#define keysInit()
+
+// The BSRR words updateKeys() writes, for writers other than the CPU
+void keysBsrr(const struct KeySet* onKeys, const struct KeySet* offKeys, uint32_t* portB,
+    uint32_t* portC);
+#endif
+void updateKeys(const struct KeySet* onKeys, const struct KeySet* offKeys);
+void updateOutput(int output, int on);
+void deactivateAllKeys(void);
+
+//------------------------------------------------------------------------------
+// Inline Functions
+//------------------------------------------------------------------------------
+#define KEYSET_CLEAR(w)         set->words[w] = 0;
+#define KEYSET_UNION(w)         set->words[w] |= add->words[w];
+#define KEYSET_DIFFERENCE(w)    set->words[w] &= ~remove->words[w];
+#define KEYSET_INTERSECT(w)     set->words[w] &= keep->words[w];
+#define KEYSET_ANY(w)           | set->words[w]
+
+static __INLINE void keySetClear(struct KeySet* set) {
+    KEYSET_UNROLL(KEYSET_CLEAR)
+}
+
+static __INLINE void keySetUnion(struct KeySet* set, const struct KeySet* add) {
+    KEYSET_UNROLL(KEYSET_UNION)
+}
+
+static __INLINE void keySetDifference(struct KeySet* set, const struct KeySet* remove) {
+    KEYSET_UNROLL(KEYSET_DIFFERENCE)
+}
+
+static __INLINE void keySetIntersect(struct KeySet* set, const struct KeySet* keep) {
+    KEYSET_UNROLL(KEYSET_INTERSECT)
+}
+
+static __INLINE int keySetEmpty(const struct KeySet* set) {
+    return !(0 KEYSET_UNROLL(KEYSET_ANY));
+}
+
+// Just the one output
+static __INLINE void keySetOutput(struct KeySet* set, int output) {
+    keySetClear(set);
+    set->words[output / 32] = 1UL << (output % 32);
+}
+
+// Song keys, as in song events and live frames, placed from KEY_BASE
+static __INLINE void keySetFromKeys(struct KeySet* set, uint32_t keys) {
+    keys &= KEY_BITS;
+    keySetClear(set);
+    set->words[KEY_BASE / 32] = keys << KEYSET_BASE;
+#if KEYSET_BASE + NUM_KEYS > 32
+    set->words[KEY_BASE / 32 + 1] = keys >> (32 - KEYSET_BASE);
+#endif
+}
+
+#endif
@@ -0,0 +1,271 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "keys.h"
+#include "live.h"
+#include "scheduler.h"
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define HALF_RING       (LIVE_RING / 2)
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct LiveFrame {
+    uint32_t time; // Microseconds since liveStart()
+    struct KeySet onKeys;
+    struct KeySet offKeys;
+    uint32_t arrival; // Core cycle of the wake that brought it
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+struct LiveStats liveStats;
+
+static uint8_t ring[LIVE_RING];
+static volatile uint32_t halves; // Ring halves the DMA has filled
+static volatile int wake;
+static volatile uint32_t wakeCycle;
+static uint32_t tail; // Bytes taken from the ring
+static struct LiveFrame queue[LIVE_QUEUE];
+static int head;
+static int queued;
+static uint32_t lastTime; // Time the next frame's delta counts from
+static int started; // A frame has been taken
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static void markWake(void);
+static uint32_t received(void);
+static void queueFrame(const uint8_t* frame, uint32_t arrival);
+static void playDue(void);
+
+//------------------------------------------------------------------------------
+// Interrupt Handlers
+//------------------------------------------------------------------------------
+// Half and full ring, so a stream with no gaps is still read in time
+void DMA1_Channel5_IRQHandler(void) {
+    uint32_t flags = DMA1->ISR;
+
+    if (flags & (DMA_ISR_HTIF5 | DMA_ISR_TCIF5)) {
+        DMA1->IFCR = DMA_IFCR_CGIF5;
+        if (flags & DMA_ISR_HTIF5) {
+            halves++;
+        }
+        if (flags & DMA_ISR_TCIF5) {
+            halves++;
+        }
+        markWake();
+    }
+
+    NVIC_ClearPendingIRQ(DMA1_Channel5_IRQn);
+}
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void liveInit() {
+    RCC->AHBENR |= RCC_AHBENR_GPIOAEN | RCC_AHBENR_DMA1EN;
+
+    // PA10 alternate function 7 (USART1_RX), pulled up so an open line idles
+    GPIOA->MODER &= ~(0x00300000);
+    GPIOA->MODER |= (0x00200000);
+    GPIOA->PUPDR &= ~(0x00300000);
+    GPIOA->PUPDR |= (0x00100000);
+    GPIOA->AFR[1] &= ~(0x00000F00);
+    GPIOA->AFR[1] |= (0x00000700);
+
+    DMA1_Channel5->CCR = 0;
+    DMA1_Channel5->CPAR = (uintptr_t) &USART1->DR;
+    DMA1_Channel5->CMAR = (uintptr_t) ring;
+
+    // Same level as the buttons, below the TIM2 deadlines
+    NVIC_SetPriority(USART1_IRQn, 1); // Shared with MIDI input, see main.c
+    NVIC_SetPriority(DMA1_Channel5_IRQn, 1);
+    NVIC_ClearPendingIRQ(USART1_IRQn);
+    NVIC_ClearPendingIRQ(DMA1_Channel5_IRQn);
+    NVIC_EnableIRQ(USART1_IRQn);
+    NVIC_EnableIRQ(DMA1_Channel5_IRQn);
+}
+
+// Restarts the time base, so the player must be stopped
+void liveStart() {
+    halves = 0;
+    wake = 0;
+    tail = 0;
+    head = 0;
+    queued = 0;
+    started = 0;
+    liveStats.frames = 0;
+    liveStats.errors = 0;
+    liveStats.late = 0;
+    liveStats.overruns = 0;
+    liveStats.worstLatency = 0;
+
+    RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
+    DMA1->IFCR = DMA_IFCR_CGIF5;
+    DMA1_Channel5->CNDTR = LIVE_RING;
+    DMA1_Channel5->CCR = DMA_CCR1_MINC | DMA_CCR1_CIRC | DMA_CCR1_HTIE | DMA_CCR1_TCIE |
+        DMA_CCR1_EN;
+
+    // 16x oversampling, so BRR is the clock over the baud rate
+    USART1->BRR = SystemCoreClock / LIVE_BAUD;
+    USART1->CR3 = USART_CR3_DMAR;
+    USART1->CR1 = USART_CR1_UE | USART_CR1_RE | USART_CR1_IDLEIE;
+
+    schedStart();
+}
+
+void liveStop() {
+    USART1->CR1 = 0;
+    USART1->CR3 = 0;
+    DMA1_Channel5->CCR = 0;
+    DMA1->IFCR = DMA_IFCR_CGIF5;
+    RCC->APB2ENR &= ~RCC_APB2ENR_USART1EN;
+    wake = 0;
+
+    schedStop();
+    deactivateAllKeys();
+}
+
+// Called from the USART1 interrupt. The line went quiet after a burst, so a
+// frame has probably just finished.
+void liveReceive() {
+    if (USART1->SR & USART_SR_IDLE) {
+        (void) USART1->DR; // Clears IDLE after the SR read; DMA already has the data
+        markWake();
+    }
+}
+
+// Bytes have come in or a queued frame is due
+int livePending() {
+    return wake || schedPending();
+}
+
+// Take the whole frames in the ring, then play those that are due
+void livePoll() {
+    uint8_t frame[LIVE_FRAME_BYTES];
+    uint32_t total, arrival, sum;
+    int i;
+
+    TRACE_ENTER(TRACE_LIVE);
+    __disable_irq();
+    arrival = wake ? wakeCycle : DWT->CYCCNT;
+    wake = 0;
+    __enable_irq();
+    schedPoll();
+
+    total = received();
+    if ((int32_t) (total - tail) > LIVE_RING) {
+        liveStats.overruns++;
+        tail = total;
+    }
+
+    while ((int32_t) (total - tail) >= LIVE_FRAME_BYTES && queued < LIVE_QUEUE) {
+        if (ring[tail % LIVE_RING] != LIVE_SYNC) {
+            tail++;
+            continue;
+        }
+
+        sum = 0;
+        for (i = 0; i < LIVE_FRAME_BYTES; i++) {
+            frame[i] = ring[(tail + i) % LIVE_RING];
+            if (i > 0 && i < LIVE_FRAME_BYTES - 1) {
+                sum += frame[i];
+            }
+        }
+        if ((uint8_t) ~sum != frame[LIVE_FRAME_BYTES - 1]) {
+            liveStats.errors++;
+            tail++;
+            continue;
+        }
+
+        tail += LIVE_FRAME_BYTES;
+        queueFrame(frame, arrival);
+    }
+
+    playDue();
+    TRACE_EXIT(TRACE_LIVE);
+}
+
+// Only the first wake since the last poll is kept, it bounds the latency
+static void markWake() {
+    if (!wake) {
+        wakeCycle = DWT->CYCCNT;
+        wake = 1;
+    }
+}
+
+// Bytes the DMA has written since liveStart(). The count of halves lags the
+// channel until its interrupt runs, which can only make this read low.
+static uint32_t received() {
+    uint32_t done, left;
+
+    do {
+        done = halves;
+        left = DMA1_Channel5->CNDTR;
+    } while (done != halves);
+
+    return done * HALF_RING + (LIVE_RING - left) % HALF_RING;
+}
+
+static void queueFrame(const uint8_t* frame, uint32_t arrival) {
+    struct LiveFrame* entry = &queue[(head + queued) % LIVE_QUEUE];
+    uint32_t now = schedNow();
+    uint32_t time = lastTime + (frame[1] | (frame[2] << 8));
+
+    if (!started) {
+        time = now + LIVE_DELAY;
+        lastTime = time;
+        started = 1;
+    } else if ((int32_t) (time - now) < 0) {
+        liveStats.late++;
+        time = now;
+        lastTime = now + LIVE_DELAY;
+    } else {
+        if ((int32_t) (time - now) > 2 * LIVE_DELAY) {
+            time = now + LIVE_DELAY;
+            if ((int32_t) (lastTime - time) > 0) {
+                time = lastTime;
+            }
+        }
+        lastTime = time;
+    }
+
+    entry->time = time;
+    keySetFromKeys(&entry->onKeys, frame[3] | (frame[4] << 8) | ((uint32_t) frame[5] << 16));
+    keySetFromKeys(&entry->offKeys, frame[6] | (frame[7] << 8) | ((uint32_t) frame[8] << 16));
+    entry->arrival = arrival;
+    queued++;
+}
+
+// Frames are queued in time order, so only the head needs a deadline
+static void playDue() {
+    struct LiveFrame* entry;
+    uint32_t latency;
+
+    while (queued) {
+        entry = &queue[head];
+        if ((int32_t) (entry->time - schedNow()) > 0) {
+            schedAt(entry->time);
+            return;
+        }
+
+        updateKeys(&entry->onKeys, &entry->offKeys);
+        latency = DWT->CYCCNT - entry->arrival;
+        if (latency > liveStats.worstLatency) {
+            liveStats.worstLatency = latency;
+        }
+        liveStats.frames++;
+
+        head = (head + 1) % LIVE_QUEUE;
+        queued--;
+    }
+}
@@ -0,0 +1,71 @@
+//------------------------------------------------------------------------------
+// Live Input
+//
+// Plays key changes sent from a PC while mode 1 is playing. They arrive on
+// USART1 (RX only, PA10, 8N1 at LIVE_BAUD) and DMA1 channel 5 copies every
+// byte into a circular ring, so there is no interrupt per byte. The line idle,
+// half ring and full ring interrupts only wake the main loop, which takes
+// whole frames out of the ring and writes them through updateKeys().
+//
+// Frame, LIVE_FRAME_BYTES long:
+//   0      LIVE_SYNC
+//   1-2    Microseconds after the previous frame, little-endian
+//   3-5    Keys to press, key 0 in bit 0 of byte 3
+//   6-8    Keys to release
+//   9      Checksum: bytes 1-8 summed modulo 256, inverted
+// Frames address NUM_KEYS keys, as songs do, in every build (see keys.h). A
+// frame that fails its checksum is dropped one byte at a time until the
+// next sync byte lines up. Gaps over 65535 us are sent as frames with no keys.
+//
+// The first frame plays LIVE_DELAY after it arrives and the rest keep their
+// spacing from it, so jitter on the link up to LIVE_DELAY is taken out. A
+// frame that arrives after its time plays at once and the frames after it are
+// timed from LIVE_DELAY past it. One timed more than twice LIVE_DELAY ahead is
+// pulled in, so the two clocks drifting apart cannot grow the delay.
+//------------------------------------------------------------------------------
+#ifndef LIVE_H
+#define LIVE_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define LIVE_BAUD       1000000
+#define LIVE_SYNC       0xA5
+#define LIVE_FRAME_BYTES 10
+#define LIVE_RING       256 // Bytes, a power of two
+#define LIVE_QUEUE      16 // Frames waiting for their time
+#define LIVE_DELAY      400 // Microseconds
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Read them from the debugger watch window; cleared when live play starts
+struct LiveStats {
+    uint32_t frames; // Frames played
+    uint32_t errors; // Frames dropped on a bad checksum
+    uint32_t late; // Frames that arrived after their time
+    uint32_t overruns; // Times the ring filled before it was read
+    uint32_t worstLatency; // Most core cycles from a frame's wake to its keys
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+extern struct LiveStats liveStats;
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void DMA1_Channel5_IRQHandler(void);
+
+void liveInit(void);
+void liveStart(void);
+void liveStop(void);
+void liveReceive(void);
+int livePending(void);
+void livePoll(void);
+
+#endif
@@ -2,9 +2,21 @@
 // Includes
 //------------------------------------------------------------------------------
 #include "STM32L1xx.h"
+#include "buttons.h"
+#include "command.h"
+#include "dmaplay.h"
+#include "keys.h"
+#include "live.h"
+#include "midi.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+#include "songs.h"
+#include "spiflash.h"
+#include "store.h"
+#include "trace.h"
 #include <assert.h>
 #include <stdio.h>
-#include <stdlib.h>
 
 //------------------------------------------------------------------------------
 // Defines
@@ -12,16 +24,20 @@
 #define HOME        1
 #define PLAY        2
 #define PAUSE       3
-#define NUM_SONGS   2
+
+#define SONGS       0 // Modes
+#define LIVE        1 // Keys sent over USART1, see live.h
+#define MIDI        2 // MIDI input on USART1, see midi.h
+#define ARRANGE     3 // Songs transposed or doubled, see playerTranspose
+
+#define SPEED_STEP  10 // Percent per press of the song or mode button
 
 //------------------------------------------------------------------------------
 // Structs
 //------------------------------------------------------------------------------
-struct Song {
-    int tempo;
-    int beat;
-    int endOfSong;
-
+struct Arrangement {
+    int transpose; // Keys
+    int doubled; // Also an octave up
 };
 
 //------------------------------------------------------------------------------
@@ -30,8 +46,19 @@ struct Song {
 int state;
 int songID;
 int mode;
-long beat;
-struct Song* songs;
+int arrangement; // Mode 3 plays the song in arrangements[arrangement]
+int speed; // Percent of the written tempo songs play at, see setSpeed()
+int loopFrom; // Bars of the song's A/B loop, 0 until given
+int loopTo;
+int unsaved; // The settings or the paused position changed since last saved
+
+// Picked with the song button while mode 3 is at home. Two LEDs, so four.
+static const struct Arrangement arrangements[] = {
+    { 0, 1 }, // Doubled an octave up
+    { 12, 0 }, // An octave up
+    { 5, 0 }, // A fourth up
+    { -7, 0 } // A fifth down
+};
 
 //------------------------------------------------------------------------------
 // Interrupt Handler Prototypes
@@ -40,42 +67,69 @@ void EXTI0_IRQHandler(void);
 void EXTI1_IRQHandler(void);
 void EXTI2_IRQHandler(void);
 void EXTI3_IRQHandler(void);
+void USART1_IRQHandler(void);
 
 //------------------------------------------------------------------------------
 // Function Prototypes
 //------------------------------------------------------------------------------
 void setup(void);
 void reset(void);
-void loadSongs(void);
-void resetSong(int index);
 void changeState(int);
 void changeSong(int);
 void changeMode(int);
-void playBeat(void);
-void activateKeys(int* keyArr, int length);
-void deactivateKeys(int* keyArr, int length);
-void deactivateAllKeys(void);
-int debounce(uint32_t mask);
-
-//------------------------------------------------------------------------------
-// Function Prototypes
-//------------------------------------------------------------------------------
-void song1(int beat);
-void song2(int beat);
+void changeArrangement(int);
+void changeSpeed(int);
+void changeLoop(int from, int to);
+int startSong(int cue, uint32_t beat);
+void saveState(void);
+void restoreState(void);
+void handleButtons(uint32_t presses);
+void handleCommand(int command, int value);
 
 //------------------------------------------------------------------------------
 // Main Loop
 //------------------------------------------------------------------------------
 int main(void) {
+    int command, value;
 
     setup();
 
     while (1) {
-        if (state == PLAY) {
-            playBeat();
+        if (state == PLAY && mode == LIVE) {
+            livePoll();
+        } else if (state == PLAY && (mode == SONGS || mode == ARRANGE)) {
+            if (schedPoll() && !playerStep()) {
+                commandStop();
+                changeState(HOME);
+            }
         } else if (state != HOME && state != PLAY && state != PAUSE) {
             reset();
         }
+
+        if (commandPending()) {
+            command = commandPoll(&value);
+            handleCommand(command, value);
+        }
+        handleButtons(buttonsPoll());
+        traceDrain();
+
+        // The core stalls while the EEPROM programs, so never while playing
+        // or while the buttons are still being sampled
+        if (unsaved && state != PLAY && !buttonsSampling()) {
+            saveState();
+        }
+
+        // Sleep until the next deadline, button press, live frame or command.
+        // Interrupts are masked so a wakeup between the check and WFI is not
+        // lost. Only Stop when no timer or receiver has to keep running: a
+        // paused song, restored at power up or not, still takes commands,
+        // and USART1 has no clock in Stop.
+        __disable_irq();
+        if (!buttonsPending() && !commandPending() && !(state == PLAY &&
+            (schedPending() || (mode == LIVE && livePending())))) {
+            powerIdle(state == HOME && !buttonsSampling());
+        }
+        __enable_irq();
     }
 }
 
@@ -84,77 +138,69 @@ int main(void) {
 //------------------------------------------------------------------------------
 // Song Select Button
 void EXTI0_IRQHandler(void) {
+    TRACE_ENTER(TRACE_EXTI0);
     if ((EXTI->IMR & EXTI_IMR_MR0) && (EXTI->PR & EXTI_PR_PR0)) {
-        // Check if an actual falling edge after debouncing
-        if (0 == debounce(0x00000001)) {
-            if (state == HOME) {
-                if (songID == NUM_SONGS - 1) {
-                    changeSong(0);
-                } else {
-                    changeSong(songID + 1);
-                }
-            }
-        }
+        // Edges only start sampling, SysTick decides if it was a press
+        buttonsWake();
 
         EXTI->PR |= EXTI_PR_PR0;
         NVIC_ClearPendingIRQ(EXTI0_IRQn);
     }
+    TRACE_EXIT(TRACE_EXTI0);
 }
 
 // Mode Select Button
 void EXTI1_IRQHandler(void) {
+    TRACE_ENTER(TRACE_EXTI1);
     if ((EXTI->IMR & EXTI_IMR_MR1) && (EXTI->PR & EXTI_PR_PR1)) {
-        // Check if an actual falling edge after debouncing
-        if (0 == debounce(0x00000002)) {
-            if (state == HOME) {
-                if (mode == 2) {
-                    changeMode(0);
-                } else {
-                    changeMode(mode + 1);
-                }
-            }
-        }
+        // Edges only start sampling, SysTick decides if it was a press
+        buttonsWake();
 
         EXTI->PR |= EXTI_PR_PR1;
         NVIC_ClearPendingIRQ(EXTI1_IRQn);
     }
+    TRACE_EXIT(TRACE_EXTI1);
 }
 
 // Play/Pause Button
 void EXTI2_IRQHandler(void) {
+    TRACE_ENTER(TRACE_EXTI2);
     if ((EXTI->IMR & EXTI_IMR_MR2) && (EXTI->PR & EXTI_PR_PR2)) {
-        // Check if an actual falling edge after debouncing
-        if (0 == debounce(0x00000004)) {
-            if (state == HOME || state == PAUSE) {
-                if (state == HOME) {
-                    resetSong(songID);
-                    beat = 0;
-                }
-                changeState(PLAY);
-            } else if (state == PLAY) {
-                changeState(PAUSE);
-            }
-        }
+        // Edges only start sampling, SysTick decides if it was a press
+        buttonsWake();
 
         EXTI->PR |= EXTI_PR_PR2;
         NVIC_ClearPendingIRQ(EXTI2_IRQn);
     }
+    TRACE_EXIT(TRACE_EXTI2);
 }
 
 // Stop Button
 void EXTI3_IRQHandler(void) {
+    TRACE_ENTER(TRACE_EXTI3);
     if ((EXTI->IMR & EXTI_IMR_MR3) && (EXTI->PR & EXTI_PR_PR3)) {
-        // Check if an actual falling edge after debouncing
-        if (0 == debounce(0x00000008)) {
-            if (state == PLAY || state == PAUSE) {
-                changeState(HOME);
-                deactivateAllKeys();
-            }
-        }
+        // Edges only start sampling, SysTick decides if it was a press
+        buttonsWake();
 
         EXTI->PR |= EXTI_PR_PR3;
         NVIC_ClearPendingIRQ(EXTI3_IRQn);
     }
+    TRACE_EXIT(TRACE_EXTI3);
+}
+
+// Serial Input, only enabled while playing
+void USART1_IRQHandler(void) {
+    TRACE_ENTER(TRACE_USART1);
+    if (mode == MIDI) {
+        midiReceive();
+    } else if (mode == LIVE) {
+        liveReceive();
+    } else {
+        commandReceive();
+    }
+
+    NVIC_ClearPendingIRQ(USART1_IRQn);
+    TRACE_EXIT(TRACE_USART1);
 }
 
 //------------------------------------------------------------------------------
@@ -197,6 +243,10 @@ void setup() {
     EXTI->IMR &= ~(0x0000000F);
     EXTI->IMR |= (0x0000000F);
     EXTI->PR |= (0x0000000F);
+    NVIC_SetPriority(EXTI0_IRQn, 1); // Below TIM2 so button edges can't delay notes
+    NVIC_SetPriority(EXTI1_IRQn, 1);
+    NVIC_SetPriority(EXTI2_IRQn, 1);
+    NVIC_SetPriority(EXTI3_IRQn, 1);
     NVIC_EnableIRQ(EXTI0_IRQn);
     NVIC_EnableIRQ(EXTI1_IRQn);
     NVIC_EnableIRQ(EXTI2_IRQn);
@@ -206,758 +256,268 @@ void setup() {
     NVIC_ClearPendingIRQ(EXTI2_IRQn);
     NVIC_ClearPendingIRQ(EXTI3_IRQn);
 
+    // Timers
+    powerInit();
+    traceInit();
+    schedInit();
+    buttonsInit();
+    spiFlashInit();
+    liveInit();
+    keysInit();
+    dmaPlayInit();
+
     // Variables
     reset();
 
     // Songs
-    loadSongs();
+    songsInit((const struct SongDirectory*) SONG_DIR_ADDRESS);
+    playerInit();
 
     // Clear Keys
     deactivateAllKeys();
 
     // Enable all interrupts
     __enable_irq();
+
+    // Come back as the power left it
+    storeInit();
+    restoreState();
 }
 
 void reset() {
     changeState(HOME);
     changeSong(0);
     changeMode(0);
-    beat = 0;
+    changeArrangement(0);
+    changeSpeed(100);
+    schedStop();
 
     deactivateAllKeys();
 }
 
-void loadSongs() {
-    songs = malloc(NUM_SONGS * sizeof(struct Song));
-
-    songs[0].tempo = 5000;
-    songs[0].beat = 1;
-    songs[0].endOfSong = 0;
-
-    songs[1].tempo = 5000;
-    songs[1].beat = 1;
-    songs[1].endOfSong = 0;
-}
-
-void  resetSong(int index) {
-    songs[index].beat = 1;
-    songs[index].endOfSong = 0;
-}
-
 void changeState(int nextState) {
     if (nextState == HOME || nextState == PLAY || nextState == PAUSE) {
         state = nextState;
-        GPIOA->ODR &= ~(0x00000300);
-        GPIOA->ODR |= state << 8;
+        unsaved = 1;
+        GPIOA->BSRR = (0x00000300 << 16) | (state << 8);
     }
 }
 
 void changeSong(int nextSongID) {
-    if (nextSongID >= 0 && nextSongID < NUM_SONGS) {
+    if (nextSongID >= 0 && nextSongID < songCount()) {
         songID = nextSongID;
+        unsaved = 1;
 
-        GPIOA->ODR &= ~(0x00000030);
-        GPIOA->ODR |= songID << 4;
+        // Two LEDs, so only the low bits of the song number show; the s
+        // command picks any song by number
+        if (mode != ARRANGE) {
+            GPIOA->BSRR = (0x00000030 << 16) | ((songID & 0x3) << 4);
+        }
     }
 }
 
 void changeMode(int nextMode) {
-    if (nextMode == 0 || nextMode == 1 || nextMode == 2) {
+    if (nextMode == 0 || nextMode == 1 || nextMode == 2 || nextMode == 3) {
         mode = nextMode;
+        unsaved = 1;
 
-        GPIOA->ODR &= ~(0x000000C0);
-        GPIOA->ODR |= mode << 6;
-    }
-}
+        GPIOA->BSRR = (0x000000C0 << 16) | (mode << 6);
 
-void playBeat() {
-    if (((double) beat / songs[songID].tempo) >= songs[songID].beat) {
-        if (songs[songID].endOfSong) {
-            deactivateAllKeys();
-            changeState(HOME);
+        // The song LEDs show the arrangement in mode 3
+        if (mode == ARRANGE) {
+            changeArrangement(arrangement);
         } else {
-            switch(songID) {
-                case 0:
-                    song1(songs[songID].beat);
-                    break;
-                case 1:
-                    song2(songs[songID].beat);
-                    break;
-                default:
-                    break;
-            }
+            changeSong(songID);
         }
     }
-    beat++;
 }
 
-void activateKeys(int* keyArr, int length) {
-    uint32_t activateB = (0x00000000);
-    uint32_t activateC = (0x00000000);
-    int i;
-    for (i = 0; i < length; i++) {
-        int key = keyArr[i];
-        if (key >= 0 && key <= 11) {
-            activateB |= 1 << key;
-        } else if (key >= 12 && key <= 23) {
-            activateC |= 1 << (key - 12);
+void changeArrangement(int nextArrangement) {
+    if (nextArrangement >= 0 &&
+        nextArrangement < (int) (sizeof(arrangements) / sizeof(arrangements[0]))) {
+        arrangement = nextArrangement;
+        unsaved = 1;
+
+        if (mode == ARRANGE) {
+            GPIOA->BSRR = (0x00000030 << 16) | (arrangement << 4);
         }
     }
+}
 
-    GPIOB->ODR |= activateB;
-    GPIOC->ODR |= activateC;
+// Applies to the song playing from its next beat, and to the songs after it
+void changeSpeed(int nextSpeed) {
+    if (nextSpeed >= PLAYER_SPEED_MIN && nextSpeed <= PLAYER_SPEED_MAX) {
+        speed = nextSpeed;
+        unsaved = 1;
+        setSpeed(speed);
+    }
 }
 
-void deactivateKeys(int* keyArr, int length) {
-    uint32_t deactivateB = (0x00000000);
-    uint32_t deactivateC = (0x00000000);
-    int i;
-    for (i = 0; i < length; i++) {
-        int key = keyArr[i];
-        if (key >= 0 && key <= 11) {
-            deactivateB |= 1 << key;
-        } else if (key >= 12 && key <= 23) {
-            deactivateC |= 1 << (key - 12);
-        }
+// Loops once both bars are given, see playerLoop(). A paused song moved to
+// the loop start is left there to be saved.
+void changeLoop(int from, int to) {
+    loopFrom = from;
+    loopTo = to;
+    if (playerLoop(loopFrom, loopTo) && state == PAUSE) {
+        unsaved = 1;
     }
+}
 
-    GPIOB->ODR &= ~(deactivateB);
-    GPIOC->ODR &= ~(deactivateC);
+// Plays the selected song, arranged in mode 3, or with cue set readies it
+// paused at beat. Returns 0 for a damaged directory entry, which is skipped
+// rather than played.
+int startSong(int cue, uint32_t beat) {
+    int started;
+
+    playerTranspose = mode == ARRANGE ? arrangements[arrangement].transpose : 0;
+    playerDouble = mode == ARRANGE ? arrangements[arrangement].doubled : 0;
+
+    started = cue ? playerCue(songID, beat) : playerStart(songID);
+    if (started) {
+        changeLoop(0, 0);
+        commandStart();
+    }
+    return started;
 }
 
-void deactivateAllKeys() {
-    GPIOB->ODR &= ~(0x0000FFFF);
-    GPIOC->ODR &= ~(0x0000FFFF);
+// Saves the settings and, while paused, where the song was left. A save that
+// fails is not tried again until something changes.
+void saveState() {
+    struct StoreState saved;
+
+    saved.songID = songID;
+    saved.mode = mode;
+    saved.arrangement = arrangement;
+    saved.speed = speed;
+    saved.paused = state == PAUSE;
+    saved.beat = saved.paused ? playerPosition() : 0;
+    storeSave(&saved);
+    unsaved = 0;
 }
 
-int debounce(uint32_t mask) {
-    int i, count = 0, loops = 50000;
-    for (i = 0; i < loops; i++) {
-        if (GPIOA->IDR & mask) {
-            count++;
+// Takes up the last saved state. A song paused when it was saved comes back
+// paused where it was left, unless the directory no longer has it.
+void restoreState() {
+    struct StoreState saved;
+
+    if (storeLoad(&saved)) {
+        changeSong(saved.songID);
+        changeArrangement(saved.arrangement);
+        changeMode(saved.mode);
+        changeSpeed(saved.speed);
+
+        if (saved.paused && songID == saved.songID && (mode == SONGS || mode == ARRANGE) &&
+            startSong(1, saved.beat)) {
+            changeState(PAUSE);
         }
     }
+    unsaved = 0;
+}
 
-    if (count > (loops / 2)) {
-        return 1;
+// Act on debounced button presses
+void handleButtons(uint32_t presses) {
+    if (!presses) {
+        return;
     }
+    TRACE_ENTER(TRACE_BUTTONS);
 
-    return 0;
-}
+    // Song Select Button, faster while a song plays
+    if (presses & BUTTON_SONG) {
+        if (state == PLAY || state == PAUSE) {
+            if (mode == SONGS || mode == ARRANGE) {
+                changeSpeed(speed + SPEED_STEP);
+            }
+        } else if (state == HOME && mode == ARRANGE) {
+            if (arrangement == (int) (sizeof(arrangements) / sizeof(arrangements[0])) - 1) {
+                changeArrangement(0);
+            } else {
+                changeArrangement(arrangement + 1);
+            }
+        } else if (state == HOME) {
+            if (songID == songCount() - 1) {
+                changeSong(0);
+            } else {
+                changeSong(songID + 1);
+            }
+        }
+    }
 
-// Mary Had A Little Lamb (1-Octave)
-void song1(int beat) {
-    int nextBeat = -1, onKeys[10], offKeys[10], onLength = 0, offLength = 0, end = 0;
-    switch(beat) {
-        case 1:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 2;
-            break;
-        case 2:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 5;
-            break;
-        case 5:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 6;
-            break;
-        case 6:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 9;
-            break;
-        case 9:
-            onKeys[0] = 0;
-            onLength = 1;
-            nextBeat = 10;
-            break;
-        case 10:
-            offKeys[0] = 0;
-            offLength = 1;
-            nextBeat = 13;
-            break;
-        case 13:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 14;
-            break;
-        case 14:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 17;
-            break;
-        case 17:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 18;
-            break;
-        case 18:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 21;
-            break;
-        case 21:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 22;
-            break;
-        case 22:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 25;
-            break;
-        case 25:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 26;
-            break;
-        case 26:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 33;
-            break;
-        case 33:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 34;
-            break;
-        case 34:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 37;
-            break;
-        case 37:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 38;
-            break;
-        case 38:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 41;
-            break;
-        case 41:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 42;
-            break;
-        case 42:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 49;
-            break;
-        case 49:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 50;
-            break;
-        case 50:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 53;
-            break;
-        case 53:
-            onKeys[0] = 7;
-            onLength = 1;
-            nextBeat = 54;
-            break;
-        case 54:
-            offKeys[0] = 7;
-            offLength = 1;
-            nextBeat = 57;
-            break;
-        case 57:
-            onKeys[0] = 7;
-            onLength = 1;
-            nextBeat = 58;
-            break;
-        case 58:
-            offKeys[0] = 7;
-            offLength = 1;
-            nextBeat = 65;
-            break;
-        case 65:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 66;
-            break;
-        case 66:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 69;
-            break;
-        case 69:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 70;
-            break;
-        case 70:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 73;
-            break;
-        case 73:
-            onKeys[0] = 0;
-            onLength = 1;
-            nextBeat = 74;
-            break;
-        case 74:
-            offKeys[0] = 0;
-            offLength = 1;
-            nextBeat = 77;
-            break;
-        case 77:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 78;
-            break;
-        case 78:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 81;
-            break;
-        case 81:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 82;
-            break;
-        case 82:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 85;
-            break;
-        case 85:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 86;  
-            break;
-        case 86:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 89;
-            break;
-        case 89:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 90;
-            break;
-        case 90:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 93;
-            break;
-        case 93:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 94;
-            break;
-        case 94:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 97;
-            break;
-        case 97:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 98;
-            break;
-        case 98:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 101;
-            break;
-        case 101:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 102;
-            break;
-        case 102:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 105;
-            break;
-        case 105:
-            onKeys[0] = 4;
-            onLength = 1;
-            nextBeat = 106;
-            break;
-        case 106:
-            offKeys[0] = 4;
-            offLength = 1;
-            nextBeat = 109;
-            break;
-        case 109:
-            onKeys[0] = 2;
-            onLength = 1;
-            nextBeat = 110;
-            break;
-        case 110:
-            offKeys[0] = 2;
-            offLength = 1;
-            nextBeat = 113;
-            break;
-        case 113:
-            onKeys[0] = 0;
-            onLength = 1;
-            nextBeat = 114;
-            break;
-        case 114:
-            offKeys[0] = 0;
-            offLength = 1;
-            nextBeat = 128;
-            break;
-        case 128:
-            end = 1;
-            break;
-        default:
-            end = 1;
+    // Mode Select Button, slower while a song plays
+    if (presses & BUTTON_MODE) {
+        if (state == PLAY || state == PAUSE) {
+            if (mode == SONGS || mode == ARRANGE) {
+                changeSpeed(speed - SPEED_STEP);
+            }
+        } else if (state == HOME) {
+            if (mode == ARRANGE) {
+                changeMode(0);
+            } else {
+                changeMode(mode + 1);
+            }
+        }
     }
 
-    if (songID == 0) {
-        activateKeys(onKeys, onLength);
-        deactivateKeys(offKeys, offLength);
-        if (end == 1) {
-            songs[songID].endOfSong = 1;
-        } else {
-            songs[songID].beat = nextBeat;
+    // Play/Pause Button
+    if (presses & BUTTON_PLAY) {
+        if (state == HOME && mode == LIVE) {
+            liveStart();
+            changeState(PLAY);
+        } else if (state == HOME && mode == MIDI) {
+            midiStart();
+            changeState(PLAY);
+        } else if (state == HOME) {
+            if (startSong(0, 0)) {
+                changeState(PLAY);
+            }
+        } else if (state == PAUSE) {
+            playerResume();
+            changeState(PLAY);
+        } else if (state == PLAY && (mode == SONGS || mode == ARRANGE)) {
+            playerPause();
+            changeState(PAUSE);
         }
     }
-}
 
-// Mary Had A Little Lamb (2-Octave)
-void song2(int beat) {
-    int nextBeat = -1, onKeys[10], offKeys[10], onLength = 0, offLength = 0, end = 0;
-    switch(beat) {
-        case 1:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 2;
-            break;
-        case 2:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 5;
-            break;
-        case 5:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 6;
-            break;
-        case 6:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 9;
-            break;
-        case 9:
-            onKeys[0] = 0;
-            onKeys[1] = 12;
-            onLength = 2;
-            nextBeat = 10;
-            break;
-        case 10:
-            offKeys[0] = 0;
-            offKeys[1] = 12;
-            offLength = 2;
-            nextBeat = 13;
-            break;
-        case 13:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 14;
-            break;
-        case 14:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 17;
-            break;
-        case 17:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 18;
-            break;
-        case 18:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 21;
-            break;
-        case 21:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 22;
-            break;
-        case 22:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 25;
-            break;
-        case 25:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 26;
-            break;
-        case 26:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 33;
-            break;
-        case 33:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 34;
-            break;
-        case 34:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 37;
-            break;
-        case 37:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 38;
-            break;
-        case 38:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 41;
-            break;
-        case 41:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 42;
-            break;
-        case 42:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 49;
-            break;
-        case 49:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 50;
-            break;
-        case 50:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 53;
-            break;
-        case 53:
-            onKeys[0] = 7;
-            onKeys[1] = 19;
-            onLength = 2;
-            nextBeat = 54;
-            break;
-        case 54:
-            offKeys[0] = 7;
-            offKeys[1] = 19;
-            offLength = 2;
-            nextBeat = 57;
-            break;
-        case 57:
-            onKeys[0] = 7;
-            onKeys[1] = 19;
-            onLength = 2;
-            nextBeat = 58;
-            break;
-        case 58:
-            offKeys[0] = 7;
-            offKeys[1] = 19;
-            offLength = 2;
-            nextBeat = 65;
-            break;
-        case 65:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 66;
-            break;
-        case 66:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 69;
-            break;
-        case 69:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 70;
-            break;
-        case 70:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 73;
-            break;
-        case 73:
-            onKeys[0] = 0;
-            onKeys[1] = 12;
-            onLength = 2;
-            nextBeat = 74;
-            break;
-        case 74:
-            offKeys[0] = 0;
-            offKeys[1] = 12;
-            offLength = 2;
-            nextBeat = 77;
-            break;
-        case 77:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 78;
-            break;
-        case 78:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 81;
-            break;
-        case 81:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 82;
-            break;
-        case 82:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 85;
-            break;
-        case 85:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 86;  
-            break;
-        case 86:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 89;
-            break;
-        case 89:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 90;
-            break;
-        case 90:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 93;
-            break;
-        case 93:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 94;
-            break;
-        case 94:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 97;
-            break;
-        case 97:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 98;
-            break;
-        case 98:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 101;
-            break;
-        case 101:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 102;
-            break;
-        case 102:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 105;
-            break;
-        case 105:
-            onKeys[0] = 4;
-            onKeys[1] = 16;
-            onLength = 2;
-            nextBeat = 106;
-            break;
-        case 106:
-            offKeys[0] = 4;
-            offKeys[1] = 16;
-            offLength = 2;
-            nextBeat = 109;
-            break;
-        case 109:
-            onKeys[0] = 2;
-            onKeys[1] = 14;
-            onLength = 2;
-            nextBeat = 110;
-            break;
-        case 110:
-            offKeys[0] = 2;
-            offKeys[1] = 14;
-            offLength = 2;
-            nextBeat = 113;
-            break;
-        case 113:
-            onKeys[0] = 0;
-            onKeys[1] = 12;
-            onLength = 2;
-            nextBeat = 114;
-            break;
-        case 114:
-            offKeys[0] = 0;
-            offKeys[1] = 12;
-            offLength = 2;
-            nextBeat = 128;
-            break;
-        case 128:
-            end = 1;
-            break;
-        default:
-            end = 1;
+    // Stop Button
+    if (presses & BUTTON_STOP) {
+        if (state == PLAY && mode == LIVE) {
+            liveStop();
+            changeState(HOME);
+        } else if (state == PLAY && mode == MIDI) {
+            midiStop();
+            changeState(HOME);
+        } else if (state == PLAY || state == PAUSE) {
+            playerStop();
+            commandStop();
+            changeState(HOME);
+        }
     }
 
-    if (songID == 1) {
-        activateKeys(onKeys, onLength);
-        deactivateKeys(offKeys, offLength);
-        if (end == 1) {
-            songs[songID].endOfSong = 1;
-        } else {
-            songs[songID].beat = nextBeat;
+    TRACE_EXIT(TRACE_BUTTONS);
+}
+
+// Act on a serial command. Commands are only taken while a song plays in
+// mode 0 or 3; a seek or a new song while paused stays paused. A song that
+// cannot be loaded goes back to HOME.
+void handleCommand(int command, int value) {
+    if (command == COMMAND_SPEED) {
+        changeSpeed(value);
+    } else if (state != PLAY && state != PAUSE) {
+        return;
+    } else if (command == COMMAND_SEEK) {
+        if (playerSeek(value) && state == PAUSE) {
+            unsaved = 1;
+        }
+    } else if (command == COMMAND_LOOP_FROM) {
+        changeLoop(value, value ? loopTo : 0);
+    } else if (command == COMMAND_LOOP_TO) {
+        changeLoop(value ? loopFrom : 0, value);
+    } else if (command == COMMAND_SONG && value < songCount()) {
+        playerStop();
+        changeSong(value);
+        if (!startSong(state == PAUSE, 0)) {
+            commandStop();
+            changeState(HOME);
         }
     }
 }
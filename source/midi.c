@@ -0,0 +1,141 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "keys.h"
+#include "midi.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define NOTE_OFF        0x80
+#define NOTE_ON         0x90
+#define CONTROL_CHANGE  0xB0
+#define PROGRAM_CHANGE  0xC0 // And channel pressure, the two with one data byte
+#define SYSTEM          0xF0
+#define REAL_TIME       0xF8
+#define ALL_SOUND_OFF   120
+#define ALL_NOTES_OFF   123
+#define ENTRY_CYCLES    12 // Exception entry, not seen by DWT in the handler
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+int midiLowNote = MIDI_LOW_NOTE - KEY_BASE;
+int midiChannel = MIDI_OMNI;
+struct MidiStats midiStats;
+
+static uint8_t status; // Running status, 0 when there is none
+static uint8_t first; // First data byte of a two byte message
+static int waiting; // Data bytes still to come for the message
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// PA10 is set up by liveInit(); only the USART changes between the modes
+void midiStart() {
+    midiReset();
+    midiStats.bytes = 0;
+    midiStats.notes = 0;
+    midiStats.outside = 0;
+    midiStats.errors = 0;
+    midiStats.worstLatency = 0;
+
+    RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
+    USART1->BRR = SystemCoreClock / MIDI_BAUD;
+    USART1->CR3 = 0;
+    USART1->CR1 = USART_CR1_UE | USART_CR1_RE | USART_CR1_RXNEIE;
+}
+
+void midiStop() {
+    USART1->CR1 = 0;
+    RCC->APB2ENR &= ~RCC_APB2ENR_USART1EN;
+
+    deactivateAllKeys();
+}
+
+// Called from the USART1 interrupt for each byte. Reading SR then DR clears
+// the error flags along with RXNE; the byte is kept either way, since a bad
+// one costs at most a message.
+void midiReceive() {
+    uint32_t start = DWT->CYCCNT;
+    uint32_t flags = USART1->SR;
+    uint32_t latency;
+
+    if (!(flags & USART_SR_RXNE)) {
+        return;
+    }
+    if (flags & (USART_SR_ORE | USART_SR_NE | USART_SR_FE)) {
+        midiStats.errors++;
+    }
+
+    if (midiParse((uint8_t) USART1->DR)) {
+        latency = DWT->CYCCNT - start + ENTRY_CYCLES;
+        if (latency > midiStats.worstLatency) {
+            midiStats.worstLatency = latency;
+        }
+    }
+}
+
+void midiReset() {
+    status = 0;
+    waiting = 0;
+}
+
+// Returns 1 when the byte finished a message that wrote the keys
+int midiParse(uint8_t byte) {
+    int type, output;
+
+    midiStats.bytes++;
+    if (byte >= REAL_TIME) {
+        return 0;
+    }
+    if (byte >= SYSTEM) {
+        status = 0;
+        return 0;
+    }
+    if (byte & 0x80) {
+        status = byte;
+        waiting = (byte & 0xE0) == PROGRAM_CHANGE ? 1 : 2;
+        return 0;
+    }
+    if (!status) {
+        return 0;
+    }
+
+    // Running status: the next data byte starts the same message again
+    if (waiting == 0) {
+        waiting = (status & 0xE0) == PROGRAM_CHANGE ? 1 : 2;
+    }
+    if (--waiting) {
+        first = byte;
+        return 0;
+    }
+
+    type = status & 0xF0;
+    if (type != NOTE_OFF && type != NOTE_ON && type != CONTROL_CHANGE) {
+        return 0;
+    }
+    if (midiChannel != MIDI_OMNI && (status & 0x0F) != midiChannel) {
+        midiStats.outside += type != CONTROL_CHANGE;
+        return 0;
+    }
+
+    if (type == CONTROL_CHANGE) {
+        if (first != ALL_SOUND_OFF && first != ALL_NOTES_OFF) {
+            return 0;
+        }
+        deactivateAllKeys();
+        return 1;
+    }
+
+    output = first - midiLowNote;
+    if (output < 0 || output >= KEY_OUTPUTS) {
+        midiStats.outside++;
+        return 0;
+    }
+
+    midiStats.notes++;
+    updateOutput(output, type == NOTE_ON && byte);
+    return 1;
+}
@@ -0,0 +1,62 @@
+//------------------------------------------------------------------------------
+// MIDI Input
+//
+// Plays a MIDI keyboard or sequencer through the relays while mode 2 is
+// playing. The MIDI OUT of the source drives USART1 RX (PA10) at 31250 baud
+// through the usual optocoupler. Every byte raises an interrupt and is parsed
+// on the spot, so a note reaches the keys as soon as its last byte lands. The
+// parser is a state machine holding one message, with no loops, so each byte
+// takes bounded time:
+//   - Running status is kept across channel messages. Real-time bytes
+//     (0xF8-0xFF) may come anywhere and are ignored.
+//   - System exclusive and common messages clear running status and their
+//     data is skipped.
+//   - Note On and Note Off for midiLowNote up to midiLowNote + KEY_OUTPUTS - 1
+//     press and release outputs 0 up, keys 0-23 on the direct outputs; other
+//     notes are ignored. Note On with velocity zero is a Note Off.
+//   - Controllers 120 (all sound off) and 123 (all notes off) release every
+//     key.
+//------------------------------------------------------------------------------
+#ifndef MIDI_H
+#define MIDI_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define MIDI_BAUD       31250
+#define MIDI_LOW_NOTE   60 // Middle C on song key 0, as midi2song maps it
+#define MIDI_OMNI       -1 // Any channel
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Read them from the debugger watch window; cleared when MIDI play starts
+struct MidiStats {
+    uint32_t bytes;
+    uint32_t notes; // Note messages that moved a key
+    uint32_t outside; // Note messages outside the window or channel
+    uint32_t errors; // Framing, noise and overrun errors on the line
+    uint32_t worstLatency; // Most cycles from a byte's interrupt to its keys
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+// Edits from the debugger apply from the next message
+extern int midiLowNote; // Note on output 0, so middle C plays song key 0
+extern int midiChannel; // 0-15, or MIDI_OMNI
+extern struct MidiStats midiStats;
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void midiStart(void);
+void midiStop(void);
+void midiReceive(void);
+void midiReset(void);
+int midiParse(uint8_t byte);
+
+#endif
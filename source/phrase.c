@@ -0,0 +1,163 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "phrase.h"
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static const uint8_t* code; // Phrases are addressed from here
+static uint32_t songStart; // The song's own code
+static uint32_t songEnd;
+static struct PhraseFrame frames[PHRASE_DEPTH];
+static int depth;
+static struct SongEvent window[2]; // Event n in window[n & 1]
+static int decoded; // Events decoded so far
+static int oldest; // First event the window holds
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static void restart(void);
+static void decode(struct SongEvent* event);
+static uint32_t readKeys(struct PhraseFrame* frame);
+static uint32_t transpose(const struct PhraseFrame* frame, uint32_t keys);
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void phraseOpen(const uint8_t* base, uint32_t start, uint32_t end) {
+    code = base;
+    songStart = start;
+    songEnd = end;
+    restart();
+}
+
+// Any event before the window is decoded again from the start of the song.
+// Past the end of the code every event is empty.
+const struct SongEvent* phraseEvent(int index) {
+    if (index < decoded - 2 || index < oldest) {
+        restart();
+    }
+    while (decoded <= index) {
+        decode(&window[decoded & 1]);
+        decoded++;
+    }
+    return &window[index & 1];
+}
+
+void phraseMark(struct PhraseMark* mark) {
+    int f;
+
+    for (f = 0; f < depth; f++) {
+        mark->frames[f] = frames[f];
+    }
+    mark->depth = depth;
+    mark->decoded = decoded;
+    mark->event = window[(decoded - 1) & 1];
+}
+
+// Only the marked event is left in the window; one before it is decoded
+// again from the start of the song
+void phraseSeek(const struct PhraseMark* mark) {
+    int f;
+
+    for (f = 0; f < mark->depth; f++) {
+        frames[f] = mark->frames[f];
+    }
+    depth = mark->depth;
+    decoded = mark->decoded;
+    oldest = decoded - 1;
+    window[oldest & 1] = mark->event;
+}
+
+static void restart() {
+    depth = 1;
+    frames[0].start = songStart;
+    frames[0].end = songEnd;
+    frames[0].position = songStart;
+    frames[0].repeats = 0;
+    frames[0].shift = 0;
+    frames[0].layer = 0;
+    decoded = 0;
+    oldest = 0;
+}
+
+static void decode(struct SongEvent* event) {
+    struct PhraseFrame* frame;
+    uint32_t at, target, bytes, delta, onKeys, offKeys;
+    int op, count, f;
+
+    for (;;) {
+        frame = &frames[depth - 1];
+        if (frame->position >= frame->end) {
+            if (frame->repeats) {
+                frame->repeats--;
+                frame->position = frame->start;
+            } else if (depth > 1) {
+                depth--;
+            } else {
+                event->onKeys = 0;
+                event->offKeys = 0;
+                return;
+            }
+            continue;
+        }
+
+        at = frame->position;
+        op = code[frame->position++];
+        if (!(op & PHRASE_CALL)) {
+            break;
+        }
+
+        target = code[at + 1] | ((uint32_t) code[at + 2] << 8);
+        bytes = code[at + 3] | ((uint32_t) code[at + 4] << 8);
+        frame->position = at + PHRASE_CALL_BYTES;
+        count = (op & PHRASE_COUNT) ? code[frame->position++] : 0;
+        if (depth < PHRASE_DEPTH && bytes && target + bytes <= at) {
+            frames[depth].repeats = count;
+            frames[depth].start = target;
+            frames[depth].end = target + bytes;
+            frames[depth].position = target;
+            frames[depth].shift = (op & PHRASE_SHIFT) - ((op & 0x10) << 1);
+            frames[depth].layer = op & PHRASE_LAYER;
+            depth++;
+        }
+    }
+
+    delta = op & PHRASE_DELTA;
+    if (delta == PHRASE_DELTA) {
+        delta = code[frame->position++];
+    }
+    onKeys = (op & PHRASE_ON) ? readKeys(frame) : 0;
+    offKeys = (op & PHRASE_OFF) ? readKeys(frame) : 0;
+    for (f = depth - 1; f > 0; f--) {
+        onKeys = transpose(&frames[f], onKeys);
+        offKeys = transpose(&frames[f], offKeys);
+    }
+
+    event->onKeys = (delta << 24) | onKeys;
+    event->offKeys = offKeys;
+}
+
+static uint32_t readKeys(struct PhraseFrame* frame) {
+    const uint8_t* p = &code[frame->position];
+    uint32_t keys;
+
+    if (*p == PHRASE_RAW) {
+        frame->position += 4;
+        return (p[1] | ((uint32_t) p[2] << 8) | ((uint32_t) p[3] << 16)) & KEY_MASK;
+    }
+    keys = KEY(*p & PHRASE_KEY);
+    while (*p++ & PHRASE_MORE) {
+        keys |= KEY(*p & PHRASE_KEY);
+    }
+    frame->position = p - code;
+    return keys & KEY_MASK;
+}
+
+static uint32_t transpose(const struct PhraseFrame* frame, uint32_t keys) {
+    uint32_t moved = frame->shift < 0 ? keys >> -frame->shift : keys << frame->shift;
+
+    return ((frame->layer ? keys : 0) | moved) & KEY_MASK;
+}
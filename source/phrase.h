@@ -0,0 +1,85 @@
+//------------------------------------------------------------------------------
+// Phrase Decoder
+//
+// Feeds the player the events of a song stored as phrase code rather than
+// SongEvent records. Songs repeat themselves: a bar comes back, a verse is
+// played again, a part is doubled an octave up. Phrase code writes each of
+// those once and calls it from then on, so a song takes a fraction of the
+// flash its event table would.
+//
+// The code is a byte string of two kinds of op:
+//   event  0 o f ddddd  delta beats, with ddddd = PHRASE_DELTA a byte of them
+//                       after it; then the keys to press if o, then the keys
+//                       to release if f
+//   call   1 r l sssss  target and length of an earlier phrase, two
+//                       little-endian halfwords, then if r a count byte:
+//                       play the phrase count more times. Its keys move by
+//                       sssss keys, signed; if l they also sound as written.
+// Keys are a byte per key, PHRASE_MORE set while another follows, or
+// PHRASE_RAW and the three byte mask. A phrase is any run of ops that ends
+// before the call, so calls cannot loop, and calls within it nest up to
+// PHRASE_DEPTH frames. Calls past that are skipped.
+//
+// Decoding walks forward a frame at a time and keeps the last two events, as
+// the player asks for the event at its cursor or the one after it. Each
+// event costs a few ops plus a call or return for each frame entered or left
+// since the one before, so a song plays at the same cost as its table. A
+// mark saves the decoder just past an event, so the player can go back to it
+// later without decoding the song up to it again.
+//------------------------------------------------------------------------------
+#ifndef PHRASE_H
+#define PHRASE_H
+
+#include <stdint.h>
+#include "songs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define PHRASE_DEPTH    4 // Frames, the song's own code the first
+
+#define PHRASE_CALL     0x80
+#define PHRASE_ON       0x40 // Event: keys to press follow
+#define PHRASE_OFF      0x20 // Event: keys to release follow
+#define PHRASE_DELTA    0x1F // Event: beats, or all ones for a byte of them
+#define PHRASE_COUNT    0x40 // Call: a repeat count follows
+#define PHRASE_LAYER    0x20 // Call: keys sound as written and transposed
+#define PHRASE_SHIFT    0x1F // Call: transpose in keys, -16 to 15
+#define PHRASE_CALL_BYTES 5 // Op, target and length, without a count
+#define PHRASE_MORE     0x80 // Key byte: another key follows
+#define PHRASE_KEY      0x1F // Key byte: the key
+#define PHRASE_RAW      0x7F // A KEY_MASK word follows in three bytes
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// A phrase being played, from its code's start up to its end. Kept small, as
+// every mark holds PHRASE_DEPTH of them.
+struct PhraseFrame {
+    uint32_t start;
+    uint32_t end;
+    uint32_t position; // Of the next op
+    uint8_t repeats; // Plays left after this one
+    int8_t shift; // Keys to transpose by
+    uint8_t layer; // The keys as written sound too
+
+};
+
+// The decoder just past an event, and the event
+struct PhraseMark {
+    struct PhraseFrame frames[PHRASE_DEPTH];
+    int depth;
+    int decoded; // Events decoded, the last of them kept in event
+    struct SongEvent event;
+
+};
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void phraseOpen(const uint8_t* code, uint32_t start, uint32_t end);
+const struct SongEvent* phraseEvent(int index);
+void phraseMark(struct PhraseMark* mark);
+void phraseSeek(const struct PhraseMark* mark);
+
+#endif
@@ -0,0 +1,853 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "dmaplay.h"
+#include "keys.h"
+#include "phrase.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+#include "stream.h"
+#include "trace.h"
+#include <assert.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define EDGE_QUEUE      48 // Room for one full event past NUM_KEYS pending edges
+#define SEEK_ENTRIES    16
+#define MICROS(time)    ((uint32_t) (((time) + 128) >> 8)) // Q.8 to the nearest microsecond
+#define NO_BEAT         0xFFFFFFFF // Past the last segment
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Coil changes due at one time, kept in time order
+struct Edge {
+    uint32_t time; // Microseconds since schedStart()
+    struct KeySet onKeys;
+    struct KeySet offKeys;
+
+};
+
+// Where an indexed bar starts: its first event, and the keys held going into
+// it, so playing can pick up there as if it had played up to it
+struct SeekEntry {
+    uint32_t bar; // From 0
+    int cursor;
+    int beat; // Of the event at cursor
+    struct KeySet held;
+    struct PhraseMark mark; // The decoder past the event, for phrase code
+
+};
+
+// Outputs of the song keys that share a pull or release delay
+struct DelayGroup {
+    uint32_t delay; // Microseconds
+    struct KeySet keys;
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static struct SongData playing; // Active song
+static struct Song song;
+static struct TempoChange firstTempo; // The header tempo, segment 0 of the map
+static int segmentCount; // The header tempo and the song's changes
+static struct Edge edges[EDGE_QUEUE];
+static int edgeCount;
+static uint32_t handed; // Time of the last edge written, or handed to the engine
+static uint32_t lead; // Longest key delay; sound times are shifted by it
+static struct DelayGroup pulls[NUM_KEYS];
+static struct DelayGroup releases[NUM_KEYS];
+static const struct KeySet noKeys;
+static int pullGroups;
+static int releaseGroups;
+static int engine; // The active song is played by the DMA engine
+static int paused; // The song clock is stopped by playerPause() or a cue
+static int shift; // playerTranspose and playerDouble as the song started
+static int doubled;
+static uint32_t startBeat; // Beat the song clock last started, or looped, from
+
+// The map scaled by the speed from an anchor, the beat where it last changed,
+// on. The segment being timed is cached at that speed from fromBeat, so
+// timing a beat stays a single multiply whatever the speed; the divisions,
+// and any reads of the map, are left to entering a segment.
+static uint32_t anchorBeat;
+static uint64_t anchorTime; // Microseconds to anchorBeat, Q.8: as played
+static uint64_t anchorRaw; // and as written
+static uint32_t fromBeat; // Later of the segment's first beat and the anchor
+static uint64_t fromTime; // Microseconds to fromBeat as played, Q.8
+static uint32_t scaledLength; // Microseconds per beat at this speed, Q24.8
+static uint32_t nextBeat; // First beat of the segment after it, or NO_BEAT
+static uint32_t skipBeat; // and of the one after that
+
+// For songs with no bar index, every seekStride-th bar reached so far, from
+// the first. A full index doubles the stride and drops the entries between,
+// so a song of any length fits and a seek scans at most a stride of bars
+// past its entry.
+static struct SeekEntry seekIndex[SEEK_ENTRIES];
+static int seekCount;
+static uint32_t seekStride;
+
+int playerUseDma = DMA_PLAY_ENGINE;
+int playerTranspose;
+int playerDouble;
+
+#ifdef JITTER_CAPTURE
+uint32_t jitterCapture[JITTER_CAPTURE];
+int jitterCount;
+#endif
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static int load(int index);
+static void resetSong(void);
+static void begin(int cued);
+static void startFrom(uint32_t beat, int paused);
+static const struct TempoChange* segmentAt(int s);
+static int findSegment(uint32_t beat);
+static uint64_t writtenTime(uint32_t beat, int s);
+static uint64_t scaleTime(uint64_t time);
+static void enterSegment(int s);
+static uint64_t timeAt(uint32_t beat);
+static uint64_t seekTime(uint32_t beat);
+static const struct SongEvent* eventAt(int index);
+static const struct SongBar* barAt(uint32_t bar);
+static int groupDelay(struct DelayGroup* groups, int count, uint32_t delay, int key);
+static void popEdge(void);
+static uint32_t arrangeKeys(uint32_t keys);
+static void arrange(const struct SongEvent* event, struct KeySet* on, struct KeySet* off);
+static void fetchEvents(void);
+static void insertKeys(uint32_t sound, const struct KeySet* on, const struct KeySet* off);
+static void advance(const struct KeySet* on, const struct KeySet* off);
+static void addEntry(uint32_t bar);
+static void seekTo(uint32_t beat);
+static void loopBack(void);
+static void insertEdge(uint32_t time, const struct KeySet* on, const struct KeySet* off);
+static void mergeEdge(struct Edge* edge, const struct KeySet* on, const struct KeySet* off);
+static void captureCycle(void);
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void playerInit() {
+    edgeCount = 0;
+    song.endOfSong = 1;
+    song.speed = 100;
+}
+
+// Returns 0 if the song cannot be loaded
+int playerStart(int index) {
+    if (!load(index)) {
+        return 0;
+    }
+    begin(0);
+    return 1;
+}
+
+// Makes song index the active one, paused at beat with the song clock at
+// zero: playerResume() plays on from there as playerSeek() would. Returns 0
+// if the song cannot be loaded.
+int playerCue(int index, uint32_t beat) {
+    if (!load(index)) {
+        return 0;
+    }
+    startFrom(beat, 1);
+    return 1;
+}
+
+void playerPause() {
+    paused = 1;
+    schedPause();
+    if (engine) {
+        dmaPlayPause();
+    }
+}
+
+void playerResume() {
+    paused = 0;
+    schedResume();
+    if (engine) {
+        dmaPlayResume();
+    }
+}
+
+void playerStop() {
+    dmaPlayStop();
+    schedStop();
+    deactivateAllKeys();
+}
+
+// Called when the deadline of the earliest queued edge expires. Returns 0
+// once the song has ended. Under the DMA engine the only deadline is the
+// last edge's.
+int playerStep() {
+    TRACE_ENTER(TRACE_STEP);
+
+    if (engine) {
+        playerStop();
+        TRACE_EXIT(TRACE_STEP);
+        return 0;
+    }
+
+    updateKeys(&edges[0].onKeys, &edges[0].offKeys);
+    captureCycle();
+    powerMarkEdge();
+    popEdge();
+
+    if (!edgeCount) {
+        playerStop();
+        TRACE_EXIT(TRACE_STEP);
+        return 0;
+    }
+
+    schedAt(edges[0].time);
+    TRACE_EXIT(TRACE_STEP);
+    return 1;
+}
+
+// Plays the active song on from the start of bar, counted from 1, with the
+// keys held there pressed first. The song clock starts again from the bar;
+// a paused song is left cued there for playerResume(). Past the end of the
+// song it ends. Returns 0 for no bar.
+int playerSeek(int bar) {
+    int wasPaused = paused;
+
+    if (bar < 1) {
+        return 0;
+    }
+
+    playerStop();
+    startFrom((uint32_t) (bar - 1) * PLAYER_BAR_BEATS, wasPaused);
+    return 1;
+}
+
+// Repeats bars from to to, counted from 1: playing that reaches the end of
+// bar to, or of the song, goes on from the start of bar from with no gap. A
+// loop that ends before the events already queued starts over at once, as
+// playerSeek() would, and returns 1. Either bar 0 stops looping, after any
+// pass already queued.
+int playerLoop(int from, int to) {
+    int last, restart = 0, ended;
+
+    dmaPlayLock();
+    ended = song.endOfSong && !song.loopEnd; // Not waiting to go back
+    song.loopEnd = 0;
+    if (from >= 1 && to >= from) {
+        song.loopStart = (from - 1) * PLAYER_BAR_BEATS;
+        song.loopEnd = to * PLAYER_BAR_BEATS;
+        last = song.endOfSong ? song.beat : song.beat - EVENT_DELTA(eventAt(song.cursor));
+        restart = ended || last >= song.loopEnd;
+    }
+    dmaPlayUnlock();
+
+    if (restart) {
+        playerSeek(from);
+    }
+    return restart;
+}
+
+// First beat of the active song not yet sounded, to play on from later. The
+// song clock stands still while paused, so this is where it was left; a beat
+// due just as it stopped is taken as not sounded, so a cued song paused
+// again keeps its place. One paused in an A/B loop pass already queued past
+// is taken at the loop start.
+uint32_t playerPosition() {
+    uint32_t low, high, middle, now;
+
+    dmaPlayLock();
+    now = schedNow();
+    low = startBeat;
+    high = (uint32_t) song.beat;
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if ((int32_t) (beatTime((int) middle) + lead - now) >= 0) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+    dmaPlayUnlock();
+    return low;
+}
+
+// Hands the next edge to the DMA engine instead of writing it. Returns 0
+// once there are none left.
+int playerNextEdge(uint32_t* time, struct KeySet* onKeys, struct KeySet* offKeys) {
+    if (!edgeCount) {
+        return 0;
+    }
+
+    *time = edges[0].time;
+    *onKeys = edges[0].onKeys;
+    *offKeys = edges[0].offKeys;
+    popEdge();
+    return 1;
+}
+
+// Play the active song, and the ones after it, at percent of their written
+// tempo. The next edge due keeps its time and every edge after it, queued
+// here or compiled by the DMA engine, is stretched from it, so the change
+// takes at the next event with no jump. Beats not yet queued are timed from
+// the next one at the new speed with nothing recomputed but the segment
+// being timed.
+void setSpeed(int percent) {
+    uint32_t beat = (uint32_t) song.beat;
+    uint32_t ratio, time, after, pivot = 0, last = 0;
+    int active, i = 0;
+
+    if (percent < PLAYER_SPEED_MIN) {
+        percent = PLAYER_SPEED_MIN;
+    } else if (percent > PLAYER_SPEED_MAX) {
+        percent = PLAYER_SPEED_MAX;
+    }
+
+    dmaPlayLock();
+    ratio = SPEED_RATIO(song.speed, percent);
+    if (engine) {
+        active = dmaPlayRetime(ratio, &pivot, &last);
+        if (active) {
+            handed = last;
+        }
+    } else {
+        active = edgeCount > 0;
+        pivot = edges[0].time;
+        last = pivot;
+        i = 1;
+    }
+
+    if (active && segmentCount) {
+        // As the engine's, no queued edge is rounded closer than
+        // PLAYER_EDGE_GAP to the one before it
+        for (; i < edgeCount; i++) {
+            time = RETIME(edges[i].time, pivot, ratio);
+            last = (int32_t) (time - last) >= PLAYER_EDGE_GAP ? time : last + PLAYER_EDGE_GAP;
+            edges[i].time = last;
+        }
+
+        // The anchor keeps its fraction, which a slower speed would magnify
+        anchorTime = timeAt(beat);
+        after = (uint32_t) (anchorTime >> 8) - pivot;
+        if ((int32_t) after > 0) {
+            anchorTime = ((uint64_t) pivot << 8) +
+                (((((uint64_t) after << 8) | (anchorTime & 0xFF)) * ratio + (1UL << 21)) >> 22);
+        }
+        anchorRaw = writtenTime(beat, findSegment(beat));
+        anchorBeat = beat;
+    }
+    song.speed = percent;
+    if (segmentCount) {
+        enterSegment(findSegment(anchorBeat));
+    }
+    dmaPlayUnlock();
+}
+
+// Deadline of a song beat in microseconds since the song started. Rounded
+// rather than cut, so the first 128 beats of a segment are within a
+// microsecond of the tempo however its length was rounded.
+uint32_t beatTime(int beat) {
+    return MICROS(timeAt((uint32_t) beat));
+}
+
+// Makes song index the active one, ready to play from its start
+static int load(int index) {
+    int k;
+
+    if (!songLoad(index, &playing)) {
+        return 0;
+    }
+    if (playing.code) {
+        phraseOpen(playing.code, playing.codeStart, playing.codeEnd);
+    } else if (!playing.events) {
+        streamOpen(&playing);
+    }
+    resetSong();
+
+    // Delays may have been edited since the last song
+    lead = 0;
+    pullGroups = 0;
+    releaseGroups = 0;
+    for (k = 0; k < NUM_KEYS; k++) {
+        if (keyDelays[k].pull > lead) {
+            lead = keyDelays[k].pull;
+        }
+        if (keyDelays[k].release > lead) {
+            lead = keyDelays[k].release;
+        }
+        pullGroups = groupDelay(pulls, pullGroups, keyDelays[k].pull, k);
+        releaseGroups = groupDelay(releases, releaseGroups, keyDelays[k].release, k);
+    }
+
+    shift = playerTranspose;
+    if (shift > 12) {
+        shift = 12;
+    } else if (shift < -12) {
+        shift = -12;
+    }
+    doubled = playerDouble;
+
+    edgeCount = 0;
+    handed = 0 - PLAYER_EDGE_GAP;
+    engine = DMA_PLAY_ENGINE && playerUseDma && (playing.events || playing.code);
+#ifdef JITTER_CAPTURE
+    jitterCount = 0;
+#endif
+    return 1;
+}
+
+static void resetSong() {
+    song.tempo = playing.tempo;
+    firstTempo.beatLength = playing.beatLength;
+    segmentCount = playing.tempoCount + 1;
+    startBeat = 0;
+    anchorBeat = 0;
+    anchorTime = 0;
+    anchorRaw = 0;
+    enterSegment(0);
+
+    song.cursor = 0;
+    song.beat = EVENT_DELTA(eventAt(0));
+    song.endOfSong = 0;
+    keySetClear(&song.held);
+    song.loopEnd = 0;
+
+    seekCount = 0;
+    seekStride = 1;
+    addEntry(0);
+}
+
+// Queues the first events and starts the song clock, or leaves it stopped
+// at zero if paused
+static void begin(int cued) {
+    paused = cued;
+    fetchEvents();
+    if (engine) {
+        dmaPlayStart();
+    }
+
+    if (paused) {
+        schedCue();
+    } else {
+        schedStart();
+    }
+    captureCycle();
+    if (engine) {
+        if (!paused) {
+            dmaPlayResume();
+        }
+        return;
+    }
+    schedAt(edges[0].time);
+}
+
+// Plays on from beat with the keys held there pressed first, the song clock
+// started again from it; if paused, readies it for playerResume()
+static void startFrom(uint32_t beat, int paused) {
+    seekTo(beat);
+    startBeat = beat;
+    anchorBeat = beat;
+    anchorTime = 0;
+    anchorRaw = writtenTime(beat, findSegment(beat));
+    enterSegment(findSegment(beat));
+
+    edgeCount = 0;
+    handed = 0 - PLAYER_EDGE_GAP;
+    insertEdge(lead, &noKeys, &noKeys);
+    insertKeys(lead, &song.held, &noKeys);
+    begin(paused);
+}
+
+static void popEdge() {
+    int i;
+
+    handed = edges[0].time;
+    edgeCount--;
+    for (i = 0; i < edgeCount; i++) {
+        edges[i] = edges[i + 1];
+    }
+    fetchEvents();
+}
+
+// Segment s of the map: the header tempo from beat 0, then each change as
+// the tools stored it with its start, read in place or through the stream.
+// Only good until the next call.
+static const struct TempoChange* segmentAt(int s) {
+    if (!s) {
+        return &firstTempo;
+    }
+    if (playing.tempos) {
+        return &playing.tempos[s - 1];
+    }
+    return streamTempo(s - 1);
+}
+
+// Last segment starting at or before beat; the first starts at beat 0
+static int findSegment(uint32_t beat) {
+    int low = 0, high = segmentCount - 1, middle;
+
+    while (low < high) {
+        middle = (low + high + 1) / 2;
+        if (segmentAt(middle)->beat <= beat) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+// Microseconds from the song start to beat as written, Q.8, in segment s
+static uint64_t writtenTime(uint32_t beat, int s) {
+    const struct TempoChange* segment = segmentAt(s);
+
+    return TEMPO_START(segment) + (uint64_t) (beat - segment->beat) * segment->beatLength;
+}
+
+// Written microseconds, Q.8, at the current speed
+static uint64_t scaleTime(uint64_t time) {
+    return time * 100 / (uint32_t) song.speed;
+}
+
+// Caches segment s at the current speed, and where the two after it start.
+// The length is rounded once per segment, a microsecond off at most every
+// 512 beats into it.
+static void enterSegment(int s) {
+    const struct TempoChange* segment = segmentAt(s);
+    uint64_t start = TEMPO_START(segment);
+    uint32_t beat = segment->beat, beatLength = segment->beatLength;
+
+    song.segment = s;
+    fromBeat = beat > anchorBeat ? beat : anchorBeat;
+    fromTime = anchorTime +
+        scaleTime(start + (uint64_t) (fromBeat - beat) * beatLength - anchorRaw);
+    scaledLength = (uint32_t) (((uint64_t) beatLength * 100 + song.speed / 2) /
+        (uint32_t) song.speed);
+    nextBeat = s + 1 < segmentCount ? segmentAt(s + 1)->beat : NO_BEAT;
+    skipBeat = s + 2 < segmentCount ? segmentAt(s + 2)->beat : NO_BEAT;
+}
+
+// Microseconds from the song start to beat as played, Q.8. Beats are timed
+// in order while playing, so the segment is at most one past the last one
+// timed; anything further is a seek.
+static uint64_t timeAt(uint32_t beat) {
+    if (beat < fromBeat || beat >= skipBeat) {
+        return seekTime(beat);
+    }
+    if (beat >= nextBeat) {
+        enterSegment(song.segment + 1);
+    }
+    return fromTime + (uint64_t) (beat - fromBeat) * scaledLength;
+}
+
+// Searches the map. Beats before the anchor were played at an earlier speed
+// and are only estimated from it.
+static uint64_t seekTime(uint32_t beat) {
+    uint64_t back;
+    int s = findSegment(beat);
+
+    if (beat < anchorBeat) {
+        back = scaleTime(anchorRaw - writtenTime(beat, s));
+        return back < anchorTime ? anchorTime - back : 0;
+    }
+    enterSegment(s);
+    return fromTime + (uint64_t) (beat - fromBeat) * scaledLength;
+}
+
+// Songs in the SPI flash are read through the stream, and phrase code through
+// its decoder. Both are quickest for the event at the cursor or the one after
+// it, and seekTo() moves the decoder anywhere else with a mark.
+static const struct SongEvent* eventAt(int index) {
+    if (playing.events) {
+        return &playing.events[index];
+    }
+    if (playing.code) {
+        return phraseEvent(index);
+    }
+    return streamEvent(index);
+}
+
+// Bar index entries of songs in the SPI flash are read as a seek needs them
+static const struct SongBar* barAt(uint32_t bar) {
+    if (playing.bars) {
+        return &playing.bars[bar];
+    }
+    return streamBar((int) bar);
+}
+
+// Keys with equal delays are driven by one edge, so an event costs an edge
+// per distinct delay however many keys it has; with no calibration, one
+static int groupDelay(struct DelayGroup* groups, int count, uint32_t delay, int key) {
+    struct KeySet output;
+    int g = 0;
+
+    while (g < count && groups[g].delay != delay) {
+        g++;
+    }
+    if (g == count) {
+        groups[g].delay = delay;
+        keySetClear(&groups[g].keys);
+        count++;
+    }
+    keySetOutput(&output, KEY_BASE + key);
+    keySetUnion(&groups[g].keys, &output);
+    return count;
+}
+
+// Keys pushed off either end by the transposition come back an octave in, as
+// midi2song folds notes, then the octave above is added if doubling. The
+// same few shifts however many keys there are.
+static uint32_t arrangeKeys(uint32_t keys) {
+    if (shift > 0) {
+        keys = (keys << shift) | ((keys >> (NUM_KEYS - shift)) << 12);
+    } else if (shift < 0) {
+        keys = (keys >> -shift) | ((keys & ((1UL << -shift) - 1)) << (12 + shift));
+    }
+    if (doubled) {
+        keys |= keys << 12;
+    }
+    return keys & KEY_MASK;
+}
+
+// The outputs event presses and lets go of as played, a key in both let go
+static void arrange(const struct SongEvent* event, struct KeySet* on, struct KeySet* off) {
+    uint32_t released = arrangeKeys(event->offKeys & KEY_MASK);
+
+    keySetFromKeys(on, arrangeKeys(event->onKeys & KEY_MASK) & ~released);
+    keySetFromKeys(off, released);
+}
+
+// Queue the drive edges of upcoming events. An event is taken once its beat
+// is no later than the earliest queued edge: none of its edges can be due
+// before beatTime(), so the head of the queue is always the next edge due.
+// Reaching the end of an A/B loop, or the song's end within one, goes back
+// to its start instead. Going back queues as many edges as an event, so it
+// waits for the same room.
+static void fetchEvents() {
+    struct KeySet on, off;
+    uint32_t sound;
+
+    while ((!song.endOfSong || song.loopEnd) && edgeCount <= EDGE_QUEUE - NUM_KEYS - 1 &&
+        (!edgeCount || (int32_t) (beatTime(song.beat) - edges[0].time) <= 0)) {
+        if (song.loopEnd && (song.endOfSong || song.beat >= song.loopEnd)) {
+            loopBack();
+            continue;
+        }
+        arrange(eventAt(song.cursor), &on, &off);
+        sound = beatTime(song.beat) + lead;
+
+        // Keeps rests and the end marker on the timeline
+        if (keySetEmpty(&on) && keySetEmpty(&off)) {
+            insertEdge(sound, &noKeys, &noKeys);
+        }
+        insertKeys(sound, &on, &off);
+
+        advance(&on, &off);
+    }
+}
+
+// Each key is driven early by its own delay to sound at sound
+static void insertKeys(uint32_t sound, const struct KeySet* on, const struct KeySet* off) {
+    struct KeySet keys;
+    int g;
+
+    for (g = 0; g < releaseGroups; g++) {
+        keys = *off;
+        keySetIntersect(&keys, &releases[g].keys);
+        if (!keySetEmpty(&keys)) {
+            insertEdge(sound - releases[g].delay, &noKeys, &keys);
+        }
+    }
+    for (g = 0; g < pullGroups; g++) {
+        keys = *on;
+        keySetIntersect(&keys, &pulls[g].keys);
+        if (!keySetEmpty(&keys)) {
+            insertEdge(sound - pulls[g].delay, &keys, &noKeys);
+        }
+    }
+}
+
+// Moves past the event at the cursor, which presses on and lets go of off
+// as played. The first event of a bar due an index entry is given one.
+static void advance(const struct KeySet* on, const struct KeySet* off) {
+    uint32_t bar;
+
+    keySetDifference(&song.held, off);
+    keySetUnion(&song.held, on);
+    song.cursor++;
+    if (song.cursor >= playing.length) {
+        song.endOfSong = 1;
+        return;
+    }
+    song.beat += EVENT_DELTA(eventAt(song.cursor));
+
+    bar = (uint32_t) song.beat / PLAYER_BAR_BEATS;
+    if (!playing.barCount && bar >= seekIndex[seekCount - 1].bar + seekStride) {
+        addEntry(bar - bar % seekStride);
+    }
+}
+
+// Indexes the event at the cursor as the start of bar. Entries are only
+// added past the last, so the first event at or after a bar is the one seen
+// the first time it is due.
+static void addEntry(uint32_t bar) {
+    struct SeekEntry* entry;
+    int e, kept = 0;
+
+    if (seekCount == SEEK_ENTRIES) {
+        seekStride *= 2;
+        for (e = 0; e < seekCount; e++) {
+            if (seekIndex[e].bar % seekStride == 0) {
+                seekIndex[kept++] = seekIndex[e];
+            }
+        }
+        seekCount = kept;
+        if (bar < seekIndex[seekCount - 1].bar + seekStride) {
+            return;
+        }
+        bar -= bar % seekStride;
+    }
+
+    entry = &seekIndex[seekCount++];
+    entry->bar = bar;
+    entry->cursor = song.cursor;
+    entry->beat = song.beat;
+    entry->held = song.held;
+    if (playing.code) {
+        phraseMark(&entry->mark);
+    }
+}
+
+// Moves the cursor to the first event at or after beat, and the held keys to
+// those down going into it. The song's entry for its bar, or its last bar,
+// is read; with no bar index the last entry at or before the bar is found.
+// The events from there are scanned.
+static void seekTo(uint32_t beat) {
+    const struct SeekEntry* entry;
+    const struct SongBar* start;
+    struct KeySet on, off;
+    uint32_t bar = beat / PLAYER_BAR_BEATS;
+    int low = 0, high = seekCount - 1, middle;
+
+    song.endOfSong = 0;
+    if (playing.barCount) {
+        if (bar >= (uint32_t) playing.barCount) {
+            bar = (uint32_t) playing.barCount - 1;
+        }
+        start = barAt(bar);
+        song.cursor = (int) start->event;
+        song.beat = (int) (bar * PLAYER_BAR_BEATS + BAR_OFFSET(start));
+        keySetFromKeys(&song.held, arrangeKeys(start->held & KEY_MASK));
+    } else {
+        while (low < high) {
+            middle = (low + high + 1) / 2;
+            if (seekIndex[middle].bar <= bar) {
+                low = middle;
+            } else {
+                high = middle - 1;
+            }
+        }
+
+        entry = &seekIndex[low];
+        song.cursor = entry->cursor;
+        song.beat = entry->beat;
+        song.held = entry->held;
+        if (playing.code) {
+            phraseSeek(&entry->mark);
+        }
+    }
+
+    while (!song.endOfSong && (uint32_t) song.beat < beat) {
+        arrange(eventAt(song.cursor), &on, &off);
+        advance(&on, &off);
+    }
+}
+
+// Goes back to the start of the loop from its end, or from the song's last
+// event if that comes first, with no gap: the keys held there and not at
+// the start are let go as the ones held at the start are pressed. The
+// start is timed on from the end. A loop starting at or past the song's
+// last event has nothing to repeat, so the song ends as it would unlooped.
+static void loopBack() {
+    uint32_t end = song.beat < song.loopEnd ? (uint32_t) song.beat : (uint32_t) song.loopEnd;
+    struct KeySet held = song.held, press, release;
+    uint32_t sound;
+    uint64_t time;
+
+    if (end <= (uint32_t) song.loopStart) {
+        song.loopEnd = 0;
+        return;
+    }
+
+    time = timeAt(end);
+    seekTo((uint32_t) song.loopStart);
+    anchorBeat = (uint32_t) song.loopStart;
+    startBeat = anchorBeat;
+    anchorTime = time;
+    anchorRaw = writtenTime(anchorBeat, findSegment(anchorBeat));
+    enterSegment(findSegment(anchorBeat));
+
+    press = song.held;
+    keySetDifference(&press, &held);
+    release = held;
+    keySetDifference(&release, &song.held);
+    sound = MICROS(time) + lead;
+    insertEdge(sound, &noKeys, &noKeys);
+    insertKeys(sound, &press, &release);
+}
+
+// Events are fetched in order, so a change merged into an existing edge
+// comes from a later event and overrides it for the same key. One due less
+// than PLAYER_EDGE_GAP from a queued edge, as differing key delays leave
+// them, is merged into it and takes its time. An event fetched late, as a
+// full queue holds it back, has its edges no earlier than that after the
+// last one handed on: the engine cannot go back, and the scheduler would
+// play it late anyway.
+static void insertEdge(uint32_t time, const struct KeySet* on, const struct KeySet* off) {
+    int i = edgeCount, j;
+
+    if ((int32_t) (time - handed) < PLAYER_EDGE_GAP) {
+        time = handed + PLAYER_EDGE_GAP;
+    }
+    while (i > 0 && (int32_t) (edges[i - 1].time - time) > 0) {
+        i--;
+    }
+
+    if (i > 0 && time - edges[i - 1].time < PLAYER_EDGE_GAP) {
+        mergeEdge(&edges[i - 1], on, off);
+        return;
+    }
+    if (i < edgeCount && edges[i].time - time < PLAYER_EDGE_GAP) {
+        mergeEdge(&edges[i], on, off);
+        return;
+    }
+
+    // fetchEvents() leaves room for anything one event or loop adds
+    assert(edgeCount < EDGE_QUEUE);
+    for (j = edgeCount; j > i; j--) {
+        edges[j] = edges[j - 1];
+    }
+    edges[i].time = time;
+    edges[i].onKeys = *on;
+    edges[i].offKeys = *off;
+    edgeCount++;
+}
+
+static void mergeEdge(struct Edge* edge, const struct KeySet* on, const struct KeySet* off) {
+    keySetDifference(&edge->onKeys, off);
+    keySetUnion(&edge->onKeys, on);
+    keySetDifference(&edge->offKeys, on);
+    keySetUnion(&edge->offKeys, off);
+}
+
+// Timestamp for tools/jitter.c, compiled out unless JITTER_CAPTURE is defined
+static void captureCycle() {
+#ifdef JITTER_CAPTURE
+    if (jitterCount < JITTER_CAPTURE) {
+        jitterCapture[jitterCount++] = DWT->CYCCNT;
+    }
+#endif
+}
@@ -0,0 +1,92 @@
+//------------------------------------------------------------------------------
+// Song Player
+//
+// Walks the event table of the active song. Each event is written to the keys
+// when its deadline expires, then the deadline of the next one is armed. Songs
+// in the internal flash are handed edge by edge to the DMA engine instead.
+//
+// Playing can start again from any bar, with the keys held there, and an A/B
+// loop repeats a run of bars for practice. A song with a bar index finds any
+// bar with one read and a scan of the bar. Songs without one are indexed as
+// they play, so going back to a bar already reached is a search and a short
+// scan rather than a walk from the start.
+//------------------------------------------------------------------------------
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <stdint.h>
+#include "keys.h"
+#include "songs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define PLAYER_SPEED_MIN 25 // Percent of the written tempo
+#define PLAYER_SPEED_MAX 400
+#define PLAYER_BAR_BEATS BEATS_PER_BAR
+#define PLAYER_EDGE_GAP 2 // Fewest microseconds between queued edges: the
+                          // DMA engine's timer stops at a reload of zero
+
+// Q22 factor that stretches times played at speed from to speed to, and a
+// time after pivot moved by it, to the nearest microsecond. The pivot itself
+// does not move.
+#define SPEED_RATIO(from, to) (((uint32_t) (from) << 22) / (uint32_t) (to))
+#define RETIME(time, pivot, ratio) \
+    ((pivot) + (uint32_t) (((uint64_t) ((time) - (pivot)) * (ratio) + (1UL << 21)) >> 22))
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Playback position in the active song, the only song state kept in RAM
+struct Song {
+    int tempo; // Quarter notes per minute, as the header gives it
+    int speed; // Percent of the written tempo, as set by setSpeed()
+    int segment; // Tempo segment of the beat last timed
+    int beat; // Beat of the next event
+    int cursor; // Index of the next event
+    int endOfSong;
+    struct KeySet held; // Keys down as played, before the event at cursor
+    int loopStart; // Beat an A/B loop goes back to
+    int loopEnd; // Beat it goes back from, 0 when not looping
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+// Clear to step every song from the scheduler, as with the KEY_CHAIN backend.
+// Read when a song starts.
+extern int playerUseDma;
+
+// Every event of a song plays transposed by playerTranspose keys, -12 to 12,
+// and with playerDouble set also an octave up, so one stored song plays in
+// any key or doubled. Read when a song starts.
+extern int playerTranspose;
+extern int playerDouble;
+
+#ifdef JITTER_CAPTURE
+// Define JITTER_CAPTURE as a record count to log the DWT cycle counter when a
+// song starts and after each event is written. Save jitterCapture from the
+// debugger once the song ends and pass it to tools/jitter.c.
+extern uint32_t jitterCapture[JITTER_CAPTURE];
+extern int jitterCount;
+#endif
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void playerInit(void);
+int playerStart(int index);
+int playerCue(int index, uint32_t beat);
+void playerPause(void);
+void playerResume(void);
+void playerStop(void);
+int playerStep(void);
+int playerSeek(int bar);
+int playerLoop(int from, int to);
+uint32_t playerPosition(void);
+int playerNextEdge(uint32_t* time, struct KeySet* onKeys, struct KeySet* offKeys);
+void setSpeed(int percent);
+uint32_t beatTime(int beat);
+
+#endif
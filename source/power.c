@@ -0,0 +1,100 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "power.h"
+#include "scheduler.h"
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+volatile uint32_t powerWorstLatency;
+volatile uint32_t powerWorstRefillLag;
+static volatile uint32_t wakeCycle;
+static volatile int wakePending;
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static void restoreClock(void);
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void powerInit() {
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+
+    // Low-power regulator in Stop, VREFINT off and not waited for on wakeup
+    PWR->CR &= ~PWR_CR_PDDS;
+    PWR->CR |= PWR_CR_LPSDSR | PWR_CR_ULP | PWR_CR_FWU;
+
+    // Cycle counter for the latency figure
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    powerWorstLatency = 0;
+    powerWorstRefillLag = 0;
+    wakePending = 0;
+}
+
+// Call with interrupts masked; a pending interrupt still ends WFI and is
+// taken once the caller unmasks
+void powerIdle(int deep) {
+    if (!deep) {
+        __WFI();
+        return;
+    }
+
+    PWR->CR |= PWR_CR_CWUF;
+    SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+    __WFI();
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+
+    // Stop falls back to MSI, bring the PLL back before any handler runs
+    restoreClock();
+}
+
+// Called from the deadline interrupt
+void powerMarkWake() {
+    wakeCycle = DWT->CYCCNT;
+    wakePending = 1;
+}
+
+// Called once the keys for that deadline have been written
+void powerMarkEdge() {
+    uint32_t latency;
+    if (wakePending) {
+        wakePending = 0;
+        latency = DWT->CYCCNT - wakeCycle;
+        if (latency > powerWorstLatency) {
+            powerWorstLatency = latency;
+        }
+    }
+}
+
+// Called from the DMA engine's transfer interrupt with the timer ticks since
+// the update that played the last slot of the half
+void powerMarkRefill(uint32_t ticks) {
+    uint32_t lag = (ticks + 1) * (SystemCoreClock / SCHED_TICK_HZ);
+
+    if (lag > powerWorstRefillLag) {
+        powerWorstRefillLag = lag;
+    }
+}
+
+// Same HSE x12 / 3 = 32 MHz setup as SystemInit(); the PLL settings in CFGR
+// survive Stop so only the oscillators and the switch need redoing
+static void restoreClock() {
+    RCC->CR |= RCC_CR_HSEON;
+    while (!(RCC->CR & RCC_CR_HSERDY)) {
+    }
+
+    RCC->CR |= RCC_CR_PLLON;
+    while (!(RCC->CR & RCC_CR_PLLRDY)) {
+    }
+
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | RCC_CFGR_SW_PLL;
+    while ((RCC->CFGR & RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) {
+    }
+}
@@ -0,0 +1,38 @@
+//------------------------------------------------------------------------------
+// Power Management
+//
+// The main loop idles in Sleep while a deadline or button sample is due, since
+// TIM2 and SysTick keep running there, and while a song is paused, as the
+// serial commands still need USART1. With nothing scheduled it drops to Stop
+// with the low-power regulator; GPIO outputs hold their levels and the EXTI
+// button lines wake the core.
+//------------------------------------------------------------------------------
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+// Worst cycles seen from a deadline interrupt to its key edge, not counting
+// the 12 cycle exception entry. Read it from the debugger watch window;
+// tools/jitter reports it from the cycle model.
+extern volatile uint32_t powerWorstLatency;
+
+// The DMA engine's timer writes its edges with no wake, so it has no such
+// latency. This is instead the worst cycles from the update that played the
+// last slot of a half buffer to the interrupt refilling it, to the next whole
+// timer tick: the margin the engine has before it replays stale slots.
+extern volatile uint32_t powerWorstRefillLag;
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void powerInit(void);
+void powerIdle(int deep);
+void powerMarkWake(void);
+void powerMarkEdge(void);
+void powerMarkRefill(uint32_t ticks);
+
+#endif
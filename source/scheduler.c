@@ -0,0 +1,178 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "power.h"
+#include "scheduler.h"
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define SCHED_EPOCH     0x00010000 // TIM2 is 16-bit, one overflow per epoch
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static volatile uint32_t schedEpoch;    // Time of the last TIM2 overflow (us)
+static volatile uint32_t schedDeadline; // Armed deadline (us)
+static volatile int schedArmed;
+static volatile int schedFlag;
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static void schedArm(void);
+
+//------------------------------------------------------------------------------
+// Interrupt Handlers
+//------------------------------------------------------------------------------
+void TIM2_IRQHandler(void) {
+    TRACE_ENTER(TRACE_TIM2);
+    if (TIM2->SR & TIM_SR_UIF) {
+        TIM2->SR = ~TIM_SR_UIF;
+        schedEpoch += SCHED_EPOCH;
+        schedArm();
+    }
+
+    if ((TIM2->DIER & TIM_DIER_CC1IE) && (TIM2->SR & TIM_SR_CC1IF)) {
+        TIM2->SR = ~TIM_SR_CC1IF;
+        TIM2->DIER &= ~TIM_DIER_CC1IE;
+        schedArmed = 0;
+        schedFlag = 1;
+        powerMarkWake();
+    }
+
+    NVIC_ClearPendingIRQ(TIM2_IRQn);
+    TRACE_EXIT(TRACE_TIM2);
+}
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void schedInit() {
+    RCC->APB1ENR |= RCC_APB1ENR_TIM2EN;
+
+    TIM2->CR1 = TIM_CR1_URS; // Only overflow raises an update interrupt
+    TIM2->PSC = (SystemCoreClock / SCHED_TICK_HZ) - 1;
+    TIM2->ARR = SCHED_EPOCH - 1;
+    TIM2->CCMR1 = 0; // Channel 1 frozen output compare, no pin
+    TIM2->EGR = TIM_EGR_UG; // Latch the prescaler
+    TIM2->SR = 0;
+    TIM2->DIER = TIM_DIER_UIE;
+
+    // Deadlines must be able to preempt the button handlers
+    NVIC_SetPriority(TIM2_IRQn, 0);
+    NVIC_ClearPendingIRQ(TIM2_IRQn);
+    NVIC_EnableIRQ(TIM2_IRQn);
+
+    schedStop();
+}
+
+// Restart the time base at zero
+void schedStart() {
+    __disable_irq();
+    TIM2->CR1 &= ~TIM_CR1_CEN;
+    TIM2->CNT = 0;
+    TIM2->SR = 0;
+    TIM2->DIER &= ~TIM_DIER_CC1IE;
+    schedEpoch = 0;
+    schedArmed = 0;
+    schedFlag = 0;
+    TIM2->CR1 |= TIM_CR1_CEN;
+    __enable_irq();
+}
+
+void schedStop() {
+    __disable_irq();
+    TIM2->CR1 &= ~TIM_CR1_CEN;
+    TIM2->DIER &= ~TIM_DIER_CC1IE;
+    schedArmed = 0;
+    schedFlag = 0;
+    __enable_irq();
+}
+
+// Zero the time base as schedStart() does but leave it stopped until
+// schedResume()
+void schedCue() {
+    schedStart();
+    schedPause();
+    TIM2->CNT = 0;
+}
+
+// Freeze the time base; the armed deadline is kept
+void schedPause() {
+    TIM2->CR1 &= ~TIM_CR1_CEN;
+}
+
+void schedResume() {
+    TIM2->CR1 |= TIM_CR1_CEN;
+}
+
+// Arm an absolute deadline in microseconds since schedStart()
+void schedAt(uint32_t deadline) {
+    __disable_irq();
+    schedDeadline = deadline;
+    schedArmed = 1;
+    schedFlag = 0;
+    if ((int32_t) (deadline - schedNow()) <= 0) {
+        schedArmed = 0;
+        schedFlag = 1;
+    } else {
+        schedArm();
+    }
+    __enable_irq();
+}
+
+uint32_t schedNow() {
+    uint32_t epoch, count;
+    do {
+        epoch = schedEpoch;
+        count = TIM2->CNT;
+    } while (epoch != schedEpoch);
+
+    // Overflow not serviced yet (interrupts masked by the caller)
+    if ((TIM2->SR & TIM_SR_UIF) && count < (SCHED_EPOCH / 2)) {
+        epoch += SCHED_EPOCH;
+    }
+
+    return epoch + count;
+}
+
+int schedPending() {
+    return schedFlag;
+}
+
+// Consume an expired deadline
+int schedPoll() {
+    if (schedFlag) {
+        schedFlag = 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+// Load the compare channel once the deadline falls inside the current epoch
+static void schedArm() {
+    uint32_t offset;
+    if (!schedArmed) {
+        return;
+    }
+
+    offset = schedDeadline - schedEpoch;
+    if (offset >= SCHED_EPOCH) {
+        return;
+    }
+
+    TIM2->CCR1 = offset;
+    TIM2->SR = ~TIM_SR_CC1IF;
+    TIM2->DIER |= TIM_DIER_CC1IE;
+
+    // Counter already past the compare value, the match would be missed
+    if (TIM2->CNT >= offset) {
+        TIM2->DIER &= ~TIM_DIER_CC1IE;
+        schedArmed = 0;
+        schedFlag = 1;
+    }
+}
@@ -0,0 +1,34 @@
+//------------------------------------------------------------------------------
+// Event Scheduler
+//
+// TIM2 free-runs at 1 MHz and is extended to a 32-bit microsecond time base in
+// software. A single deadline can be armed at a time; capture/compare channel 1
+// fires exactly when it is reached and sets a flag for the main loop.
+//------------------------------------------------------------------------------
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define SCHED_TICK_HZ   1000000
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void TIM2_IRQHandler(void);
+
+void schedInit(void);
+void schedStart(void);
+void schedCue(void);
+void schedStop(void);
+void schedPause(void);
+void schedResume(void);
+void schedAt(uint32_t deadline);
+uint32_t schedNow(void);
+int schedPending(void);
+int schedPoll(void);
+
+#endif
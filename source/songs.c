@@ -0,0 +1,205 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "songs.h"
+#include "spiflash.h"
+#include <stddef.h>
+#include <string.h>
+
+//------------------------------------------------------------------------------
+// Song Data
+//
+// Phrase code written by tools/phrasepack.c (see phrase.h), one op to a line
+// with the delta beats and keys it plays or the code it calls. Both songs are
+// Mary Had A Little Lamb: its bars come back as calls, and the 2-octave
+// arrangement is the 1-octave one layered 12 keys up. The last event only
+// marks the end of the song.
+//------------------------------------------------------------------------------
+static const uint8_t maryCode[] = {
+    // Mary Had A Little Lamb (1-Octave), 0-64
+    0x41, 0x04,                             // 1 on 4
+    0x21, 0x04,                             // 1 off 4
+    0x43, 0x02,                             // 3 on 2
+    0x21, 0x02,                             // 1 off 2
+    0x43, 0x00,                             // 3 on 0
+    0x21, 0x00,                             // 1 off 0
+    0x43, 0x02,                             // 3 on 2
+    0x21, 0x02,                             // 1 off 2
+    0xC2, 0x0C, 0x00, 0x04, 0x00, 0x02,     // 12-16 +2 x3
+    0x47, 0x02,                             // 7 on 2
+    0x21, 0x02,                             // 1 off 2
+    0xC0, 0x0C, 0x00, 0x04, 0x00, 0x01,     // 12-16 x2
+    0x47, 0x04,                             // 7 on 4
+    0x21, 0x04,                             // 1 off 4
+    0x85, 0x1A, 0x00, 0x06, 0x00,           // 26-32 +5
+    0x47, 0x04,                             // 7 on 4
+    0x80, 0x02, 0x00, 0x14, 0x00,           // 2-22
+    0x82, 0x04, 0x00, 0x08, 0x00,           // 4-12 +2
+    0x82, 0x08, 0x00, 0x08, 0x00,           // 8-16 +2
+    0x9E, 0x30, 0x00, 0x05, 0x00,           // 48-53 -2
+    0x0E,                                   // 14
+    // Mary Had A Little Lamb (2-Octave), 64-69
+    0xAC, 0x00, 0x00, 0x40, 0x00,           // 0-64 +12 layered
+};
+
+//------------------------------------------------------------------------------
+// Song Library
+//------------------------------------------------------------------------------
+const struct SongData songLibrary[] = {
+    SONG_CODE("Mary Had A Little Lamb (1-Octave)", 120, maryCode, 0, 64, 53),
+    SONG_CODE("Mary Had A Little Lamb (2-Octave)", 120, maryCode, 64, 69, 53)
+};
+
+const int numSongs = sizeof(songLibrary) / sizeof(songLibrary[0]);
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static const struct SongDirectory* directory; // In the internal flash
+static int directoryCount;
+static uint32_t flashSize; // Bytes in the SPI flash image, read at boot
+static int flashCount;
+static char flashName[SONG_NAME_BYTES]; // Of the last song loaded from SPI flash
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static int checkDirectory(const struct SongDirectory* image, uint32_t limit);
+static int checkHeader(const struct SongHeader* header, uint32_t size);
+static void fillSong(struct SongData* song, const struct SongHeader* header);
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// Only the directory headers are checked here so boot time does not grow with
+// the number of songs; each song is checked when it is loaded. Erased or
+// missing flash reads as all zeros or all ones and fails the magic check.
+void songsInit(const struct SongDirectory* image) {
+    struct SongDirectory header;
+
+    directory = NULL;
+    directoryCount = 0;
+    if (image && checkDirectory(image, SONG_DIR_SIZE)) {
+        directory = image;
+        directoryCount = image->count;
+    }
+
+    flashSize = 0;
+    flashCount = 0;
+    spiFlashRead(SONG_SPI_ADDRESS, &header, sizeof(header));
+    if (checkDirectory(&header, SONG_SPI_SIZE)) {
+        flashSize = header.size;
+        flashCount = header.count;
+    }
+}
+
+int songCount() {
+    return numSongs + directoryCount + flashCount;
+}
+
+// Returns 0 if there is no such song or its directory entry is damaged. A
+// song from the SPI flash has no events, tempos or bars pointer; the player
+// streams them from song->address, song->tempoAddress and song->barAddress,
+// and its name is only kept until the next one is loaded. Phrase code must
+// be read in place, as calls reach back, so it is refused there.
+int songLoad(int index, struct SongData* song) {
+    const uint8_t* base = (const uint8_t*) directory;
+    const struct SongHeader* header;
+    struct SongHeader copy;
+    uint32_t offset;
+
+    if (index < 0) {
+        return 0;
+    }
+    if (index < numSongs) {
+        *song = songLibrary[index];
+        return 1;
+    }
+
+    index -= numSongs;
+    if (index < directoryCount) {
+        offset = ((const uint32_t*) (directory + 1))[index];
+        if (offset % 4 || offset > directory->size ||
+            directory->size - offset < sizeof(struct SongHeader)) {
+            return 0;
+        }
+        header = (const struct SongHeader*) (base + offset);
+        if (!checkHeader(header, directory->size)) {
+            return 0;
+        }
+
+        fillSong(song, header);
+        if (header->codeBytes) {
+            song->code = base + header->events;
+        } else {
+            song->events = (const struct SongEvent*) (base + header->events);
+        }
+        song->tempos = (const struct TempoChange*) (base + header->tempos);
+        if (song->barCount) {
+            song->bars = (const struct SongBar*) (base + header->bars);
+        }
+        return 1;
+    }
+
+    index -= directoryCount;
+    if (index >= flashCount) {
+        return 0;
+    }
+
+    spiFlashRead(SONG_SPI_ADDRESS + sizeof(struct SongDirectory) + index * sizeof(uint32_t),
+        &offset, sizeof(offset));
+    if (offset % 4 || offset > flashSize || flashSize - offset < sizeof(struct SongHeader)) {
+        return 0;
+    }
+    spiFlashRead(SONG_SPI_ADDRESS + offset, &copy, sizeof(copy));
+    if (!checkHeader(&copy, flashSize) || copy.codeBytes) {
+        return 0;
+    }
+
+    memcpy(flashName, copy.name, SONG_NAME_BYTES);
+    fillSong(song, &copy);
+    song->name = flashName;
+    song->address = SONG_SPI_ADDRESS + copy.events;
+    song->tempos = NULL;
+    song->tempoAddress = SONG_SPI_ADDRESS + copy.tempos;
+    song->barAddress = SONG_SPI_ADDRESS + copy.bars;
+    return 1;
+}
+
+static int checkDirectory(const struct SongDirectory* image, uint32_t limit) {
+    return image->magic == SONG_DIR_MAGIC && image->version == SONG_DIR_VERSION &&
+        image->size <= limit &&
+        sizeof(struct SongDirectory) + image->count * sizeof(uint32_t) <= image->size;
+}
+
+// Events or code, tempo changes and the bar index must lie inside an image
+// of size bytes
+static int checkHeader(const struct SongHeader* header, uint32_t size) {
+    return !(header->events % 4) && header->length && header->tempo &&
+        !header->name[SONG_NAME_BYTES - 1] && header->events <= size &&
+        (header->codeBytes ? header->codeBytes <= size - header->events :
+        header->length <= (size - header->events) / sizeof(struct SongEvent)) &&
+        (!header->tempoCount || (!(header->tempos % 4) && header->tempos <= size &&
+        header->tempoCount <= (size - header->tempos) / sizeof(struct TempoChange))) &&
+        (!header->barCount || (!(header->bars % 4) && header->bars <= size &&
+        header->barCount <= (size - header->bars) / sizeof(struct SongBar)));
+}
+
+static void fillSong(struct SongData* song, const struct SongHeader* header) {
+    song->name = header->name;
+    song->tempo = header->tempo;
+    song->beatLength = header->beatLength;
+    song->length = (int) header->length;
+    song->lowKey = header->lowKey;
+    song->highKey = header->highKey;
+    song->events = NULL;
+    song->address = 0;
+    song->code = NULL;
+    song->codeStart = 0;
+    song->codeEnd = header->codeBytes;
+    song->tempoCount = (int) header->tempoCount;
+    song->tempoAddress = 0;
+    song->bars = NULL;
+    song->barCount = header->codeBytes ? 0 : (int) header->barCount; // Code needs a mark
+    song->barAddress = 0;
+}
@@ -0,0 +1,171 @@
+//------------------------------------------------------------------------------
+// Song Library
+//
+// Songs are flash-resident event tables walked by the player in player.c, or
+// phrase code that writes each repeated passage once (see phrase.h). The
+// few built into songs.c come first; after them come the songs of a directory
+// image that tools/songpack.c builds and that is flashed on its own to the
+// upper half of the part, and last the songs of a second image of the same
+// layout at the start of the external SPI flash, which are streamed rather
+// than read in place (see stream.h). Songs are numbered across all three and
+// any one is found in constant time.
+//
+// A song keeps its header tempo up to its first tempo change, if it has any.
+// Each change sets the beat length from its beat on, so ritardandos and
+// tempo changes play as written. The tools also store the time each change
+// starts at, so the player reads a map of any length in place and times a
+// beat from its change alone, with integer math only (see beatTime() in
+// player.c).
+//
+// Events address NUM_KEYS keys, two octaves, in every build; the KEY_CHAIN
+// backend places them at KEY_BASE (see keys.h).
+//
+// songpack also indexes where each bar of an event table starts, so playing
+// can start from any bar with one read and a scan of that bar. Phrase code
+// and the tables built into songs.c have no bar index; the player indexes
+// them as they play instead.
+//
+// Directory image, little-endian:
+//   struct SongDirectory
+//   uint32_t offsets[count]   byte offset of each SongHeader
+//   SongHeader, then SongEvent records or phrase code, then TempoChange
+//   records, then SongBar records, each word aligned
+//------------------------------------------------------------------------------
+#ifndef SONGS_H
+#define SONGS_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define KEY(k)              (1UL << (k)) // Keys 0-11 on PB0-11, 12-23 on PC0-11
+#define KEY_MASK            0x00FFFFFF
+#define EVENT(delta, on, off) { ((uint32_t) (delta) << 24) | (on), (off) }
+#define EVENT_DELTA(event)  ((int) ((event)->onKeys >> 24))
+#define SONG_LENGTH(events) ((int) (sizeof(events) / sizeof(events[0])))
+#define TEMPO_START(change) (((uint64_t) (change)->startHigh << 32) | (change)->start)
+#define BEATS_PER_QUARTER   4 // Song beats are sixteenth notes
+#define BEATS_PER_BAR       (4 * BEATS_PER_QUARTER) // Songs carry no meter: 4/4
+#define BAR_OFFSET(bar)     ((uint32_t) ((bar)->held >> 24))
+
+// Microseconds per beat in Q24.8, folded by the compiler so nothing is
+// divided at boot. Whole and fractional parts keep it in 32-bit math.
+#define BEAT_DIVISOR(bpm)   ((uint32_t) (bpm) * BEATS_PER_QUARTER)
+#define BEAT_LENGTH(bpm)    (((60000000UL / BEAT_DIVISOR(bpm)) << 8) | \
+                            (((60000000UL % BEAT_DIVISOR(bpm)) << 8) / BEAT_DIVISOR(bpm)))
+
+// Library entry for an event table that may use any key
+#define SONG(title, bpm, events) \
+    { (title), (bpm), BEAT_LENGTH(bpm), (events), SONG_LENGTH(events), 0, 23, 0, 0, 0, 0, \
+    0, 0, 0, 0, 0, 0 }
+
+// The same with a table of TempoChange records, in beat order, as midi2song
+// writes them
+#define SONG_TEMPOS(title, bpm, events, tempos) \
+    { (title), (bpm), BEAT_LENGTH(bpm), (events), SONG_LENGTH(events), 0, 23, 0, \
+    (tempos), SONG_LENGTH(tempos), 0, 0, 0, 0, 0, 0, 0 }
+
+// A song of length events in phrase code, from start to end of code, as
+// written by tools/phrasepack.c
+#define SONG_CODE(title, bpm, code, start, end, length) \
+    { (title), (bpm), BEAT_LENGTH(bpm), 0, (length), 0, 23, 0, 0, 0, 0, (code), (start), (end), \
+    0, 0, 0 }
+#define SONG_CODE_TEMPOS(title, bpm, code, start, end, length, tempos) \
+    { (title), (bpm), BEAT_LENGTH(bpm), 0, (length), 0, 23, 0, (tempos), SONG_LENGTH(tempos), \
+    0, (code), (start), (end), 0, 0, 0 }
+
+#ifndef SONG_DIR_ADDRESS
+#define SONG_DIR_ADDRESS    0x08020000 // Firmware is linked below this
+#endif
+#define SONG_DIR_SIZE       0x00020000
+#define SONG_DIR_MAGIC      0x44534D50 // "PMSD"
+#define SONG_DIR_VERSION    5 // Songs may carry a bar index
+#define SONG_NAME_BYTES     32
+#define SONG_SPI_ADDRESS    0x00000000 // Directory image in the SPI flash
+#define SONG_SPI_SIZE       0x00800000 // An 8 MB part
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Packed into two words: beats since the previous event share the top byte of
+// onKeys, longer gaps are split with empty records
+struct SongEvent {
+    uint32_t onKeys;
+    uint32_t offKeys;
+};
+
+// From its beat on, each beat of the song lasts beatLength. start sums the
+// header tempo and the changes before it, to the fraction of a microsecond so
+// a long map does not drift; see TEMPO_START().
+struct TempoChange {
+    uint32_t beat; // Beats since the song started
+    uint32_t beatLength; // Microseconds per beat, Q24.8
+    uint32_t start; // Microseconds from the song start to beat, Q.8: low word
+    uint32_t startHigh; // and high word
+};
+
+// Where a bar of an event table starts: the first event at or after its
+// first beat, and the keys held going into it. Events are at most 255 beats
+// apart, so the event's beats past the bar's first fit in the top byte.
+struct SongBar {
+    uint32_t event;
+    uint32_t held; // Song keys, with the beats past in the top byte: see BAR_OFFSET()
+};
+
+struct SongData {
+    const char* name;
+    int tempo; // Quarter notes per minute
+    uint32_t beatLength; // Microseconds per beat, Q24.8
+    const struct SongEvent* events;
+    int length;
+    int lowKey; // Lowest and highest key the song presses
+    int highKey;
+    uint32_t address; // SPI flash address of the events when events is NULL
+    const struct TempoChange* tempos; // After the header tempo, in beat order
+    int tempoCount;
+    uint32_t tempoAddress; // SPI flash address of the changes when tempos is NULL
+    const uint8_t* code; // Phrase code in place of events when not NULL, see phrase.h
+    uint32_t codeStart; // The song's own code; calls may reach before it
+    uint32_t codeEnd;
+    const struct SongBar* bars; // Bar index from bar 0, NULL when there is none or it is streamed
+    int barCount; // 0 for none
+    uint32_t barAddress; // SPI flash address of the bar index when bars is NULL
+};
+
+struct SongDirectory {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t size; // Bytes in the whole image
+};
+
+struct SongHeader {
+    char name[SONG_NAME_BYTES]; // Zero padded and terminated
+    uint16_t tempo;
+    uint8_t lowKey;
+    uint8_t highKey;
+    uint32_t beatLength;
+    uint32_t length; // Events
+    uint32_t events; // Byte offset of the first event
+    uint32_t tempoCount; // Tempo changes, 0 for one tempo throughout
+    uint32_t tempos; // Byte offset of the first change
+    uint32_t codeBytes; // Phrase code at events in place of records, 0 for none
+    uint32_t barCount; // Bar index entries, 0 for none
+    uint32_t bars; // Byte offset of the first
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+extern const struct SongData songLibrary[];
+extern const int numSongs; // Built into songs.c
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void songsInit(const struct SongDirectory* directory);
+int songCount(void);
+int songLoad(int index, struct SongData* song);
+
+#endif
@@ -0,0 +1,132 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "spiflash.h"
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static volatile int busy;
+static volatile uint32_t startCycle;
+static volatile uint32_t readCycles; // Length of the last completed read
+
+//------------------------------------------------------------------------------
+// Interrupt Handlers
+//------------------------------------------------------------------------------
+// Receive-only mode keeps clocking until SPE is cleared, so a byte or two
+// past the end may be read; that is harmless for a read command and the
+// extra data is dropped with the overrun flag
+void DMA1_Channel4_IRQHandler(void) {
+    if (DMA1->ISR & DMA_ISR_TCIF4) {
+        DMA1->IFCR = DMA_IFCR_CGIF4;
+        SPI2->CR1 &= ~(SPI_CR1_SPE | SPI_CR1_RXONLY);
+        GPIOB->BSRR = SPI_FLASH_CS;
+        DMA1_Channel4->CCR = 0;
+        SPI2->CR2 = 0;
+        (void) SPI2->DR;
+        (void) SPI2->SR;
+
+        readCycles = DWT->CYCCNT - startCycle;
+        busy = 0;
+    }
+
+    NVIC_ClearPendingIRQ(DMA1_Channel4_IRQn);
+}
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void spiFlashInit() {
+    RCC->AHBENR |= RCC_AHBENR_GPIOBEN | RCC_AHBENR_DMA1EN;
+    RCC->APB1ENR |= RCC_APB1ENR_SPI2EN;
+
+    // PB12 output idling high, PB13-15 alternate function 5 at 40 MHz
+    GPIOB->BSRR = SPI_FLASH_CS;
+    GPIOB->MODER &= ~(0xFF000000);
+    GPIOB->MODER |= (0xA9000000);
+    GPIOB->OTYPER &= ~(0x0000F000);
+    GPIOB->OSPEEDR |= (0xFF000000);
+    GPIOB->PUPDR &= ~(0xFF000000);
+    GPIOB->AFR[1] &= ~(0xFFF00000);
+    GPIOB->AFR[1] |= (0x55500000);
+
+    // Master, mode 0, MSB first, PCLK1 / 2, chip select driven by hand.
+    // Enabled for each read.
+    SPI2->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI;
+    SPI2->CR2 = 0;
+
+    DMA1_Channel4->CCR = 0;
+    DMA1_Channel4->CPAR = (uintptr_t) &SPI2->DR;
+
+    // Same level as the buttons, below the TIM2 deadlines
+    NVIC_SetPriority(DMA1_Channel4_IRQn, 1);
+    NVIC_ClearPendingIRQ(DMA1_Channel4_IRQn);
+    NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+
+    busy = 0;
+}
+
+// Start reading length bytes at address into buffer and return at once. A
+// read still in flight is waited for first.
+void spiFlashStart(uint32_t address, void* buffer, uint32_t length) {
+    uint32_t command = ((uint32_t) SPI_FLASH_READ << 24) | (address & 0x00FFFFFF);
+    int i;
+
+    spiFlashWait();
+    if (!length) {
+        return;
+    }
+
+    busy = 1;
+    startCycle = DWT->CYCCNT;
+    GPIOB->BSRR = SPI_FLASH_CS << 16;
+    SPI2->CR1 |= SPI_CR1_SPE;
+
+    for (i = 24; i >= 0; i -= 8) {
+        SPI2->DR = (command >> i) & 0xFF;
+        while (!(SPI2->SR & SPI_SR_RXNE)) {
+        }
+        (void) SPI2->DR;
+    }
+    while (SPI2->SR & SPI_SR_BSY) {
+    }
+
+    // Receive-only mode clocks the data in with nothing to send, which
+    // leaves channel 5 (SPI2_TX) free for USART1_RX
+    SPI2->CR1 &= ~SPI_CR1_SPE;
+    DMA1_Channel4->CMAR = (uintptr_t) buffer;
+    DMA1_Channel4->CNDTR = length;
+    DMA1_Channel4->CCR = DMA_CCR1_PL | DMA_CCR1_MINC | DMA_CCR1_TCIE | DMA_CCR1_EN;
+    SPI2->CR2 = SPI_CR2_RXDMAEN;
+    SPI2->CR1 |= SPI_CR1_RXONLY | SPI_CR1_SPE;
+}
+
+void spiFlashRead(uint32_t address, void* buffer, uint32_t length) {
+    spiFlashStart(address, buffer, length);
+    spiFlashWait();
+}
+
+// Sleeps until the DMA interrupt. Interrupts are masked around the check so
+// the wakeup cannot fall between it and WFI. Reads run from setup() with
+// interrupts still off, so the caller's mask is restored, not forced on.
+void spiFlashWait() {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    while (busy) {
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    __set_PRIMASK(primask);
+}
+
+int spiFlashBusy() {
+    return busy;
+}
+
+// Core cycles from the chip select going low to the last byte landing
+uint32_t spiFlashLastRead() {
+    return readCycles;
+}
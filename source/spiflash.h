@@ -0,0 +1,33 @@
+//------------------------------------------------------------------------------
+// External SPI NOR Flash
+//
+// A 25-series NOR part (W25Q64 or similar) on SPI2: PB12 chip select, PB13
+// SCK, PB14 MISO and PB15 MOSI, clocked at 16 MHz. The read command and
+// address are sent by hand, then the SPI switches to receive-only and DMA1
+// channel 4 (SPI2_RX) moves the data. Only reads are made; the part is
+// programmed off the board.
+//------------------------------------------------------------------------------
+#ifndef SPIFLASH_H
+#define SPIFLASH_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define SPI_FLASH_READ  0x03 // Read data, 24-bit address, no dummy cycles
+#define SPI_FLASH_CS    0x00001000 // PB12
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void DMA1_Channel4_IRQHandler(void);
+
+void spiFlashInit(void);
+void spiFlashStart(uint32_t address, void* buffer, uint32_t length);
+void spiFlashRead(uint32_t address, void* buffer, uint32_t length);
+void spiFlashWait(void);
+int spiFlashBusy(void);
+uint32_t spiFlashLastRead(void);
+
+#endif
@@ -0,0 +1,144 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "store.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define PEKEY1          0x89ABCDEF // Unlock sequence for PECR
+#define PEKEY2          0x02030405
+#define NVM_ERRORS      (FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_SIZERR)
+#define NO_BEAT         0xFFFFFFFF // Record of a song not paused
+
+// Record words, the check last as it is written last
+#define SEQUENCE        0
+#define SETTINGS        1 // Song ID, then speed in the high half
+#define POSITION        2 // Beat, or NO_BEAT
+#define CHECK           3 // Mode, arrangement, then a hash of the rest
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+uint32_t storeWrites;
+
+static int newest; // Slot of the newest good record, -1 for none
+static uint32_t sequence; // Its sequence number
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static volatile uint32_t* slotAt(int slot);
+static uint32_t check(const volatile uint32_t* record, uint32_t low);
+static int program(volatile uint32_t* word, uint32_t value);
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// Reads every slot to find the newest good record
+void storeInit() {
+    const volatile uint32_t* record;
+    int slot;
+
+    newest = -1;
+    sequence = 0;
+    for (slot = 0; slot < (int) STORE_SLOTS; slot++) {
+        record = slotAt(slot);
+        if (record[CHECK] != check(record, record[CHECK] & 0xFF)) {
+            continue;
+        }
+        if (newest < 0 || (int32_t) (record[SEQUENCE] - sequence) > 0) {
+            newest = slot;
+            sequence = record[SEQUENCE];
+        }
+    }
+}
+
+// Returns 0 if nothing has been saved
+int storeLoad(struct StoreState* state) {
+    const volatile uint32_t* record;
+
+    if (newest < 0) {
+        return 0;
+    }
+
+    record = slotAt(newest);
+    state->songID = (int) (record[SETTINGS] & 0xFFFF);
+    state->speed = (int) (record[SETTINGS] >> 16);
+    state->mode = (int) (record[CHECK] & 0xF);
+    state->arrangement = (int) ((record[CHECK] >> 4) & 0xF);
+    state->paused = record[POSITION] != NO_BEAT;
+    state->beat = state->paused ? record[POSITION] : 0;
+    return 1;
+}
+
+// Writes a record unless the newest already holds state. Returns 0 if a word
+// would not program; the newest good record is still the last one saved.
+int storeSave(const struct StoreState* state) {
+    volatile uint32_t* record;
+    uint32_t settings, position, low, hash;
+    int slot, ok;
+
+    settings = ((uint32_t) state->songID & 0xFFFF) | ((uint32_t) state->speed << 16);
+    position = state->paused ? state->beat : NO_BEAT;
+    low = ((uint32_t) state->mode & 0xF) | (((uint32_t) state->arrangement & 0xF) << 4);
+    if (newest >= 0) {
+        record = slotAt(newest);
+        if (record[SETTINGS] == settings && record[POSITION] == position &&
+            (record[CHECK] & 0xFF) == low) {
+            return 1;
+        }
+    }
+
+    slot = newest < 0 ? 0 : (newest + 1) % (int) STORE_SLOTS;
+    record = slotAt(slot);
+
+    FLASH->PEKEYR = PEKEY1;
+    FLASH->PEKEYR = PEKEY2;
+    ok = program(&record[SEQUENCE], sequence + 1) && program(&record[SETTINGS], settings) &&
+        program(&record[POSITION], position);
+    if (ok) {
+        hash = check(record, low);
+        ok = program(&record[CHECK], hash);
+    }
+    FLASH->PECR |= FLASH_PECR_PELOCK;
+
+    if (!ok) {
+        return 0;
+    }
+    newest = slot;
+    sequence++;
+    return 1;
+}
+
+static volatile uint32_t* slotAt(int slot) {
+    return (volatile uint32_t*) (DATA_EEPROM_BASE + slot * 4 * STORE_RECORD_WORDS);
+}
+
+// The erased EEPROM reads as zeros, which never check
+static uint32_t check(const volatile uint32_t* record, uint32_t low) {
+    uint32_t hash = 0x811C9DC5 ^ low;
+
+    hash = (hash ^ record[SEQUENCE]) * 0x01000193;
+    hash = (hash ^ record[SETTINGS]) * 0x01000193;
+    hash = (hash ^ record[POSITION]) * 0x01000193;
+    return (hash & 0xFFFFFF00) | low;
+}
+
+// A word already holding value is left alone, which spares its wear
+static int program(volatile uint32_t* word, uint32_t value) {
+    if (*word == value) {
+        return 1;
+    }
+
+    *word = value;
+    while (FLASH->SR & FLASH_SR_BSY) {
+    }
+    storeWrites++;
+    if (FLASH->SR & NVM_ERRORS) {
+        FLASH->SR = NVM_ERRORS;
+        return 0;
+    }
+    return *word == value;
+}
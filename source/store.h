@@ -0,0 +1,54 @@
+//------------------------------------------------------------------------------
+// Saved State
+//
+// Keeps the song, mode, arrangement and speed, and where a paused song was
+// left, in the data EEPROM so the board comes back after a power cycle as it
+// was. Each save writes one record to the next slot of a ring over the whole
+// EEPROM, so every word wears alike; words that already hold their value are
+// not written. A record's check word is written last, so one torn by a power
+// loss fails its check and the one before it stands.
+//
+// storeInit() reads every slot once at boot and keeps the newest good record,
+// in the same time whatever was saved. A word takes a few milliseconds to
+// program with the core stalled, so saves must not be made while a song
+// plays.
+//------------------------------------------------------------------------------
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define STORE_RECORD_WORDS 4
+#define STORE_SLOTS     ((DATA_EEPROM_END - DATA_EEPROM_BASE + 1) / (4 * STORE_RECORD_WORDS))
+#define STORE_ENDURANCE 300000 // Program cycles per word the datasheet gives
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct StoreState {
+    int songID;
+    int mode;
+    int arrangement;
+    int speed; // Percent of the written tempo
+    int paused; // A song was paused at beat
+    uint32_t beat;
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+// Words programmed since boot. Read it from the debugger watch window.
+extern uint32_t storeWrites;
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void storeInit(void);
+int storeLoad(struct StoreState* state);
+int storeSave(const struct StoreState* state);
+
+#endif
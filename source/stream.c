@@ -0,0 +1,128 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "spiflash.h"
+#include "stream.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define BLOCK_BYTES     (STREAM_BLOCK_EVENTS * sizeof(struct SongEvent))
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+struct StreamStats streamStats;
+
+static struct SongEvent buffers[2][STREAM_BLOCK_EVENTS]; // Block n in buffers[n & 1]
+static uint32_t base; // Flash address of the first event
+static int length; // Events in the song
+static int current; // Block the player is in
+static int fetching; // Block being read into the other buffer, -1 if none
+static struct TempoChange tempos[STREAM_TEMPO_CHANGES]; // From change tempoFirst on
+static uint32_t tempoBase; // Flash address of the first change
+static int tempoCount;
+static int tempoFirst; // -1 until a window is read
+static uint32_t barBase; // Flash address of the bar index
+static struct SongBar barEntry; // The entry read last
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static void fetch(int block);
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// The first block is read before returning, the second is started
+void streamOpen(const struct SongData* song) {
+    base = song->address;
+    length = song->length;
+    tempoBase = song->tempoAddress;
+    tempoCount = song->tempoCount;
+    tempoFirst = -1;
+    barBase = song->barAddress;
+    streamStats.refills = 0;
+    streamStats.underruns = 0;
+    streamStats.worstRefill = 0;
+    streamStats.worstWait = 0;
+
+    fetch(0);
+    spiFlashWait();
+    current = 0;
+    fetch(1);
+}
+
+// The player reads in order, asking only for the block it is in or the next,
+// so the block before can be overwritten as soon as the next one is entered.
+// Any other block is read while the player waits.
+const struct SongEvent* streamEvent(int index) {
+    int block = index / STREAM_BLOCK_EVENTS;
+    uint32_t start;
+
+    if (block != current) {
+        if (block != fetching) {
+            fetch(block);
+        }
+        if (spiFlashBusy()) {
+            streamStats.underruns++;
+            start = DWT->CYCCNT;
+            spiFlashWait();
+            start = DWT->CYCCNT - start;
+            if (start > streamStats.worstWait) {
+                streamStats.worstWait = start;
+            }
+        }
+        if (spiFlashLastRead() > streamStats.worstRefill) {
+            streamStats.worstRefill = spiFlashLastRead();
+        }
+
+        current = block;
+        fetch(block + 1);
+    }
+
+    return &buffers[block & 1][index % STREAM_BLOCK_EVENTS];
+}
+
+// Only good until the next call, which may read another window over it. The
+// window is read from index on, so the changes after it follow in order.
+const struct TempoChange* streamTempo(int index) {
+    int count;
+
+    if (tempoFirst < 0 || index < tempoFirst || index >= tempoFirst + STREAM_TEMPO_CHANGES) {
+        count = tempoCount - index;
+        if (count > STREAM_TEMPO_CHANGES) {
+            count = STREAM_TEMPO_CHANGES;
+        }
+        spiFlashRead(tempoBase + index * sizeof(struct TempoChange), tempos,
+            count * sizeof(struct TempoChange));
+        tempoFirst = index;
+    }
+
+    return &tempos[index - tempoFirst];
+}
+
+// Only good until the next call
+const struct SongBar* streamBar(int bar) {
+    spiFlashRead(barBase + bar * sizeof(struct SongBar), &barEntry, sizeof(barEntry));
+    return &barEntry;
+}
+
+// Starts reading a block; does nothing past the end of the song
+static void fetch(int block) {
+    int remaining = length - block * STREAM_BLOCK_EVENTS;
+
+    fetching = -1;
+    if (remaining <= 0) {
+        return;
+    }
+
+    if (remaining > STREAM_BLOCK_EVENTS) {
+        remaining = STREAM_BLOCK_EVENTS;
+    }
+    spiFlashStart(base + block * BLOCK_BYTES, buffers[block & 1],
+        remaining * sizeof(struct SongEvent));
+    fetching = block;
+    streamStats.refills++;
+}
@@ -0,0 +1,51 @@
+//------------------------------------------------------------------------------
+// Song Event Stream
+//
+// Feeds the player the events of a song held in the external SPI flash. Two
+// RAM blocks are used in turn: while the player walks one, the next block of
+// the song is read into the other by DMA. Reaching a block that has not
+// finished loading is an underrun; the player then waits for it and is late.
+//
+// The song's tempo changes are read a window at a time. The player times
+// beats in order, so it moves on to the next window only every
+// STREAM_TEMPO_CHANGES changes; a seek may ask for any change and waits for
+// its window. A seek reads the song's bar index one entry at a time, too.
+//------------------------------------------------------------------------------
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+#include "songs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define STREAM_BLOCK_EVENTS 32 // A power of two, 256 bytes a block
+#define STREAM_TEMPO_CHANGES 8 // 128 bytes a window
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Read them from the debugger watch window; cleared when a song starts
+struct StreamStats {
+    uint32_t refills; // Blocks read
+    uint32_t underruns; // Blocks the player reached before they were read
+    uint32_t worstRefill; // Most core cycles taken to read one block
+    uint32_t worstWait; // Most core cycles the player waited in an underrun
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+extern struct StreamStats streamStats;
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void streamOpen(const struct SongData* song);
+const struct SongEvent* streamEvent(int index);
+const struct TempoChange* streamTempo(int index);
+const struct SongBar* streamBar(int bar);
+
+#endif
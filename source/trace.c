@@ -0,0 +1,142 @@
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+#include "STM32L1xx.h"
+#include "live.h"
+#include "trace.h"
+
+#ifdef TRACE
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define PACKET_HEADER   ((TRACE_PORT << 3) | 0x03) // ITM software packet of 4 bytes
+#define SYNC_ZEROS      5 // Then 0x80, an ITM sync packet
+#define TX_PIN          0x00000200 // PA9, also the state LED
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+struct TraceLog traceLog;
+
+//------------------------------------------------------------------------------
+// Local Function Prototypes
+//------------------------------------------------------------------------------
+static uint32_t takeRecord(void);
+#ifdef TRACE_UART
+static void drainUart(void);
+static void sendByte(uint8_t byte);
+#endif
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// powerInit() has already started the cycle counter
+void traceInit() {
+    traceLog.head = 0;
+    traceLog.tail = 0;
+    traceLog.lost = 0;
+
+#ifdef TRACE_UART
+    // USART1_TX is alternate function 7 of PA9, selected only while draining
+    GPIOA->AFR[1] &= ~(0x000000F0);
+    GPIOA->AFR[1] |= (0x00000070);
+#endif
+}
+
+// Called from handlers of any priority, so the slot is claimed with
+// interrupts masked. The caller's mask is restored, not forced on.
+void traceRecord(uint32_t point) {
+    uint32_t primask = __get_PRIMASK();
+    uint32_t record = (point << 24) | (DWT->CYCCNT & 0x00FFFFFF);
+
+    __disable_irq();
+    traceLog.records[traceLog.head & (TRACE_SIZE - 1)] = record;
+    traceLog.head++;
+    if (traceLog.head - traceLog.tail > TRACE_SIZE) {
+        traceLog.tail++;
+        traceLog.lost++;
+    }
+    __set_PRIMASK(primask);
+}
+
+// Send everything recorded so far to the ITM port if a debugger opened it.
+// Built with TRACE_UART, else out of USART1 on PA9 while nothing else has
+// the USART enabled and the state LED on the pin is off.
+void traceDrain() {
+    uint32_t record;
+
+    if (traceLog.tail == traceLog.head) {
+        return;
+    }
+
+    if ((ITM->TCR & ITM_TCR_ITMENA_Msk) && (ITM->TER & (1UL << TRACE_PORT))) {
+        while (traceLog.tail != traceLog.head) {
+            record = takeRecord();
+            while (ITM->PORT[TRACE_PORT].u32 == 0) {
+            }
+            ITM->PORT[TRACE_PORT].u32 = record;
+        }
+        return;
+    }
+
+#ifdef TRACE_UART
+    if (!(USART1->CR1 & USART_CR1_UE) && !(GPIOA->ODR & TX_PIN)) {
+        drainUart();
+    }
+#endif
+}
+
+static uint32_t takeRecord() {
+    uint32_t record;
+
+    __disable_irq();
+    record = traceLog.records[traceLog.tail & (TRACE_SIZE - 1)];
+    traceLog.tail++;
+    __enable_irq();
+    return record;
+}
+
+#ifdef TRACE_UART
+// The same packets as ITM, led by a sync packet. PA9 is an alternate
+// function only until the last byte has left the line.
+static void drainUart() {
+    uint32_t record;
+    int i;
+
+    RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
+    USART1->BRR = SystemCoreClock / LIVE_BAUD;
+    USART1->CR3 = 0;
+    USART1->CR1 = USART_CR1_UE | USART_CR1_TE;
+    GPIOA->MODER &= ~(0x000C0000);
+    GPIOA->MODER |= (0x00080000);
+
+    for (i = 0; i < SYNC_ZEROS; i++) {
+        sendByte(0x00);
+    }
+    sendByte(0x80);
+    while (traceLog.tail != traceLog.head) {
+        record = takeRecord();
+        sendByte(PACKET_HEADER);
+        sendByte((uint8_t) record);
+        sendByte((uint8_t) (record >> 8));
+        sendByte((uint8_t) (record >> 16));
+        sendByte((uint8_t) (record >> 24));
+    }
+
+    while (!(USART1->SR & USART_SR_TC)) {
+    }
+    GPIOA->MODER &= ~(0x000C0000);
+    GPIOA->MODER |= (0x00040000);
+    USART1->CR1 = 0;
+    RCC->APB2ENR &= ~RCC_APB2ENR_USART1EN;
+}
+
+static void sendByte(uint8_t byte) {
+    while (!(USART1->SR & USART_SR_TXE)) {
+    }
+    USART1->DR = byte;
+}
+#endif
+
+#endif
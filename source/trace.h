@@ -0,0 +1,86 @@
+//------------------------------------------------------------------------------
+// Tracepoints
+//
+// Built only when TRACE is defined. Each tracepoint stores one word in a RAM
+// ring buffer: the point number and an entry flag in the top byte, the low 24
+// bits of the DWT cycle counter below it. The main loop drains the ring to ITM
+// stimulus port 1 whenever a debugger has enabled it. The newest TRACE_SIZE
+// records also stay in traceLog for a memory dump. tools/tracedump.c decodes
+// either into cycle histograms.
+//
+// With no debugger, define TRACE_UART as well to send the records out of
+// USART1 (TX only, 8N1 at LIVE_BAUD) as the same ITM packets led by a sync
+// packet, so a serial adapter can capture them. USART1_TX has no free pin:
+// PA9 drives the PLAY state LED and PB6 a key. So PA9 is only borrowed
+// while its LED is off, at HOME, and while no live or MIDI input has the
+// USART. The LED glows with the idle line during a drain, and between
+// drains the adapter sees the LED's low level as a break. The main loop
+// waits on a drain, about 13 ms for a full ring.
+//
+// SWO shares PB3 with key 3, so key 3 does not play while SWO is routed out.
+// Built with KEY_CHAIN, PB3 clocks the latches instead; read traceLog from
+// RAM there.
+//------------------------------------------------------------------------------
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define TRACE_SIZE      256 // Records, a power of two
+#define TRACE_PORT      1 // ITM stimulus port
+#define TRACE_ENTRY     0x80 // Set on entry records
+
+// Point numbers, also listed in tools/tracedump.c
+#define TRACE_EXTI0     0
+#define TRACE_EXTI1     1
+#define TRACE_EXTI2     2
+#define TRACE_EXTI3     3
+#define TRACE_TIM2      4 // Scheduler interrupt
+#define TRACE_SYSTICK   5 // Button debounce sample
+#define TRACE_BUTTONS   6 // Main loop acting on presses
+#define TRACE_STEP      7 // Player writing one event
+#define TRACE_KEYS      8 // updateKeys()
+#define TRACE_KEYS_OFF  9 // deactivateAllKeys()
+#define TRACE_LIVE      10 // livePoll()
+#define TRACE_USART1    11 // Serial input interrupt
+
+#ifdef TRACE
+#define TRACE_ENTER(point)  traceRecord((point) | TRACE_ENTRY)
+#define TRACE_EXIT(point)   traceRecord(point)
+#else
+#define TRACE_ENTER(point)
+#define TRACE_EXIT(point)
+#define traceInit()
+#define traceDrain()
+#endif
+
+#ifdef TRACE
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct TraceLog {
+    uint32_t head; // Records written since traceInit()
+    uint32_t tail; // Records drained to ITM or dropped
+    uint32_t lost; // Records overwritten before they were drained
+    uint32_t records[TRACE_SIZE];
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+extern struct TraceLog traceLog;
+
+//------------------------------------------------------------------------------
+// Function Prototypes
+//------------------------------------------------------------------------------
+void traceInit(void);
+void traceRecord(uint32_t point);
+void traceDrain(void);
+
+#endif
+#endif
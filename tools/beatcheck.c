@@ -0,0 +1,133 @@
+//------------------------------------------------------------------------------
+// Beat deadline check
+//
+// Sweeps a song's tempo over every whole bpm from -l to -h and checks
+// beatTime() of the player, which times a beat with one integer multiply of
+// its Q24.8 length, against the floating point formula it replaced,
+// beat * 60000000.0 / (bpm * BEATS_PER_QUARTER). Every deadline must be
+// within 1 us of the formula for the first -b beats. The Q24.8 length drops
+// under 1/256 us a beat, so past them a deadline may drift early by a
+// microsecond every 256 beats, but never be more than half a microsecond
+// late. Reports the worst error, and its tempo and beat, over -n beats.
+// Exits 1 on the first failure.
+//
+// Usage:
+//   beatcheck [-l low_bpm] [-h high_bpm] [-b exact_beats] [-n beats]
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o beatcheck tools/beatcheck.c source/player.c source/dmaplay.c source/phrase.c source/keys.c source/scheduler.c source/power.c source/songs.c source/spiflash.c source/stream.c tools/stubs/stubs.c tools/stubs/synth.c -lm
+//------------------------------------------------------------------------------
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "STM32L1xx.h"
+#include "dmaplay.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+#include "songs.h"
+#include "stubs.h"
+#include "synth.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define EVENTS          2
+#define LIMIT_MICROS    1.0
+#define LATE_MICROS     0.5 // A deadline rounded to the nearest microsecond
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static struct SongDirectory* directory;
+static struct SongHeader* header;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// A RAM directory of one short song; only its tempo changes
+static void buildSong() {
+    struct SongEvent* events;
+
+    directory = synthDirectory(1, SYNTH_FIRST_SONG(1) + SYNTH_SONG_BYTES(EVENTS));
+    header = synthSong(directory, 0, SYNTH_FIRST_SONG(1), EVENTS);
+    strcpy(header->name, "Beat check");
+    events = (struct SongEvent*) ((uint8_t*) directory + header->events);
+    events[0].onKeys = KEY(0);
+    events[1].onKeys = (1UL << 24);
+    events[1].offKeys = KEY(0);
+}
+
+int main(int argc, char** argv) {
+    uint32_t low = 20, high = 400, exact = 128, beats = 65536, bpm, beat, time;
+    double ideal, error, worst = 0, bound;
+    uint32_t worstBpm = 0, worstBeat = 0;
+    unsigned long checked = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            low = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-h") && i + 1 < argc) {
+            high = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            exact = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            beats = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: beatcheck [-l low_bpm] [-h high_bpm] [-b exact_beats] "
+                "[-n beats]\n");
+            return 2;
+        }
+    }
+    if (!low || high < low || high > 0xFFFF || exact > beats) {
+        fprintf(stderr, "beatcheck: need 1 <= low <= high bpm and exact beats within beats\n");
+        return 2;
+    }
+
+    buildSong();
+    for (bpm = low; bpm <= high; bpm++) {
+        synthTempo(header, (int) bpm);
+
+        hostReset();
+        powerInit();
+        schedInit();
+        dmaPlayInit();
+        songsInit(directory);
+        playerInit();
+        playerUseDma = 0;
+        if (!playerStart(numSongs)) {
+            fprintf(stderr, "beatcheck: song does not load at %lu bpm\n", (unsigned long) bpm);
+            return 1;
+        }
+
+        for (beat = 0; beat <= beats; beat++) {
+            ideal = beat * 60000000.0 / (bpm * BEATS_PER_QUARTER);
+            if (ideal >= 4294967296.0) {
+                break;
+            }
+            time = beatTime((int) beat);
+            error = ideal - time;
+            bound = beat <= exact ? LIMIT_MICROS : LATE_MICROS + beat / 256.0;
+            if (error < -LATE_MICROS || error > bound) {
+                fprintf(stderr, "beatcheck: %lu bpm beat %lu at %lu us, formula %.3f us\n",
+                    (unsigned long) bpm, (unsigned long) beat, (unsigned long) time, ideal);
+                return 1;
+            }
+            if (fabs(error) > fabs(worst)) {
+                worst = error;
+                worstBpm = bpm;
+                worstBeat = beat;
+            }
+            checked++;
+        }
+        playerStop();
+    }
+
+    printf("%lu deadlines at %lu-%lu bpm, within %.0f us for the first %lu beats\n", checked,
+        (unsigned long) low, (unsigned long) high, LIMIT_MICROS, (unsigned long) exact);
+    printf("worst %.3f us %s, %lu bpm beat %lu\n", fabs(worst), worst < 0 ? "late" : "early", (unsigned long) worstBpm,
+        (unsigned long) worstBeat);
+    return 0;
+}
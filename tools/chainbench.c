@@ -0,0 +1,297 @@
+//------------------------------------------------------------------------------
+// Shift register chain check and benchmark
+//
+// Runs the KEY_CHAIN backend of source/keys.c on the register stubs, whose
+// SPI1 feeds a model of the 74HC595 chain, and checks two things:
+//   - the latched outputs. Random updates through updateKeys(),
+//     updateOutput() and deactivateAllKeys() arrive at random gaps, many of
+//     them while a frame is still on the wire so they have to be carried in
+//     the next. Whenever the chain goes quiet its outputs must be what was
+//     last asked for, /OE must be low and no latch may show an output that
+//     was never asked for.
+//   - the time from an update to the latch pulse that shows it, at a range
+//     of steady update intervals. Every update must latch within 50 us. The
+//     interrupt costs -i cycles; on the board read keyChainWorst.
+// Exits 1 on the first failure.
+//
+// Usage:
+//   chainbench [-n updates] [-S seed] [-i irq_cycles]
+//
+// Build:
+//   gcc -O2 -DKEY_CHAIN -Itools/stubs -Isource -o chainbench tools/chainbench.c source/keys.c source/power.c tools/stubs/stubs.c
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "STM32L1xx.h"
+#include "keys.h"
+#include "power.h"
+#include "stubs.h"
+
+#ifndef KEY_CHAIN
+#error "Build chainbench with -DKEY_CHAIN"
+#endif
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define IRQ_CYCLES      60 // 12 entry, flag and latch writes, 10 exit
+#define LIMIT_MICROS    50.0
+#define WORDS           ((KEY_OUTPUTS + 31) / 32)
+#define MAX_GAP         400 // Cycles between random updates, about one frame
+#define MAX_PENDING     256 // Updates not yet latched
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct Update {
+    uint64_t time;
+    uint32_t outputs[WORDS]; // Outputs asked for once it was made
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static uint32_t seed = 1;
+static uint32_t expected[WORDS]; // Outputs as last asked for
+static uint32_t asked[WORDS]; // Outputs asked for at any time since the check
+static unsigned long latches;
+static struct Update pending[MAX_PENDING];
+static int pendingHead;
+static int pendingCount;
+static uint64_t worstCycles;
+static double sumCycles;
+static unsigned long timed;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static uint32_t nextRandom() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static int latched(int output) {
+    return (hostChain[output / 8] >> (output % 8)) & 1;
+}
+
+static void fail(const char* what, int output) {
+    fprintf(stderr, "chainbench: %s", what);
+    if (output >= 0) {
+        fprintf(stderr, " at output %d, latched %d, expected %d", output, latched(output),
+            (int) ((expected[output / 32] >> (output % 32)) & 1));
+    }
+    fprintf(stderr, ", seed %lu\n", (unsigned long) seed);
+    exit(1);
+}
+
+static int shows(const uint32_t* outputs) {
+    int i;
+
+    for (i = 0; i < KEY_OUTPUTS; i++) {
+        if (latched(i) != (int) ((outputs[i / 32] >> (i % 32)) & 1)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Each latch may only show outputs that have been asked for since the last
+// quiet check. The newest update whose outputs it shows has latched, with
+// every update before it.
+static void onLatch() {
+    uint64_t latency;
+    int i, shown = -1;
+
+    latches++;
+    for (i = 0; i < KEY_OUTPUTS; i++) {
+        if (latched(i) && !((asked[i / 32] >> (i % 32)) & 1)) {
+            fail("an output came on that was never asked for", i);
+        }
+    }
+
+    for (i = pendingCount - 1; i >= 0 && shown < 0; i--) {
+        if (shows(pending[(pendingHead + i) % MAX_PENDING].outputs)) {
+            shown = i;
+        }
+    }
+    for (i = 0; i <= shown; i++) {
+        latency = hostCycles - pending[pendingHead].time;
+        worstCycles = latency > worstCycles ? latency : worstCycles;
+        sumCycles += (double) latency;
+        timed++;
+        pendingHead = (pendingHead + 1) % MAX_PENDING;
+        pendingCount--;
+    }
+}
+
+static void setExpected(int output, int on) {
+    if (on) {
+        expected[output / 32] |= 1UL << (output % 32);
+        asked[output / 32] |= 1UL << (output % 32);
+    } else {
+        expected[output / 32] &= ~(1UL << (output % 32));
+    }
+}
+
+// Let any frame still on the wire, and the one carrying late updates, finish
+static void settle() {
+    while (hostStep()) {
+    }
+    hostFlush();
+}
+
+static void check() {
+    int i;
+
+    settle();
+    if (pendingCount) {
+        fail("an update never latched", -1);
+    }
+    if (hostGPIOB.ODR & KEY_CHAIN_OE) {
+        fail("/OE is still high", -1);
+    }
+    for (i = 0; i < KEY_OUTPUTS; i++) {
+        if (latched(i) != (int) ((expected[i / 32] >> (i % 32)) & 1)) {
+            fail("outputs differ", i);
+        }
+    }
+    memcpy(asked, expected, sizeof(asked));
+}
+
+static void randomUpdate() {
+    uint32_t kind = nextRandom() % 100, on, off;
+    struct KeySet onKeys, offKeys;
+    int i;
+
+    if (kind < 50) {
+        on = nextRandom() & ((1UL << NUM_KEYS) - 1) & nextRandom();
+        off = nextRandom() & ((1UL << NUM_KEYS) - 1) & nextRandom();
+        for (i = 0; i < NUM_KEYS; i++) {
+            if ((on | off) & (1UL << i)) {
+                setExpected(KEY_BASE + i, !(off & (1UL << i)));
+            }
+        }
+        keySetFromKeys(&onKeys, on);
+        keySetFromKeys(&offKeys, off);
+        updateKeys(&onKeys, &offKeys);
+    } else if (kind < 98) {
+        i = (int) (nextRandom() % KEY_OUTPUTS);
+        on = nextRandom() % 2;
+        setExpected(i, (int) on);
+        updateOutput(i, (int) on);
+    } else {
+        memset(expected, 0, sizeof(expected));
+        deactivateAllKeys();
+    }
+
+    if (pendingCount == MAX_PENDING) {
+        fail("updates are not being latched", -1);
+    }
+    pending[(pendingHead + pendingCount) % MAX_PENDING].time = hostCycles;
+    memcpy(pending[(pendingHead + pendingCount) % MAX_PENDING].outputs, expected,
+        sizeof(expected));
+    pendingCount++;
+}
+
+static void fuzz(long updates) {
+    long n;
+
+    for (n = 0; n < updates; n++) {
+        randomUpdate();
+        hostSpend(nextRandom() % MAX_GAP);
+        if (nextRandom() % 16 == 0) {
+            check();
+        }
+    }
+    check();
+}
+
+// Updates every interval cycles; returns 0 if one took too long to latch
+static int measure(uint32_t interval, long updates, uint32_t irqCycles) {
+    double perMicro = SystemCoreClock / 1e6;
+    unsigned long before;
+    long n;
+
+    settle();
+    hostIrqCycles = irqCycles;
+    keyChainWorst = 0;
+    worstCycles = 0;
+    sumCycles = 0;
+    timed = 0;
+    before = latches;
+    for (n = 0; n < updates; n++) {
+        randomUpdate();
+        hostSpend(interval);
+    }
+    settle();
+    hostIrqCycles = 0;
+
+    printf("%9.2f %9lu %9lu %9.2f %9.2f %9.2f\n", interval / perMicro, (unsigned long) updates,
+        latches - before, sumCycles / timed / perMicro, worstCycles / perMicro,
+        keyChainWorst / perMicro);
+    return worstCycles / perMicro <= LIMIT_MICROS && keyChainWorst / perMicro <= LIMIT_MICROS;
+}
+
+int main(int argc, char** argv) {
+    static const uint32_t intervals[] = { 32, 96, 160, 224, 320, 640, 1600, 32000 };
+    uint32_t irqCycles = IRQ_CYCLES;
+    long updates = 200000;
+    int opt, i, ok = 1;
+
+    for (opt = 1; opt < argc; opt++) {
+        if (opt + 1 >= argc || argv[opt][0] != '-' || argv[opt][2]) {
+            fprintf(stderr, "usage: %s [-n updates] [-S seed] [-i irq_cycles]\n", argv[0]);
+            return 2;
+        }
+        switch (argv[opt][1]) {
+        case 'n':
+            updates = atol(argv[++opt]);
+            break;
+        case 'S':
+            seed = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        case 'i':
+            irqCycles = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "chainbench: unknown option %s\n", argv[opt]);
+            return 2;
+        }
+    }
+
+    hostReset();
+    hostLatch = onLatch;
+    powerInit();
+
+    // Before the first latch the outputs hold whatever they powered up with
+    memset(asked, 0xFF, sizeof(asked));
+    GPIOB->MODER = 0x55555555;
+    keysInit();
+    hostFlush();
+    if (!(hostGPIOB.ODR & KEY_CHAIN_OE)) {
+        fail("/OE is low before the first frame", -1);
+    }
+    memset(asked, 0, sizeof(asked));
+    check();
+
+    fuzz(updates);
+    printf("%lu updates checked in %lu latches, %d outputs, song keys from %d\n",
+        (unsigned long) updates, latches, KEY_OUTPUTS, KEY_BASE);
+
+    printf("\nupdate to latch (us), %d byte frame %.2f us on the wire, %lu cycle interrupt\n",
+        KEY_OUTPUTS / 8, KEY_OUTPUTS * (2 << ((SPI1->CR1 & SPI_CR1_BR) >> 3)) /
+        (SystemCoreClock / 1e6), (unsigned long) irqCycles);
+    printf("%9s %9s %9s %9s %9s %9s\n", "interval", "updates", "latches", "mean", "worst",
+        "firmware");
+    for (i = 0; i < (int) (sizeof(intervals) / sizeof(intervals[0])); i++) {
+        ok &= measure(intervals[i], updates / 10, irqCycles);
+    }
+    if (!ok) {
+        fprintf(stderr, "chainbench: an update took over %.0f us to latch\n", LIMIT_MICROS);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,418 @@
+//------------------------------------------------------------------------------
+// Note timing benchmark
+//
+// Measures when each key sounds or stops against its ideal time, beat times
+// the exact tempo with no rounding, following the song's tempo changes. A
+// key is taken to sound its pull delay after its coil is driven and to stop
+// its release delay after, using the keyDelays table or a file given with
+// -l. Reports the mean error, the 99th percentile and maximum of its size,
+// and the drift from the first edge to the last. Positive errors are late.
+// The player starts songs late by the longest key delay so early edges fit;
+// that lead-in is not counted. From the simulator it also reports
+// powerWorstLatency, the worst cycles from a deadline waking the core to its
+// key edge over every song, or on the DMA engine, which wakes for no edge,
+// powerWorstRefillLag, the worst cycles from a half buffer running out to
+// its refill.
+//
+// The coil times come from one of two places:
+//   - the simulator, running the real player code with a cycle model: each
+//     interrupt costs -i cycles and the main loop takes -m cycles from the
+//     deadline flag to the key store. -k holds a button for the whole song so
+//     the SysTick debounce sampler competes with playback; it is pressed the
+//     given number of cycles before the song starts. SysTick and TIM2 share a
+//     clock, so that phase decides which notes the sampler lands on. Songs
+//     are played by the DMA engine (see dmaplay.h), which the cycle model
+//     cannot delay; -p steps them from the scheduler instead.
+//   - a capture from the board, built with JITTER_CAPTURE defined (see
+//     player.h). Save jitterCapture[0..jitterCount-1] from the debugger as
+//     numbers separated by white space or commas and pass it with -d, along
+//     with the index of the song that was played. The keys each record
+//     changed are found by replaying the song in the simulator. Records are
+//     only written for songs stepped from the scheduler, so clear
+//     playerUseDma in the capture build.
+//
+// Usage:
+//   jitter [-p] [-l delays] [-i irq_cycles] [-m loop_cycles] [-k phase_cycles]
+//   jitter [-l delays] -d capture -n song [-f core_hz]
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o jitter tools/jitter.c source/player.c source/dmaplay.c source/phrase.c source/keys.c source/scheduler.c source/power.c source/buttons.c source/songs.c source/spiflash.c source/stream.c tools/stubs/stubs.c -lm
+//------------------------------------------------------------------------------
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "STM32L1xx.h"
+#include "buttons.h"
+#include "dmaplay.h"
+#include "keys.h"
+#include "phrase.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+#include "songs.h"
+#include "stubs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define IRQ_CYCLES  60 // 12 entry, TIM2 compare branch, 10 exit
+#define LOOP_CYCLES 100 // Sleep wakeup, schedPoll() and playerStep() to the store
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+// Coil changes made at one time, by playerStep() or by the DMA engine
+struct Step {
+    double time; // Microseconds from the song start
+    uint32_t rising;
+    uint32_t falling;
+
+};
+
+struct Error {
+    double ideal;
+    double error;
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static struct Step* traceSteps; // Of the song being simulated
+static int traceCount;
+static int traceSize;
+static uint64_t traceStart;
+static uint32_t traceBefore; // Outputs before the last step
+static uint32_t traceOutputs;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static void loadDelays(const char* path) {
+    unsigned long pull, release;
+    int k;
+    FILE* file = fopen(path, "r");
+
+    if (!file) {
+        perror(path);
+        exit(2);
+    }
+
+    for (k = 0; k < NUM_KEYS; k++) {
+        if (fscanf(file, "%lu %lu", &pull, &release) != 2 || pull > 0xFFFF || release > 0xFFFF) {
+            fprintf(stderr, "jitter: %s needs %d pairs of delays under 65536 us\n", path, NUM_KEYS);
+            exit(2);
+        }
+        keyDelays[k].pull = (uint16_t) pull;
+        keyDelays[k].release = (uint16_t) release;
+    }
+
+    fclose(file);
+}
+
+static uint32_t keyOutputs() {
+    return (GPIOB->ODR & 0x00000FFF) | ((GPIOC->ODR & 0x00000FFF) << 12);
+}
+
+// Port changes at the same cycle join one step. Reads the other port from its
+// register so a pending BSRR write there is not applied from inside the trace.
+static void traceKeys(char port, uint32_t odr) {
+    double time = (hostCycles - traceStart) / (SystemCoreClock / 1e6);
+    uint32_t outputs;
+
+    if (port == 'A') {
+        return;
+    }
+    outputs = port == 'B' ? (odr & 0x00000FFF) | ((hostGPIOC.ODR & 0x00000FFF) << 12) :
+        (hostGPIOB.ODR & 0x00000FFF) | ((odr & 0x00000FFF) << 12);
+    if (outputs == traceOutputs) {
+        return;
+    }
+
+    if (!traceCount || traceSteps[traceCount - 1].time != time) {
+        if (traceCount == traceSize) {
+            traceSize *= 2;
+            traceSteps = realloc(traceSteps, traceSize * sizeof(struct Step));
+        }
+        if (!traceSteps) {
+            fprintf(stderr, "jitter: out of memory\n");
+            exit(2);
+        }
+        traceBefore = traceOutputs;
+        traceSteps[traceCount].time = time;
+        traceCount++;
+    }
+    traceOutputs = outputs;
+    traceSteps[traceCount - 1].rising = outputs & ~traceBefore;
+    traceSteps[traceCount - 1].falling = traceBefore & ~outputs;
+}
+
+// The library tempo is exact; tempo changes are as precise as the song holds
+// them
+static double idealTime(const struct SongData* song, int beat) {
+    double time = 0, perBeat = 60000000.0 / (song->tempo * BEATS_PER_QUARTER);
+    int from = 0, i;
+
+    for (i = 0; i < song->tempoCount && (int) song->tempos[i].beat <= beat; i++) {
+        time += (song->tempos[i].beat - from) * perBeat;
+        from = (int) song->tempos[i].beat;
+        perBeat = song->tempos[i].beatLength / 256.0;
+    }
+    return time + (beat - from) * perBeat;
+}
+
+static int compareDoubles(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+static int compareIdeal(const void* a, const void* b) {
+    return compareDoubles(&((const struct Error*) a)->ideal, &((const struct Error*) b)->ideal);
+}
+
+// Pairs the nth change of each key with the nth change the song asks for
+static void report(int index, const struct Step* steps, int count) {
+    struct SongData song;
+    const struct SongEvent* event;
+    double lead = 0, actual, sum = 0;
+    double* sizes;
+    struct Error* errors;
+    uint32_t held = 0, change, key;
+    int i, k, s, beat = 0, edges = 0, missing = 0, next[NUM_KEYS];
+
+    songLoad(index, &song);
+    errors = malloc((song.length * NUM_KEYS + 1) * sizeof(struct Error));
+    sizes = malloc((song.length * NUM_KEYS + 1) * sizeof(double));
+    if (!errors || !sizes) {
+        fprintf(stderr, "jitter: out of memory\n");
+        exit(2);
+    }
+
+    for (k = 0; k < NUM_KEYS; k++) {
+        next[k] = 0;
+        if (keyDelays[k].pull > lead) {
+            lead = keyDelays[k].pull;
+        }
+        if (keyDelays[k].release > lead) {
+            lead = keyDelays[k].release;
+        }
+    }
+
+    // The player is done with the decoder by now
+    if (song.code) {
+        phraseOpen(song.code, song.codeStart, song.codeEnd);
+    }
+    for (i = 0; i < song.length; i++) {
+        event = song.code ? phraseEvent(i) : &song.events[i];
+        beat += EVENT_DELTA(event);
+        change = (held & event->offKeys) | (~held & event->onKeys & ~event->offKeys & KEY_MASK);
+        held ^= change;
+
+        for (k = 0; k < NUM_KEYS; k++) {
+            key = KEY(k);
+            if (!(change & key)) {
+                continue;
+            }
+
+            // Find this key's next coil change in the same direction
+            for (s = next[k]; s < count; s++) {
+                if ((held & key) ? (steps[s].rising & key) : (steps[s].falling & key)) {
+                    break;
+                }
+            }
+            if (s == count) {
+                missing++;
+                continue;
+            }
+
+            next[k] = s + 1;
+            actual = steps[s].time + ((held & key) ? keyDelays[k].pull : keyDelays[k].release);
+            errors[edges].ideal = idealTime(&song, beat);
+            errors[edges].error = actual - lead - errors[edges].ideal;
+            sum += errors[edges].error;
+            sizes[edges] = fabs(errors[edges].error);
+            edges++;
+        }
+    }
+
+    if (!edges) {
+        printf("%-36s no key edges\n", song.name);
+    } else {
+        qsort(sizes, edges, sizeof(double), compareDoubles);
+        qsort(errors, edges, sizeof(struct Error), compareIdeal);
+        printf("%-36s %6d %9.3f %9.3f %9.3f %9.3f\n", song.name, edges,
+            sum / edges, sizes[(edges * 99 + 99) / 100 - 1], sizes[edges - 1],
+            errors[edges - 1].error - errors[0].error);
+    }
+    if (missing) {
+        printf("  %d key changes were never driven\n", missing);
+    }
+
+    free(errors);
+    free(sizes);
+}
+
+// hold is the press time in cycles before the song start, negative for none.
+// Fills steps and returns how many there were.
+static int simulate(int index, uint32_t irqCycles, uint32_t loopCycles, long hold, struct Step** steps) {
+    int playing = 1;
+
+    traceSize = 256;
+    traceCount = 0;
+    traceSteps = malloc(traceSize * sizeof(struct Step));
+    hostReset();
+    hostIrqCycles = irqCycles;
+    powerInit();
+    schedInit();
+    buttonsInit();
+    dmaPlayInit();
+    playerInit();
+    if (hold >= 0) {
+        GPIOA->IDR &= ~BUTTON_MODE;
+        buttonsWake();
+        hostSpend(hold);
+    }
+
+    traceOutputs = keyOutputs();
+    traceStart = hostCycles;
+    hostTrace = traceKeys;
+    playerStart(index);
+    while (playing) {
+        if (schedPoll()) {
+            hostSpend(loopCycles);
+            playing = playerStep();
+        } else if (!hostStep()) {
+            fprintf(stderr, "jitter: timer stopped in song %d\n", index);
+            exit(1);
+        }
+    }
+    hostFlush();
+    hostTrace = NULL;
+
+    *steps = traceSteps;
+    return traceCount;
+}
+
+// The first record is the song start; the counter wraps every 134 s at 32 MHz
+// so the differences are summed rather than the raw values used
+static int analyse(const char* path, int index, double coreHz) {
+    struct Step* steps;
+    uint64_t elapsed = 0;
+    uint32_t value, previous = 0;
+    char token[32];
+    int count = -1, total, c, length;
+    FILE* file = fopen(path, "r");
+
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+
+    playerUseDma = 0;
+    total = simulate(index, 0, 0, -1, &steps);
+    while (count < total) {
+        length = 0;
+        while ((c = fgetc(file)) != EOF && (c == ',' || c == ' ' || c == '\t' || c == '\r' || c == '\n')) {
+        }
+        while (c != EOF && c != ',' && c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+            if (length < (int) sizeof(token) - 1) {
+                token[length++] = (char) c;
+            }
+            c = fgetc(file);
+        }
+        if (!length) {
+            break;
+        }
+
+        token[length] = '\0';
+        value = (uint32_t) strtoul(token, NULL, 0);
+        if (count >= 0) {
+            elapsed += (uint32_t) (value - previous);
+            steps[count].time = elapsed * 1e6 / coreHz;
+        }
+        previous = value;
+        count++;
+    }
+    fclose(file);
+
+    if (count < 1) {
+        fprintf(stderr, "jitter: %s holds no records\n", path);
+        free(steps);
+        return 1;
+    }
+    if (count < total) {
+        printf("  only %d of %d records were captured\n", count, total);
+    }
+
+    report(index, steps, count);
+    free(steps);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* capture = NULL;
+    struct Step* steps;
+    uint32_t irqCycles = IRQ_CYCLES, loopCycles = LOOP_CYCLES;
+    double coreHz = 32000000;
+    uint32_t worstLatency = 0, worstLag = 0;
+    long hold = -1;
+    int index = -1, opt, i, count;
+
+    for (opt = 1; opt < argc; opt++) {
+        if (!strcmp(argv[opt], "-p")) {
+            playerUseDma = 0;
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-k")) {
+            hold = strtol(argv[++opt], NULL, 0);
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-l")) {
+            loadDelays(argv[++opt]);
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-i")) {
+            irqCycles = (uint32_t) strtoul(argv[++opt], NULL, 0);
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-m")) {
+            loopCycles = (uint32_t) strtoul(argv[++opt], NULL, 0);
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-d")) {
+            capture = argv[++opt];
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-n")) {
+            index = atoi(argv[++opt]);
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-f")) {
+            coreHz = atof(argv[++opt]);
+        } else {
+            fprintf(stderr, "usage: %s [-p] [-l delays] [-i irq_cycles] [-m loop_cycles] [-k phase_cycles]\n"
+                "       %s [-l delays] -d capture -n song [-f core_hz]\n", argv[0], argv[0]);
+            return 2;
+        }
+    }
+
+    if (capture && (index < 0 || index >= songCount())) {
+        fprintf(stderr, "jitter: -d needs a song index from 0 to %d\n", songCount() - 1);
+        return 2;
+    }
+
+    printf("%-36s %6s %9s %9s %9s %9s\n", "edge error (us)", "edges", "mean",
+        "p99", "max", "drift");
+    if (capture) {
+        return analyse(capture, index, coreHz);
+    }
+
+    for (i = 0; i < songCount(); i++) {
+        count = simulate(i, irqCycles, loopCycles, hold, &steps);
+        report(i, steps, count);
+        free(steps);
+        if (powerWorstLatency > worstLatency) {
+            worstLatency = powerWorstLatency;
+        }
+        if (powerWorstRefillLag > worstLag) {
+            worstLag = powerWorstRefillLag;
+        }
+    }
+    if (playerUseDma) {
+        printf("worst refill lag %lu cycles, %.2f us\n", (unsigned long) worstLag,
+            worstLag * 1e6 / coreHz);
+    } else {
+        printf("worst wake to key edge %lu cycles, %.2f us\n", (unsigned long) worstLatency,
+            worstLatency * 1e6 / coreHz);
+    }
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+//------------------------------------------------------------------------------
+// Live input stand-in
+//
+// Opens a pty and runs the firmware's live input (source/live.c) behind it on
+// the register stubs, so tools/livesend.c or any other sender can be tried
+// without a board. Virtual time is held to the wall clock. What the pty
+// delivers is fed to the USART1 model, which lands it at LIVE_BAUD into the
+// DMA ring as the part would, so the frame rate the link can carry and the
+// latency from a frame's wake to its keys both come out as on the board.
+//
+// Each key change is printed with its time unless -q is given. Once frames
+// have come in and the line has been quiet for -w milliseconds (default
+// 1000), or on Ctrl-C, the stats of live.h are printed and it exits.
+//
+// Usage:
+//   livepty [-q] [-w idle_ms]
+// then, in another shell:
+//   livesend /dev/pts/N file.song
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o livepty tools/livepty.c source/live.c source/keys.c source/scheduler.c source/power.c tools/stubs/stubs.c
+//------------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "STM32L1xx.h"
+#include "live.h"
+#include "power.h"
+#include "scheduler.h"
+#include "stubs.h"
+#include <termios.h> // After the stubs, it defines CR1-CR3 as delay flags
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define KEY_PINS        0x0FFF // PB0-11 and PC0-11
+#define LOOP_CYCLES     100 // Main loop around livePoll()
+#define STEP_CYCLES     32 // Virtual time moves in steps of a microsecond
+#define READ_BYTES      1024
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static volatile sig_atomic_t stopped;
+static uint32_t tracedKeys[3];
+static int quiet;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// main.c hands the interrupt to the input of the mode that is playing
+void USART1_IRQHandler(void) {
+    liveReceive();
+}
+
+static void onSignal(int signal) {
+    (void) signal;
+    stopped = 1;
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void traceKeys(char port, uint32_t odr) {
+    int index = port - 'A';
+
+    if (quiet || port == 'A' || (odr & KEY_PINS) == tracedKeys[index]) {
+        return;
+    }
+    tracedKeys[index] = odr & KEY_PINS;
+    printf("%12.3f ms  %c %03lx\n", hostCycles / (SystemCoreClock / 1000.0), port,
+        (unsigned long) (odr & KEY_PINS));
+}
+
+// The pty is the board's end of the link: raw, so no byte is translated
+static int openPty(void) {
+    struct termios tio;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fd < 0 || grantpt(fd) || unlockpt(fd) || tcgetattr(fd, &tio)) {
+        perror("livepty: pty");
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+
+    return fd;
+}
+
+// The main loop of firmware mode 1 until virtual time reaches the wall clock
+static void runUntil(uint64_t target) {
+    uint64_t step;
+
+    while (hostCycles < target) {
+        if (livePending()) {
+            livePoll();
+            hostSpend(LOOP_CYCLES);
+            continue;
+        }
+
+        step = target - hostCycles;
+        hostSpend(step < STEP_CYCLES ? step : STEP_CYCLES);
+    }
+}
+
+int main(int argc, char** argv) {
+    uint8_t buffer[READ_BYTES];
+    struct pollfd pfd;
+    unsigned long bytes = 0;
+    double start, first = 0, last = 0, perMicro, wire;
+    int fd, slave, room, idleMs = 1000, opt;
+    ssize_t got;
+
+    for (opt = 1; opt < argc; opt++) {
+        if (!strcmp(argv[opt], "-q")) {
+            quiet = 1;
+        } else if (!strcmp(argv[opt], "-w") && opt + 1 < argc) {
+            idleMs = atoi(argv[++opt]);
+        } else {
+            fprintf(stderr, "usage: %s [-q] [-w idle_ms]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    fd = openPty();
+    if (fd < 0) {
+        return 1;
+    }
+
+    // Held open so the pty stays up between senders
+    slave = open(ptsname(fd), O_RDWR | O_NOCTTY);
+    printf("listening on %s at %d baud\n", ptsname(fd), LIVE_BAUD);
+    fflush(stdout);
+    signal(SIGINT, onSignal);
+
+    hostReset();
+    hostTrace = traceKeys;
+    powerInit();
+    schedInit();
+    liveInit();
+    liveStart();
+
+    perMicro = SystemCoreClock / 1e6;
+    start = now();
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    while (!stopped) {
+        room = READ_BYTES - hostUartQueued();
+        pfd.events = room > 0 ? POLLIN : 0;
+        poll(&pfd, 1, 1);
+
+        runUntil((uint64_t) ((now() - start) * 1e6 * perMicro));
+
+        if (room > 0 && (pfd.revents & POLLIN)) {
+            got = read(fd, buffer, room);
+            if (got > 0) {
+                if (!bytes) {
+                    first = now();
+                }
+                hostUartSend(buffer, (int) got);
+                bytes += (unsigned long) got;
+                last = now();
+            }
+        }
+
+        if (bytes && !hostUartQueued() && (now() - last) * 1000 > idleMs) {
+            break;
+        }
+    }
+
+    runUntil(hostCycles + (uint64_t) (2 * LIVE_DELAY * perMicro));
+    liveStop();
+
+    // A frame costs its bytes on the wire and one idle character to wake
+    wire = (LIVE_FRAME_BYTES + 1) * 10 * 1e6 / LIVE_BAUD;
+    printf("%lu bytes, %lu frames, %lu bad, %lu late, %lu overruns\n", bytes,
+        (unsigned long) liveStats.frames, (unsigned long) liveStats.errors,
+        (unsigned long) liveStats.late, (unsigned long) liveStats.overruns);
+    if (last > first) {
+        printf("%.0f frames/s over %.3f s, the link carries %d\n",
+            liveStats.frames / (last - first), last - first,
+            LIVE_BAUD / (LIVE_FRAME_BYTES * 10));
+    }
+    printf("worst wake to keys %.1f us, frame on the wire %.1f us, end to end %.1f us\n",
+        liveStats.worstLatency / perMicro, wire, liveStats.worstLatency / perMicro + wire);
+
+    close(slave);
+    close(fd);
+    return 0;
+}
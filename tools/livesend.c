@@ -0,0 +1,292 @@
+//------------------------------------------------------------------------------
+// Live input sender
+//
+// Plays a .song file from midi2song -r to the board over a serial port, as
+// the frames of source/live.h, one frame per song event. Frames are sent at
+// the time their notes are due, so the board plays them LIVE_DELAY later;
+// with -n they are sent as fast as the port takes them to measure
+// throughput. Tempo changes in the file are followed as the player would. The
+// board must be in mode 1 and playing.
+//
+// Any serial device works, including the pty that tools/livepty.c opens to
+// run the firmware's decoder on the PC.
+//
+// Usage:
+//   livesend [-n] [-b baud] device file.song
+//
+// Build:
+//   gcc -O2 -Isource -o livesend tools/livesend.c
+//------------------------------------------------------------------------------
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "live.h"
+#include "songs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define SONG_FILE_MAGIC     "PMSG"
+#define FILE_HEADER_BYTES   (4 + sizeof(struct SongHeader))
+#define MAX_DELTA           0xFFFF // Microseconds one frame can wait
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct Baud {
+    long rate;
+    speed_t speed;
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static const struct Baud bauds[] = {
+    { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 },
+    { 500000, B500000 }, { 921600, B921600 }, { 1000000, B1000000 },
+    { 2000000, B2000000 }
+};
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static uint32_t get16(const uint8_t* p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleepUntil(double when) {
+    struct timespec ts;
+    ts.tv_sec = (time_t) when;
+    ts.tv_nsec = (long) ((when - ts.tv_sec) * 1e9);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+// Raw 8N1 at the given rate. A pty takes the settings and ignores the rate.
+static int openPort(const char* path, long rate) {
+    struct termios tio;
+    int fd, i;
+
+    for (i = 0; i < (int) (sizeof(bauds) / sizeof(bauds[0])); i++) {
+        if (bauds[i].rate == rate) {
+            break;
+        }
+    }
+    if (i == (int) (sizeof(bauds) / sizeof(bauds[0]))) {
+        fprintf(stderr, "livesend: unsupported baud rate %ld\n", rate);
+        return -1;
+    }
+
+    fd = open(path, O_WRONLY | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+        tio.c_cflag |= CLOCAL;
+        cfsetispeed(&tio, bauds[i].speed);
+        cfsetospeed(&tio, bauds[i].speed);
+        if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+static void putFrame(uint8_t* frame, uint32_t delta, uint32_t on, uint32_t off) {
+    uint32_t sum = 0;
+    int i;
+
+    frame[0] = LIVE_SYNC;
+    frame[1] = (uint8_t) delta;
+    frame[2] = (uint8_t) (delta >> 8);
+    frame[3] = (uint8_t) on;
+    frame[4] = (uint8_t) (on >> 8);
+    frame[5] = (uint8_t) (on >> 16);
+    frame[6] = (uint8_t) off;
+    frame[7] = (uint8_t) (off >> 8);
+    frame[8] = (uint8_t) (off >> 16);
+    for (i = 1; i < LIVE_FRAME_BYTES - 1; i++) {
+        sum += frame[i];
+    }
+    frame[LIVE_FRAME_BYTES - 1] = (uint8_t) ~sum;
+}
+
+static int sendAll(int fd, const uint8_t* bytes, int count) {
+    ssize_t done;
+
+    while (count > 0) {
+        done = write(fd, bytes, count);
+        if (done < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        bytes += done;
+        count -= (int) done;
+    }
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    const uint8_t* header;
+    const uint8_t* event;
+    const uint8_t* tempos;
+    uint8_t* data;
+    uint8_t frame[LIVE_FRAME_BYTES];
+    uint32_t length, beatLength, tempoCount, change = 0, beat = 0, delta, step, i, on, off;
+    uint64_t due = 0, sent = 0; // Microseconds in Q24.8 and whole
+    uint64_t wait;
+    unsigned long frames = 0;
+    long rate = LIVE_BAUD, size;
+    int flood = 0, opt, fd;
+    double start, elapsed;
+    FILE* file;
+
+    for (opt = 1; opt < argc && argv[opt][0] == '-'; opt++) {
+        if (!strcmp(argv[opt], "-n")) {
+            flood = 1;
+        } else if (!strcmp(argv[opt], "-b") && opt + 1 < argc) {
+            rate = atol(argv[++opt]);
+        } else {
+            break;
+        }
+    }
+    if (argc - opt != 2) {
+        fprintf(stderr, "usage: %s [-n] [-b baud] device file.song\n", argv[0]);
+        return 2;
+    }
+
+    file = fopen(argv[opt + 1], "rb");
+    if (!file) {
+        perror(argv[opt + 1]);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    data = malloc(size > 0 ? size : 1);
+    if (!data || fread(data, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "livesend: cannot read %s\n", argv[opt + 1]);
+        return 1;
+    }
+    fclose(file);
+
+    header = data + 4;
+    if (size < (long) FILE_HEADER_BYTES || memcmp(data, SONG_FILE_MAGIC, 4)) {
+        fprintf(stderr, "livesend: %s is not a song file from midi2song -r\n", argv[opt + 1]);
+        return 1;
+    }
+    if (get32(header + offsetof(struct SongHeader, codeBytes))) {
+        fprintf(stderr, "livesend: %s is phrase code; send the midi2song -r file\n",
+            argv[opt + 1]);
+        return 1;
+    }
+    length = get32(header + offsetof(struct SongHeader, length));
+    beatLength = get32(header + offsetof(struct SongHeader, beatLength));
+    tempoCount = get32(header + offsetof(struct SongHeader, tempoCount));
+    tempos = data + FILE_HEADER_BYTES + length * sizeof(struct SongEvent);
+    if (length > (unsigned long) size / sizeof(struct SongEvent) ||
+        tempoCount > (unsigned long) size / sizeof(struct TempoChange) ||
+        (unsigned long) (size - FILE_HEADER_BYTES) != length * sizeof(struct SongEvent) +
+        tempoCount * sizeof(struct TempoChange)) {
+        fprintf(stderr, "livesend: %s is damaged\n", argv[opt + 1]);
+        return 1;
+    }
+
+    fd = openPort(argv[opt], rate);
+    if (fd < 0) {
+        return 1;
+    }
+
+    start = now();
+    for (i = 0; i < length; i++) {
+        event = data + FILE_HEADER_BYTES + i * sizeof(struct SongEvent);
+        on = get32(event);
+        off = get32(event + 4);
+
+        // Beat lengths are Q24.8; the remainder carries to the next event. A
+        // tempo change takes effect on its beat.
+        for (delta = on >> 24; ; delta -= step) {
+            while (change < tempoCount && get32(tempos + change * sizeof(struct TempoChange)) <= beat) {
+                beatLength = get32(tempos + change * sizeof(struct TempoChange) + 4);
+                change++;
+            }
+            if (!delta) {
+                break;
+            }
+            step = delta;
+            if (change < tempoCount &&
+                get32(tempos + change * sizeof(struct TempoChange)) - beat < step) {
+                step = get32(tempos + change * sizeof(struct TempoChange)) - beat;
+            }
+            due += (uint64_t) step * beatLength;
+            beat += step;
+        }
+        on &= KEY_MASK;
+        off &= KEY_MASK;
+        if (!on && !off) {
+            continue;
+        }
+
+        wait = (due >> 8) - sent;
+        while (wait > MAX_DELTA) {
+            putFrame(frame, MAX_DELTA, 0, 0);
+            sent += MAX_DELTA;
+            wait -= MAX_DELTA;
+            if (!flood) {
+                sleepUntil(start + sent / 1e6);
+            }
+            if (!sendAll(fd, frame, LIVE_FRAME_BYTES)) {
+                perror(argv[opt]);
+                return 1;
+            }
+            frames++;
+        }
+
+        putFrame(frame, (uint32_t) wait, on, off);
+        sent += wait;
+        if (!flood) {
+            sleepUntil(start + sent / 1e6);
+        }
+        if (!sendAll(fd, frame, LIVE_FRAME_BYTES)) {
+            perror(argv[opt]);
+            return 1;
+        }
+        frames++;
+    }
+
+    tcdrain(fd);
+    elapsed = now() - start;
+    printf("%lu frames, %lu bytes in %.3f s, %.0f frames/s\n", frames,
+        frames * LIVE_FRAME_BYTES, elapsed, elapsed > 0 ? frames / elapsed : 0);
+
+    close(fd);
+    free(data);
+    return 0;
+}
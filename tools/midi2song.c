@@ -0,0 +1,735 @@
+//------------------------------------------------------------------------------
+// MIDI to song table compiler
+//
+// Reads a Standard MIDI File (format 0 or 1), quantises every note to the
+// sixteenth-note beat grid the player uses, maps MIDI note numbers onto the 24
+// relay keys and prints a SongEvent table for songs.c. Set tempo events from
+// any track become the song's tempo map: the one in force at the start gives
+// the library tempo and the rest a TempoChange table.
+//
+// Build:
+//   gcc -O2 -o midi2song tools/midi2song.c
+//
+// Usage:
+//   midi2song [-n name] [-t title] [-b base] [-x] [-d] [-r] [-o out.c] file.mid
+//     -n  C identifier for the table (default "song")
+//     -t  Title for the library entry (default the file name)
+//     -b  MIDI note played by key 0 (default 60, middle C)
+//     -x  Drop notes outside the 24 keys instead of folding them by octaves
+//     -d  Keep the General MIDI percussion channel (10)
+//     -r  Write a binary .song file for tools/songpack.c instead of C
+//------------------------------------------------------------------------------
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define NUM_KEYS            24
+#define BEATS_PER_QUARTER   4 // Must match songs.h
+#define BEATS_PER_BAR       16 // Songs end on the bar after the last release
+#define MAX_DELTA           255 // Delta shares the top byte of a record
+#define EVENT_BYTES         8 // sizeof(struct SongEvent)
+#define PERCUSSION          9
+#define SONG_FILE_MAGIC     "PMSG"
+#define SONG_NAME_BYTES     32 // Must match songs.h
+#define SONG_HEADER_BYTES   68 // sizeof(struct SongHeader)
+#define TEMPO_BYTES         16 // sizeof(struct TempoChange)
+#define DEFAULT_TEMPO       500000 // Microseconds per quarter until a set tempo
+#define BEAT_DIVISOR(bpm)   ((uint32_t) (bpm) * BEATS_PER_QUARTER)
+#define BEAT_LENGTH(bpm)    (((60000000UL / BEAT_DIVISOR(bpm)) << 8) | \
+                            (((60000000UL % BEAT_DIVISOR(bpm)) << 8) / BEAT_DIVISOR(bpm)))
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct Note {
+    int key;
+    long start; // Beats
+    long end;
+};
+
+struct Change {
+    long beat;
+    uint32_t onKeys;
+    uint32_t offKeys;
+};
+
+struct Record {
+    int delta;
+    uint32_t onKeys;
+    uint32_t offKeys;
+};
+
+struct Tempo {
+    uint64_t tick;
+    long order; // Of the set tempo events, so the later of two on a tick wins
+    uint32_t micros; // Per quarter note
+};
+
+struct TempoChange {
+    long beat;
+    uint32_t beatLength; // Microseconds per beat, Q24.8
+    uint64_t start; // Microseconds from the song start to beat, Q.8
+};
+
+struct Options {
+    const char* name;
+    const char* title;
+    int base;
+    int fold;
+    int drums;
+};
+
+struct Stats {
+    long notes;
+    long folded;
+    long dropped;
+    long merged;
+    long tempos;
+    int lowest;
+    int highest;
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static struct Note* notes;
+static long numNotes, capNotes;
+static struct Tempo* tempos;
+static long numTempos, capTempos;
+static struct Stats stats;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static void fail(const char* message) {
+    fprintf(stderr, "midi2song: %s\n", message);
+    exit(1);
+}
+
+static uint32_t be32(const uint8_t* p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+static uint32_t be16(const uint8_t* p) {
+    return ((uint32_t) p[0] << 8) | p[1];
+}
+
+static uint32_t readVarLen(const uint8_t** p, const uint8_t* end) {
+    uint32_t value = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (*p >= end) {
+            fail("truncated variable-length value");
+        }
+        value = (value << 7) | (**p & 0x7F);
+        if (!(*(*p)++ & 0x80)) {
+            return value;
+        }
+    }
+
+    fail("variable-length value too long");
+    return 0;
+}
+
+// Map a MIDI note number onto a relay key, or -1 to drop it
+static int mapKey(int note, const struct Options* opt) {
+    int key = note - opt->base;
+    if (key >= 0 && key < NUM_KEYS) {
+        return key;
+    }
+
+    if (!opt->fold) {
+        stats.dropped++;
+        return -1;
+    }
+
+    stats.folded++;
+    while (key < 0) {
+        key += 12;
+    }
+    while (key >= NUM_KEYS) {
+        key -= 12;
+    }
+    return key;
+}
+
+static long toBeat(uint64_t tick, uint32_t division) {
+    return (long) ((tick * BEATS_PER_QUARTER + division / 2) / division);
+}
+
+static void addNote(int midiNote, uint64_t start, uint64_t end, uint32_t division,
+        const struct Options* opt) {
+    int key;
+
+    stats.notes++;
+    if (midiNote < stats.lowest) {
+        stats.lowest = midiNote;
+    }
+    if (midiNote > stats.highest) {
+        stats.highest = midiNote;
+    }
+
+    key = mapKey(midiNote, opt);
+    if (key < 0) {
+        return;
+    }
+
+    if (numNotes == capNotes) {
+        capNotes = capNotes ? capNotes * 2 : 1024;
+        notes = realloc(notes, capNotes * sizeof(struct Note));
+        if (!notes) {
+            fail("out of memory");
+        }
+    }
+
+    notes[numNotes].key = key;
+    notes[numNotes].start = toBeat(start, division);
+    notes[numNotes].end = toBeat(end, division);
+    if (notes[numNotes].end <= notes[numNotes].start) {
+        notes[numNotes].end = notes[numNotes].start + 1;
+    }
+    numNotes++;
+}
+
+static void addTempo(uint64_t tick, uint32_t micros) {
+    stats.tempos++;
+    if (numTempos == capTempos) {
+        capTempos = capTempos ? capTempos * 2 : 64;
+        tempos = realloc(tempos, capTempos * sizeof(struct Tempo));
+        if (!tempos) {
+            fail("out of memory");
+        }
+    }
+
+    tempos[numTempos].tick = tick;
+    tempos[numTempos].order = numTempos;
+    tempos[numTempos].micros = micros;
+    numTempos++;
+}
+
+// Collect the notes and set tempo events of one MTrk chunk
+static void readTrack(const uint8_t* p, const uint8_t* end, uint32_t division,
+        const struct Options* opt) {
+    int64_t started[16][128];
+    uint64_t tick = 0;
+    uint8_t status = 0;
+    int channel, note, velocity, i, j;
+
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < 128; j++) {
+            started[i][j] = -1;
+        }
+    }
+
+    while (p < end) {
+        tick += readVarLen(&p, end);
+        if (p >= end) {
+            fail("truncated track");
+        }
+
+        if (*p & 0x80) {
+            status = *p++;
+        } else if (status < 0x80 || status >= 0xF0) {
+            fail("data byte without running status");
+        }
+
+        if (status == 0xFF) {
+            uint8_t type;
+            uint32_t length;
+            if (p >= end) {
+                fail("truncated meta event");
+            }
+            type = *p++;
+            length = readVarLen(&p, end);
+            if (length > (uint32_t) (end - p)) {
+                fail("truncated meta event");
+            }
+            if (type == 0x51 && length == 3) {
+                addTempo(tick, ((uint32_t) p[0] << 16) | ((uint32_t) p[1] << 8) | p[2]);
+            }
+            p += length;
+            status = 0; // Meta and sysex cancel running status
+            if (type == 0x2F) {
+                break;
+            }
+            continue;
+        }
+
+        if (status == 0xF0 || status == 0xF7) {
+            uint32_t length = readVarLen(&p, end);
+            if (length > (uint32_t) (end - p)) {
+                fail("truncated sysex event");
+            }
+            p += length;
+            status = 0;
+            continue;
+        }
+
+        channel = status & 0x0F;
+        switch (status & 0xF0) {
+            case 0x80:
+            case 0x90:
+                if (end - p < 2) {
+                    fail("truncated note event");
+                }
+                note = p[0] & 0x7F;
+                velocity = p[1] & 0x7F;
+                p += 2;
+                if (channel == PERCUSSION && !opt->drums) {
+                    break;
+                }
+
+                // A new Note On for a sounding note ends the earlier one
+                if (started[channel][note] >= 0) {
+                    addNote(note, (uint64_t) started[channel][note], tick, division, opt);
+                    started[channel][note] = -1;
+                }
+                if ((status & 0xF0) == 0x90 && velocity) {
+                    started[channel][note] = (int64_t) tick;
+                }
+                break;
+            case 0xA0:
+            case 0xB0:
+            case 0xE0:
+                p += 2;
+                break;
+            case 0xC0:
+            case 0xD0:
+                p += 1;
+                break;
+            default:
+                fail("unexpected status byte");
+        }
+    }
+
+    // Close notes left hanging at the end of the track
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < 128; j++) {
+            if (started[i][j] >= 0) {
+                addNote(j, (uint64_t) started[i][j], tick, division, opt);
+            }
+        }
+    }
+}
+
+static int byTick(const void* a, const void* b) {
+    const struct Tempo* x = a;
+    const struct Tempo* y = b;
+    if (x->tick != y->tick) {
+        return (x->tick > y->tick) - (x->tick < y->tick);
+    }
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+// The tempo in force at tick 0 sets bpm; each later change becomes a record
+// on its beat, the last of any that share one, and the player reads its
+// start from it rather than summing the map. Changes past the end beat or
+// that keep the tempo are left out. Returns the number of records.
+static long buildTempos(struct TempoChange** out, int* bpm, uint32_t division, long endBeat) {
+    struct TempoChange* changes = malloc((numTempos + 1) * sizeof(struct TempoChange));
+    uint32_t first = DEFAULT_TEMPO, beatLength, last;
+    long count = 0, i, beat;
+
+    if (!changes) {
+        fail("out of memory");
+    }
+
+    qsort(tempos, numTempos, sizeof(struct Tempo), byTick);
+    for (i = 0; i < numTempos && tempos[i].tick == 0; i++) {
+        first = tempos[i].micros;
+    }
+    if (!first) {
+        first = DEFAULT_TEMPO;
+    }
+    *bpm = (int) ((60000000UL + first / 2) / first);
+    last = BEAT_LENGTH(*bpm);
+
+    for (; i < numTempos; i++) {
+        beat = toBeat(tempos[i].tick, division);
+        beatLength = (uint32_t) (((uint64_t) tempos[i].micros << 8) / BEATS_PER_QUARTER);
+        if (beat >= endBeat || !beatLength) {
+            continue;
+        }
+        if (count && changes[count - 1].beat == beat) {
+            count--;
+            last = count ? changes[count - 1].beatLength : BEAT_LENGTH(*bpm);
+        }
+        if (beatLength != last) {
+            changes[count].beat = beat;
+            changes[count].beatLength = beatLength;
+            count++;
+            last = beatLength;
+        }
+    }
+
+    last = BEAT_LENGTH(*bpm);
+    for (i = 0; i < count; i++) {
+        beat = i ? changes[i - 1].beat : 0;
+        changes[i].start = (i ? changes[i - 1].start : 0) +
+            (uint64_t) (changes[i].beat - beat) * last;
+        last = changes[i].beatLength;
+    }
+
+    *out = changes;
+    return count;
+}
+
+static int byKeyThenStart(const void* a, const void* b) {
+    const struct Note* x = a;
+    const struct Note* y = b;
+    if (x->key != y->key) {
+        return x->key - y->key;
+    }
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static int byBeat(const void* a, const void* b) {
+    const struct Change* x = a;
+    const struct Change* y = b;
+    return (x->beat > y->beat) - (x->beat < y->beat);
+}
+
+// The player releases a key that is pressed and released in the same record,
+// so a re-struck key needs at least one beat of silence before it. Shorten the
+// earlier note, or hold through when there is no room to.
+static void separateRepeats(void) {
+    long i, kept = 0;
+
+    qsort(notes, numNotes, sizeof(struct Note), byKeyThenStart);
+    for (i = 0; i < numNotes; i++) {
+        if (kept > 0 && notes[kept - 1].key == notes[i].key &&
+                notes[kept - 1].end >= notes[i].start) {
+            struct Note* last = &notes[kept - 1];
+            if (notes[i].start - 1 > last->start) {
+                last->end = notes[i].start - 1;
+            } else {
+                if (notes[i].end > last->end) {
+                    last->end = notes[i].end;
+                }
+                stats.merged++;
+                continue;
+            }
+        }
+        notes[kept++] = notes[i];
+    }
+    numNotes = kept;
+}
+
+static void printMask(FILE* out, uint32_t keys) {
+    char text[256];
+    int length = 0, key;
+
+    if (!keys) {
+        length = sprintf(text, "0");
+    }
+    for (key = 0; key < NUM_KEYS; key++) {
+        if (keys & (1UL << key)) {
+            length += sprintf(text + length, "%sKEY(%d)", length ? " | " : "", key);
+        }
+    }
+    fputs(text, out);
+}
+
+static long addRecord(struct Record* records, long count, long gap, uint32_t on, uint32_t off) {
+    for (; gap > MAX_DELTA; gap -= MAX_DELTA) {
+        records[count].delta = MAX_DELTA;
+        records[count].onKeys = 0;
+        records[count].offKeys = 0;
+        count++;
+    }
+    records[count].delta = (int) gap;
+    records[count].onKeys = on;
+    records[count].offKeys = off;
+    return count + 1;
+}
+
+// Merge note edges into one record per beat. Gaps too long for the delta
+// byte get empty records, and the song ends on the bar after the last edge.
+static long buildRecords(struct Record** out) {
+    struct Change* changes = malloc((numNotes * 2 + 1) * sizeof(struct Change));
+    struct Record* records;
+    long numChanges = 0, numRecords = 0, capRecords, i, beat = 0, at, endBeat;
+    uint32_t on, off;
+
+    if (!changes) {
+        fail("out of memory");
+    }
+
+    for (i = 0; i < numNotes; i++) {
+        changes[numChanges].beat = notes[i].start;
+        changes[numChanges].onKeys = 1UL << notes[i].key;
+        changes[numChanges].offKeys = 0;
+        numChanges++;
+        changes[numChanges].beat = notes[i].end;
+        changes[numChanges].onKeys = 0;
+        changes[numChanges].offKeys = 1UL << notes[i].key;
+        numChanges++;
+    }
+    qsort(changes, numChanges, sizeof(struct Change), byBeat);
+
+    // Every change plus the end marker, and fillers for the longest gaps
+    endBeat = numChanges ? changes[numChanges - 1].beat : 0;
+    endBeat = ((endBeat + BEATS_PER_BAR - 1) / BEATS_PER_BAR) * BEATS_PER_BAR;
+    capRecords = numChanges + 1 + endBeat / MAX_DELTA + 1;
+    records = malloc(capRecords * sizeof(struct Record));
+    if (!records) {
+        fail("out of memory");
+    }
+
+    for (i = 0; i < numChanges; ) {
+        on = 0;
+        off = 0;
+        at = changes[i].beat;
+        while (i < numChanges && changes[i].beat == at) {
+            on |= changes[i].onKeys;
+            off |= changes[i].offKeys;
+            i++;
+        }
+        numRecords = addRecord(records, numRecords, at - beat, on, off);
+        beat = at;
+    }
+    numRecords = addRecord(records, numRecords, endBeat - beat, 0, 0);
+
+    free(changes);
+    *out = records;
+    return numRecords;
+}
+
+static void emitTable(FILE* out, const struct Options* opt, int bpm, const char* source,
+    const struct Record* records, long numRecords, const struct TempoChange* changes,
+    long numChanges) {
+    long i;
+
+    fprintf(out, "// Generated by midi2song from %s\n", source);
+    fprintf(out, "static const struct SongEvent %s[] = {\n", opt->name);
+    for (i = 0; i < numRecords; i++) {
+        fprintf(out, "    EVENT(%3d, ", records[i].delta);
+        printMask(out, records[i].onKeys);
+        fprintf(out, ", ");
+        printMask(out, records[i].offKeys);
+        fprintf(out, ")%s\n", i + 1 < numRecords ? "," : "");
+    }
+    fprintf(out, "};\n\n");
+
+    if (numChanges) {
+        fprintf(out, "// Beat, microseconds per beat in Q24.8, start in Q.8 microseconds\n");
+        fprintf(out, "static const struct TempoChange %s_tempos[] = {\n", opt->name);
+        for (i = 0; i < numChanges; i++) {
+            fprintf(out, "    { %ld, %lu, %lu, %lu }%s\n", changes[i].beat,
+                (unsigned long) changes[i].beatLength,
+                (unsigned long) (changes[i].start & 0xFFFFFFFF),
+                (unsigned long) (changes[i].start >> 32), i + 1 < numChanges ? "," : "");
+        }
+        fprintf(out, "};\n\n");
+        fprintf(out, "// Library entry:\n");
+        fprintf(out, "//  SONG_TEMPOS(\"%s\", %d, %s, %s_tempos),\n", opt->title, bpm, opt->name,
+            opt->name);
+        return;
+    }
+    fprintf(out, "// Library entry:\n");
+    fprintf(out, "//  SONG(\"%s\", %d, %s),\n", opt->title, bpm, opt->name);
+}
+
+static void put16(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t) value;
+    p[1] = (uint8_t) (value >> 8);
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    put16(p, value);
+    put16(p + 2, value >> 16);
+}
+
+// A .song file for tools/songpack.c: SONG_FILE_MAGIC, then a SongHeader
+// (see source/songs.h) whose offsets and bar index are left zero, then
+// the records and the tempo changes
+static void emitSongFile(FILE* out, const struct Options* opt, int bpm,
+    const struct Record* records, long numRecords, const struct TempoChange* changes,
+    long numChanges) {
+    uint8_t header[4 + SONG_HEADER_BYTES], event[EVENT_BYTES], tempo[TEMPO_BYTES];
+    uint32_t used = 0;
+    long i;
+    int low = NUM_KEYS - 1, high = 0, key;
+
+    for (i = 0; i < numRecords; i++) {
+        used |= records[i].onKeys;
+    }
+    for (key = 0; key < NUM_KEYS; key++) {
+        if (used & (1UL << key)) {
+            low = key < low ? key : low;
+            high = key;
+        }
+    }
+    if (!used) {
+        low = 0;
+    }
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, SONG_FILE_MAGIC, 4);
+    strncpy((char*) header + 4, opt->title, SONG_NAME_BYTES - 1);
+    put16(header + 4 + SONG_NAME_BYTES, (uint32_t) bpm);
+    header[4 + SONG_NAME_BYTES + 2] = (uint8_t) low;
+    header[4 + SONG_NAME_BYTES + 3] = (uint8_t) high;
+    put32(header + 4 + SONG_NAME_BYTES + 4, BEAT_LENGTH(bpm));
+    put32(header + 4 + SONG_NAME_BYTES + 8, (uint32_t) numRecords);
+    put32(header + 4 + SONG_NAME_BYTES + 16, (uint32_t) numChanges);
+    fwrite(header, 1, sizeof(header), out);
+
+    for (i = 0; i < numRecords; i++) {
+        put32(event, ((uint32_t) records[i].delta << 24) | records[i].onKeys);
+        put32(event + 4, records[i].offKeys);
+        fwrite(event, 1, sizeof(event), out);
+    }
+    for (i = 0; i < numChanges; i++) {
+        put32(tempo, (uint32_t) changes[i].beat);
+        put32(tempo + 4, changes[i].beatLength);
+        put32(tempo + 8, (uint32_t) changes[i].start);
+        put32(tempo + 12, (uint32_t) (changes[i].start >> 32));
+        fwrite(tempo, 1, TEMPO_BYTES, out);
+    }
+}
+
+static uint8_t* readFile(const char* path, long* size) {
+    FILE* file = fopen(path, "rb");
+    uint8_t* data;
+
+    if (!file) {
+        fail("cannot open input");
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = malloc(*size > 0 ? *size : 1);
+    if (!data || fread(data, 1, *size, file) != (size_t) *size) {
+        fail("cannot read input");
+    }
+    fclose(file);
+    return data;
+}
+
+int main(int argc, char** argv) {
+    struct Options opt;
+    const char* input = NULL;
+    const char* output = NULL;
+    FILE* out = stdout;
+    struct Record* records;
+    struct TempoChange* changes;
+    uint8_t* data;
+    const uint8_t* p;
+    const uint8_t* end;
+    long size, numRecords, numChanges, endBeat = 0, r;
+    uint32_t format, tracks, division, length;
+    int bpm, i, raw = 0;
+    clock_t begin = clock();
+
+    opt.name = "song";
+    opt.title = NULL;
+    opt.base = 60;
+    opt.fold = 1;
+    opt.drums = 0;
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            opt.name = argv[++i];
+        } else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            opt.title = argv[++i];
+        } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            opt.base = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            output = argv[++i];
+        } else if (!strcmp(argv[i], "-x")) {
+            opt.fold = 0;
+        } else if (!strcmp(argv[i], "-d")) {
+            opt.drums = 1;
+        } else if (!strcmp(argv[i], "-r")) {
+            raw = 1;
+        } else if (argv[i][0] != '-' && !input) {
+            input = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [-n name] [-t title] [-b base] [-x] [-d] [-r] [-o out.c] file.mid\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!input) {
+        fprintf(stderr, "usage: %s [-n name] [-t title] [-b base] [-x] [-d] [-r] [-o out.c] file.mid\n", argv[0]);
+        return 2;
+    }
+    if (!opt.title) {
+        opt.title = input;
+    }
+
+    data = readFile(input, &size);
+    p = data;
+    end = data + size;
+    if (size < 14 || memcmp(p, "MThd", 4) || be32(p + 4) < 6) {
+        fail("not a Standard MIDI File");
+    }
+    format = be16(p + 8);
+    tracks = be16(p + 10);
+    division = be16(p + 12);
+    if (format > 1) {
+        fail("only format 0 and 1 files are supported");
+    }
+    if (division & 0x8000 || division == 0) {
+        fail("SMPTE time division is not supported");
+    }
+    p += 8 + be32(p + 4);
+
+    stats.lowest = 127;
+    stats.highest = 0;
+    for (i = 0; i < (int) tracks && end - p >= 8; i++) {
+        length = be32(p + 4);
+        if (length > (uint32_t) (end - p - 8)) {
+            fail("truncated track chunk");
+        }
+        if (!memcmp(p, "MTrk", 4)) {
+            readTrack(p + 8, p + 8 + length, division, &opt);
+        }
+        p += 8 + length;
+    }
+
+    separateRepeats();
+
+    if (raw && !output) {
+        fail("-r needs -o");
+    }
+    if (output) {
+        out = fopen(output, raw ? "wb" : "w");
+        if (!out) {
+            fail("cannot open output");
+        }
+    }
+    numRecords = buildRecords(&records);
+    for (r = 0; r < numRecords; r++) {
+        endBeat += records[r].delta;
+    }
+    numChanges = buildTempos(&changes, &bpm, division, endBeat);
+    if (raw) {
+        emitSongFile(out, &opt, bpm, records, numRecords, changes, numChanges);
+    } else {
+        emitTable(out, &opt, bpm, input, records, numRecords, changes, numChanges);
+    }
+    if (output) {
+        fclose(out);
+    }
+
+    fprintf(stderr, "%s: %ld notes (MIDI %d-%d), %ld folded, %ld dropped, %ld repeats merged\n",
+        input, stats.notes, stats.notes ? stats.lowest : 0, stats.notes ? stats.highest : 0,
+        stats.folded, stats.dropped, stats.merged);
+    fprintf(stderr, "%s: %d BPM, %ld set tempo events, %ld tempo changes\n", input, bpm,
+        stats.tempos, numChanges);
+    fprintf(stderr, "%s: %ld records, %ld bytes of flash, %.2f ms\n", input, numRecords,
+        numRecords * EVENT_BYTES + numChanges * TEMPO_BYTES,
+        1000.0 * (clock() - begin) / CLOCKS_PER_SEC);
+
+    free(changes);
+    free(tempos);
+    free(records);
+    free(notes);
+    free(data);
+    return 0;
+}
@@ -0,0 +1,360 @@
+//------------------------------------------------------------------------------
+// MIDI input fuzz test and latency benchmark
+//
+// Feeds source/midi.c three kinds of input:
+//   - well formed streams: random channel, note, controller and program
+//     messages with running status wherever the standard allows it, system
+//     exclusive and system common messages between them and real-time bytes
+//     dropped in anywhere, even inside a message. The generator keeps its own
+//     idea of which keys are down and the ports are checked against it after
+//     every message.
+//   - random bytes, after which no pin outside the keys may have moved, and
+//     an all notes off on every channel must bring the keys back to none.
+//   - note messages through the USART1 model at MIDI_BAUD in virtual time,
+//     timing each key edge from the start of its message's first byte and
+//     from the landing of its last, with and without running status. The
+//     interrupt costs -i cycles; on the board read midiStats.worstLatency.
+// Both fuzz passes run for every channel setting in turn: omni and channel 0
+// to 15. Exits 1 on the first mismatch.
+//
+// Usage:
+//   midifuzz [-n messages] [-S seed] [-i irq_cycles]
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o midifuzz tools/midifuzz.c source/midi.c source/keys.c source/power.c tools/stubs/stubs.c
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "STM32L1xx.h"
+#include "keys.h"
+#include "midi.h"
+#include "power.h"
+#include "stubs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define KEY_PINS        0x0FFF // PB0-11 and PC0-11
+#define IRQ_CYCLES      80 // 12 entry, one byte through the parser, 10 exit
+#define LATENCY_NOTES   200
+#define MAX_MESSAGE     64 // Longest generated message, with real-time bytes
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct Latency {
+    double sum;
+    double worst;
+    int count;
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static uint32_t seed = 1;
+static uint32_t expected; // Keys the generator believes are down
+static int runningStatus; // Last channel status sent, 0 after system messages
+static unsigned long checked;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// main.c hands the interrupt to the input of the mode that is playing
+void USART1_IRQHandler(void) {
+    midiReceive();
+}
+
+static uint32_t nextRandom() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+static uint32_t keysDown() {
+    hostFlush();
+    return (hostGPIOB.ODR & KEY_PINS) | ((hostGPIOC.ODR & KEY_PINS) << 12);
+}
+
+static void fail(const char* what, const uint8_t* bytes, int count) {
+    int i;
+
+    fprintf(stderr, "midifuzz: %s after", what);
+    for (i = 0; i < count; i++) {
+        fprintf(stderr, " %02x", bytes[i]);
+    }
+    fprintf(stderr, "\n  keys %06lx, expected %06lx, channel %d, low note %d, seed %lu\n",
+        (unsigned long) keysDown(), (unsigned long) expected, midiChannel, midiLowNote,
+        (unsigned long) seed);
+    exit(1);
+}
+
+// Append a byte, sometimes with a real-time byte before it
+static int put(uint8_t* out, int count, uint8_t byte) {
+    if (nextRandom() % 8 == 0) {
+        out[count++] = (uint8_t) (0xF8 + nextRandom() % 8);
+    }
+    out[count++] = byte;
+    return count;
+}
+
+// Notes mostly land in or near the window so keys move often
+static uint8_t randomNote() {
+    if (nextRandom() % 4) {
+        return (uint8_t) (midiLowNote - 4 + nextRandom() % (NUM_KEYS + 8));
+    }
+    return (uint8_t) (nextRandom() % 128);
+}
+
+// One message, its effect applied to expected. Returns its length.
+static int generate(uint8_t* out) {
+    uint32_t kind = nextRandom() % 100;
+    int channel = (int) (nextRandom() % 16), count = 0, length, i;
+    uint8_t status, note, value;
+    uint32_t key;
+
+    // System exclusive and common, which end running status
+    if (kind < 8) {
+        if (kind < 4) {
+            count = put(out, count, 0xF0);
+            length = (int) (nextRandom() % 12);
+            for (i = 0; i < length; i++) {
+                count = put(out, count, (uint8_t) (nextRandom() & 0x7F));
+            }
+            count = put(out, count, 0xF7);
+        } else {
+            status = (uint8_t) (0xF1 + nextRandom() % 6);
+            count = put(out, count, status);
+            length = status == 0xF2 ? 2 : status == 0xF1 || status == 0xF3 ? 1 : 0;
+            for (i = 0; i < length; i++) {
+                count = put(out, count, (uint8_t) (nextRandom() & 0x7F));
+            }
+        }
+        runningStatus = 0;
+        return count;
+    }
+
+    if (kind < 70) {
+        status = (uint8_t) ((nextRandom() % 2 ? 0x90 : 0x80) | channel);
+    } else if (kind < 80) {
+        status = (uint8_t) (0xB0 | channel);
+    } else {
+        status = (uint8_t) ((0xA0 + 0x10 * (nextRandom() % 5)) | channel); // A0-E0
+        if ((status & 0xF0) == 0xB0) {
+            status = (uint8_t) (0xE0 | channel);
+        }
+    }
+
+    // Running status: the status byte is left out when it repeats
+    if (status != runningStatus || nextRandom() % 4 == 0) {
+        count = put(out, count, status);
+        runningStatus = status;
+    }
+
+    if ((status & 0xE0) == 0xC0) {
+        count = put(out, count, (uint8_t) (nextRandom() & 0x7F));
+        return count;
+    }
+
+    note = (status & 0xF0) == 0xB0 ? (uint8_t) (nextRandom() % 4 == 0 ? 120 + 3 * (nextRandom() % 2) :
+        nextRandom() & 0x7F) : randomNote();
+    value = nextRandom() % 4 == 0 ? 0 : (uint8_t) (1 + nextRandom() % 127);
+    count = put(out, count, note);
+    count = put(out, count, value);
+
+    if (midiChannel != MIDI_OMNI && channel != midiChannel) {
+        return count;
+    }
+    key = (uint32_t) (note - midiLowNote);
+    switch (status & 0xF0) {
+    case 0x90:
+        if (key < NUM_KEYS) {
+            expected = value ? expected | (1UL << key) : expected & ~(1UL << key);
+        }
+        break;
+    case 0x80:
+        if (key < NUM_KEYS) {
+            expected &= ~(1UL << key);
+        }
+        break;
+    case 0xB0:
+        if (note == 120 || note == 123) {
+            expected = 0;
+        }
+        break;
+    }
+    return count;
+}
+
+static void feed(const uint8_t* bytes, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        midiParse(bytes[i]);
+    }
+}
+
+static void wellFormed(long messages) {
+    uint8_t message[MAX_MESSAGE];
+    long m;
+    int count;
+
+    for (m = 0; m < messages; m++) {
+        count = generate(message);
+        feed(message, count);
+        if (keysDown() != expected) {
+            fail("keys differ", message, count);
+        }
+        checked++;
+    }
+}
+
+static void randomBytes(long bytes) {
+    uint8_t message[3];
+    uint32_t otherB = hostGPIOB.ODR & ~KEY_PINS, otherC = hostGPIOC.ODR & ~KEY_PINS;
+    long b;
+    int channel;
+
+    for (b = 0; b < bytes; b++) {
+        message[0] = (uint8_t) nextRandom();
+        midiParse(message[0]);
+        hostFlush();
+        if ((hostGPIOB.ODR & ~KEY_PINS) != otherB || (hostGPIOC.ODR & ~KEY_PINS) != otherC) {
+            fail("a pin outside the keys moved", message, 1);
+        }
+    }
+
+    expected = 0;
+    for (channel = 0; channel < 16; channel++) {
+        message[0] = (uint8_t) (0xB0 | channel);
+        message[1] = 123;
+        message[2] = 0;
+        feed(message, 3);
+    }
+    if (keysDown()) {
+        fail("all notes off left keys down", message, 3);
+    }
+    runningStatus = 0xB0 | 15;
+    checked++;
+}
+
+// Time from the first byte's start bit to the key edge, and from the last
+// byte landing. Each message goes out on an idle line.
+static void measure(int running, uint32_t irqCycles, struct Latency* wire,
+    struct Latency* landing) {
+    uint8_t message[3];
+    uint64_t start, byteCycles;
+    uint32_t before;
+    double fromStart, fromLast, perMicro = SystemCoreClock / 1e6;
+    int n, count;
+
+    hostReset();
+    hostIrqCycles = irqCycles;
+    powerInit();
+    midiLowNote = MIDI_LOW_NOTE;
+    midiChannel = MIDI_OMNI;
+    midiStart();
+    deactivateAllKeys();
+    byteCycles = (uint64_t) 10 * USART1->BRR;
+
+    for (n = 0; n < LATENCY_NOTES; n++) {
+        count = 0;
+        if (!running || n == 0) {
+            message[count++] = n % 2 ? 0x80 : 0x90;
+        }
+        message[count++] = (uint8_t) (MIDI_LOW_NOTE + (n / 2) % NUM_KEYS);
+        message[count++] = 64;
+        if (running) {
+            message[count - 1] = n % 2 ? 0 : 64; // Note On, velocity zero off
+        }
+
+        before = keysDown();
+        start = hostCycles;
+        hostUartSend(message, count);
+        while (keysDown() == before) {
+            if (!hostStep()) {
+                fprintf(stderr, "midifuzz: note %d never reached the keys\n", n);
+                exit(1);
+            }
+        }
+
+        fromStart = (hostCycles - start) / perMicro;
+        fromLast = (hostCycles - start - count * byteCycles) / perMicro;
+        if (n > 0 || !running) {
+            wire->sum += fromStart;
+            wire->count++;
+            wire->worst = fromStart > wire->worst ? fromStart : wire->worst;
+            landing->sum += fromLast;
+            landing->count++;
+            landing->worst = fromLast > landing->worst ? fromLast : landing->worst;
+        }
+
+        hostSpend(2 * byteCycles); // Let the line go idle
+    }
+
+    midiStop();
+    hostIrqCycles = 0;
+}
+
+static void printLatency(const char* what, const struct Latency* wire,
+    const struct Latency* landing) {
+    printf("%-18s %9.1f %9.1f %9.1f %9.1f\n", what, wire->sum / wire->count, wire->worst,
+        landing->sum / landing->count, landing->worst);
+}
+
+int main(int argc, char** argv) {
+    struct Latency wire[2], landing[2];
+    uint32_t irqCycles = IRQ_CYCLES;
+    long messages = 200000;
+    int opt, channel;
+
+    for (opt = 1; opt < argc; opt++) {
+        if (opt + 1 >= argc || argv[opt][0] != '-' || argv[opt][2]) {
+            fprintf(stderr, "usage: %s [-n messages] [-S seed] [-i irq_cycles]\n", argv[0]);
+            return 2;
+        }
+        switch (argv[opt][1]) {
+        case 'n':
+            messages = atol(argv[++opt]);
+            break;
+        case 'S':
+            seed = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        case 'i':
+            irqCycles = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "midifuzz: unknown option %s\n", argv[opt]);
+            return 2;
+        }
+    }
+
+    hostReset();
+    powerInit();
+    deactivateAllKeys();
+    for (channel = MIDI_OMNI; channel < 16; channel++) {
+        midiChannel = channel;
+        midiLowNote = (int) (nextRandom() % (128 - NUM_KEYS));
+        midiReset();
+        expected = keysDown();
+        runningStatus = 0;
+
+        wellFormed(messages / 17);
+        randomBytes(messages / 17);
+        wellFormed(messages / 17);
+    }
+    printf("%lu messages and resyncs checked, %lu bytes parsed\n", checked,
+        (unsigned long) midiStats.bytes);
+
+    memset(wire, 0, sizeof(wire));
+    memset(landing, 0, sizeof(landing));
+    measure(0, irqCycles, &wire[0], &landing[0]);
+    measure(1, irqCycles, &wire[1], &landing[1]);
+    printf("\nnote latency (us) at %d baud, %lu cycle interrupt\n", MIDI_BAUD,
+        (unsigned long) irqCycles);
+    printf("%-18s %9s %9s %9s %9s\n", "", "start", "worst", "last byte", "worst");
+    printLatency("status byte", &wire[0], &landing[0]);
+    printLatency("running status", &wire[1], &landing[1]);
+
+    return 0;
+}
@@ -0,0 +1,683 @@
+//------------------------------------------------------------------------------
+// Phrase code compressor
+//
+// Rewrites songs as phrase code (see source/phrase.h). Repeats are found
+// without any help: at each event the longest run of earlier ops that plays
+// the same events, as written or moved by a transpose with or without the
+// keys as written, becomes one call, and copies of it straight after become
+// its repeat count. Calls are only taken where they save bytes and never nest
+// deeper than the decoder's frames. Every song is then decoded with
+// source/phrase.c and checked against its events, and the flash it took as a
+// table and as code is reported.
+//
+// Usage:
+//   phrasepack [-l] [-n name] [-c out.c] [-d dir] [file.song...]
+//     -l  Take the songs built into source/songs.c first
+//     -n  C identifier for the code table (default "phraseCode")
+//     -c  Write one code table for songs.c, in which each song may call the
+//         phrases of the songs before it
+//     -d  Write each song into dir as a .song file for tools/songpack.c, coded
+//         on its own
+// Input files come from midi2song -r, or from phrasepack -d.
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o phrasepack tools/phrasepack.c source/phrase.c source/songs.c source/spiflash.c tools/stubs/stubs.c
+//------------------------------------------------------------------------------
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "phrase.h"
+#include "songs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define SONG_FILE_MAGIC     "PMSG"
+#define FILE_HEADER_BYTES   (4 + sizeof(struct SongHeader))
+#define SIGNATURES          1024 // Delta and whether keys go on and off
+#define MAX_CHAIN           256 // Earlier ops tried at each event
+#define MAX_REACH           0xFFFF // Calls hold halfword targets and lengths
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct Input {
+    const char* path; // NULL for a built-in song
+    const char* title;
+    uint8_t header[sizeof(struct SongHeader)]; // As it will be written
+    struct SongEvent* events;
+    int length;
+    struct TempoChange* tempos;
+    int tempoCount;
+    uint32_t first; // Of its events in the coder
+    uint32_t start; // Of its code
+    uint32_t end;
+    int depth; // Most frames it takes
+    int firstOp;
+    int ops;
+
+};
+
+// An op of a song's own code and the events it plays
+struct Op {
+    uint32_t event;
+    uint32_t events;
+    uint32_t offset;
+    uint32_t bytes;
+    int depth; // Frames it enters, 0 for an event
+    int next; // Earlier op with the same signature, -1 for none
+
+};
+
+struct Match {
+    int op; // First op of the phrase
+    uint32_t length; // Events in the phrase
+    uint32_t bytes;
+    int depth;
+    int shift;
+    int layer;
+    int repeats;
+    long saving;
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static struct SongEvent* events; // Every song coded so far, in order
+static uint32_t numEvents;
+static uint32_t* plain; // Bytes events 0 to n would take as single ops
+static struct Op* ops;
+static int numOps;
+static uint8_t* code;
+static uint32_t numCode;
+static int heads[SIGNATURES];
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static void* grow(void* data, size_t bytes) {
+    data = realloc(data, bytes ? bytes : 1);
+    if (!data) {
+        fprintf(stderr, "phrasepack: out of memory\n");
+        exit(2);
+    }
+    return data;
+}
+
+static uint32_t get16(const uint8_t* p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+static void put16(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t) value;
+    p[1] = (uint8_t) (value >> 8);
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    put16(p, value);
+    put16(p + 2, value >> 16);
+}
+
+static int countKeys(uint32_t keys) {
+    int count = 0;
+
+    for (; keys; keys &= keys - 1) {
+        count++;
+    }
+    return count;
+}
+
+static uint32_t keyBytes(uint32_t keys) {
+    int count = countKeys(keys);
+
+    return count < 4 ? (uint32_t) count : 4;
+}
+
+static uint32_t eventBytes(const struct SongEvent* event) {
+    return 1 + (EVENT_DELTA(event) >= PHRASE_DELTA) + keyBytes(event->onKeys & KEY_MASK) +
+        keyBytes(event->offKeys);
+}
+
+static int signature(const struct SongEvent* event) {
+    return EVENT_DELTA(event) * 4 + ((event->onKeys & KEY_MASK) ? 2 : 0) + (event->offKeys ? 1 : 0);
+}
+
+// As the decoder's transpose()
+static uint32_t moveKeys(uint32_t keys, int shift, int layer) {
+    uint32_t moved = shift < 0 ? keys >> -shift : keys << shift;
+
+    return ((layer ? keys : 0) | moved) & KEY_MASK;
+}
+
+static int sameEvent(const struct SongEvent* from, const struct SongEvent* to, int shift,
+    int layer) {
+    return EVENT_DELTA(from) == EVENT_DELTA(to) && to->offKeys == moveKeys(from->offKeys, shift, layer) &&
+        (to->onKeys & KEY_MASK) == moveKeys(from->onKeys & KEY_MASK, shift, layer);
+}
+
+static int sameRun(uint32_t from, uint32_t to, uint32_t length, int shift, int layer) {
+    uint32_t n;
+
+    for (n = 0; n < length; n++) {
+        if (!sameEvent(&events[from + n], &events[to + n], shift, layer)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void putByte(uint32_t value) {
+    if (!(numCode & 1023)) {
+        code = grow(code, numCode + 1024);
+    }
+    code[numCode++] = (uint8_t) value;
+}
+
+static void putKeys(uint32_t keys) {
+    int key;
+
+    if (countKeys(keys) >= 4) {
+        putByte(PHRASE_RAW);
+        putByte(keys);
+        putByte(keys >> 8);
+        putByte(keys >> 16);
+        return;
+    }
+    for (key = 0; keys; key++) {
+        if (keys & KEY(key)) {
+            keys &= ~KEY(key);
+            putByte((uint32_t) key | (keys ? PHRASE_MORE : 0));
+        }
+    }
+}
+
+static void addOp(uint32_t event, uint32_t count, uint32_t offset, int depth) {
+    struct Op* op;
+    int s = signature(&events[event]);
+
+    if (!(numOps & 255)) {
+        ops = grow(ops, (numOps + 256) * sizeof(struct Op));
+    }
+    op = &ops[numOps];
+    op->event = event;
+    op->events = count;
+    op->offset = offset;
+    op->bytes = numCode - offset;
+    op->depth = depth;
+    op->next = heads[s];
+    heads[s] = numOps++;
+}
+
+// The best call at event at, which must end by last. Phrases are runs of
+// whole ops that were played before at.
+static void findMatch(uint32_t at, uint32_t last, struct Match* best) {
+    struct Match match;
+    const struct Op* op;
+    int k, o, tries, t;
+
+    best->saving = 0;
+    for (k = heads[signature(&events[at])], tries = 0; k >= 0 && tries < MAX_CHAIN;
+        k = ops[k].next, tries++) {
+        for (t = 0; t < 64; t++) {
+            match.shift = (t & PHRASE_SHIFT) - 16;
+            match.layer = t >> 5;
+            if ((match.layer && !match.shift) ||
+                !sameEvent(&events[ops[k].event], &events[at], match.shift, match.layer)) {
+                continue;
+            }
+
+            match.op = k;
+            match.length = 0;
+            match.depth = 0;
+            for (o = k; o < numOps; o++) {
+                op = &ops[o];
+                if (op->event + op->events > at || at + match.length + op->events > last ||
+                    op->offset + op->bytes > MAX_REACH ||
+                    op->depth + 2 > PHRASE_DEPTH ||
+                    !sameRun(op->event, at + match.length, op->events, match.shift, match.layer)) {
+                    break;
+                }
+                match.length += op->events;
+                match.bytes = op->offset + op->bytes - ops[k].offset;
+                match.depth = op->depth > match.depth ? op->depth : match.depth;
+
+                match.repeats = 0;
+                while (match.repeats < 255 && at + (match.repeats + 2) * match.length <= last &&
+                    sameRun(ops[k].event, at + (match.repeats + 1) * match.length, match.length,
+                    match.shift, match.layer)) {
+                    match.repeats++;
+                }
+                match.saving = (long) (plain[at + (match.repeats + 1) * match.length] - plain[at]) -
+                    PHRASE_CALL_BYTES - (match.repeats ? 1 : 0);
+                if (match.saving > best->saving) {
+                    *best = match;
+                }
+            }
+        }
+    }
+}
+
+// Appends a song's events to the coder and writes its code
+static void encode(struct Input* song) {
+    struct Match match;
+    const struct SongEvent* event;
+    uint32_t at, last, offset, delta;
+    int n;
+
+    song->first = numEvents;
+    events = grow(events, (numEvents + song->length) * sizeof(struct SongEvent));
+    plain = grow(plain, (numEvents + song->length + 1) * sizeof(uint32_t));
+    if (!numEvents) {
+        plain[0] = 0;
+    }
+    for (n = 0; n < song->length; n++) {
+        events[numEvents] = song->events[n];
+        plain[numEvents + 1] = plain[numEvents] + eventBytes(&song->events[n]);
+        numEvents++;
+    }
+
+    song->start = numCode;
+    song->firstOp = numOps;
+    song->depth = 1;
+    last = numEvents;
+    for (at = song->first; at < last; ) {
+        offset = numCode;
+        findMatch(at, last, &match);
+        if (match.saving > 0) {
+            putByte(PHRASE_CALL | (match.repeats ? PHRASE_COUNT : 0) |
+                (match.layer ? PHRASE_LAYER : 0) | ((uint32_t) match.shift & PHRASE_SHIFT));
+            putByte(ops[match.op].offset);
+            putByte(ops[match.op].offset >> 8);
+            putByte(match.bytes);
+            putByte(match.bytes >> 8);
+            if (match.repeats) {
+                putByte((uint32_t) match.repeats);
+            }
+            addOp(at, (match.repeats + 1) * match.length, offset, match.depth + 1);
+            at += (match.repeats + 1) * match.length;
+            if (match.depth + 2 > song->depth) {
+                song->depth = match.depth + 2;
+            }
+            continue;
+        }
+
+        event = &events[at];
+        delta = (uint32_t) EVENT_DELTA(event);
+        putByte((delta < PHRASE_DELTA ? delta : PHRASE_DELTA) |
+            ((event->onKeys & KEY_MASK) ? PHRASE_ON : 0) | (event->offKeys ? PHRASE_OFF : 0));
+        if (delta >= PHRASE_DELTA) {
+            putByte(delta);
+        }
+        if (event->onKeys & KEY_MASK) {
+            putKeys(event->onKeys & KEY_MASK);
+        }
+        if (event->offKeys) {
+            putKeys(event->offKeys);
+        }
+        addOp(at, 1, offset, 0);
+        at++;
+    }
+    song->end = numCode;
+    song->ops = numOps - song->firstOp;
+}
+
+static void resetCoder() {
+    int s;
+
+    numEvents = 0;
+    numOps = 0;
+    numCode = 0;
+    for (s = 0; s < SIGNATURES; s++) {
+        heads[s] = -1;
+    }
+}
+
+// Plays the code back through the firmware's decoder
+static int verify(const struct Input* song) {
+    const struct SongEvent* event;
+    int n;
+
+    phraseOpen(code, song->start, song->end);
+    for (n = 0; n < song->length; n++) {
+        event = phraseEvent(n);
+        if (event->onKeys != song->events[n].onKeys || event->offKeys != song->events[n].offKeys) {
+            fprintf(stderr, "phrasepack: %s decodes wrong at event %d\n", song->title, n);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void setHeader(struct Input* song, const char* name, int tempo, int lowKey, int highKey,
+    uint32_t beatLength) {
+    memset(song->header, 0, sizeof(song->header));
+    strncpy((char*) song->header, name, SONG_NAME_BYTES - 1);
+    put16(song->header + offsetof(struct SongHeader, tempo), (uint32_t) tempo);
+    song->header[offsetof(struct SongHeader, lowKey)] = (uint8_t) lowKey;
+    song->header[offsetof(struct SongHeader, highKey)] = (uint8_t) highKey;
+    put32(song->header + offsetof(struct SongHeader, beatLength), beatLength);
+    put32(song->header + offsetof(struct SongHeader, length), (uint32_t) song->length);
+    put32(song->header + offsetof(struct SongHeader, tempoCount), (uint32_t) song->tempoCount);
+}
+
+// A song of the library, with its events decoded if it is phrase code
+static void loadBuiltIn(int index, struct Input* song) {
+    struct SongData data;
+    int n;
+
+    songLoad(index, &data);
+    song->path = NULL;
+    song->length = data.length;
+    song->tempoCount = data.tempoCount;
+    song->events = grow(NULL, data.length * sizeof(struct SongEvent));
+    song->tempos = grow(NULL, data.tempoCount * sizeof(struct TempoChange));
+    if (data.code) {
+        phraseOpen(data.code, data.codeStart, data.codeEnd);
+    }
+    for (n = 0; n < data.length; n++) {
+        song->events[n] = data.code ? *phraseEvent(n) : data.events[n];
+    }
+    memcpy(song->tempos, data.tempos, data.tempoCount * sizeof(struct TempoChange));
+    setHeader(song, data.name, data.tempo, data.lowKey, data.highKey, data.beatLength);
+    song->title = data.name;
+}
+
+static int readSong(struct Input* song) {
+    const uint8_t* header;
+    const uint8_t* payload;
+    uint8_t* data;
+    uint32_t bytes;
+    long size;
+    int n;
+    FILE* file = fopen(song->path, "rb");
+
+    if (!file) {
+        perror(song->path);
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    data = grow(NULL, size > 0 ? size : 1);
+    if (fread(data, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "phrasepack: cannot read %s\n", song->path);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    header = data + 4;
+    if (size < (long) FILE_HEADER_BYTES || memcmp(data, SONG_FILE_MAGIC, 4)) {
+        fprintf(stderr, "phrasepack: %s is not a song file\n", song->path);
+        return 0;
+    }
+    song->length = (int) get32(header + offsetof(struct SongHeader, length));
+    song->tempoCount = (int) get32(header + offsetof(struct SongHeader, tempoCount));
+    bytes = get32(header + offsetof(struct SongHeader, codeBytes));
+    bytes = bytes ? (bytes + 3) & ~3UL : (uint32_t) song->length * sizeof(struct SongEvent);
+    if (song->length <= 0 || song->tempoCount < 0 ||
+        song->length > size / (long) sizeof(struct SongEvent) ||
+        song->tempoCount > size / (long) sizeof(struct TempoChange) ||
+        (unsigned long) (size - FILE_HEADER_BYTES) != bytes +
+        song->tempoCount * sizeof(struct TempoChange)) {
+        fprintf(stderr, "phrasepack: %s is damaged\n", song->path);
+        return 0;
+    }
+
+    memcpy(song->header, header, sizeof(song->header));
+    song->header[SONG_NAME_BYTES - 1] = 0;
+    song->title = (const char*) song->header;
+    song->events = grow(NULL, song->length * sizeof(struct SongEvent));
+    song->tempos = grow(NULL, song->tempoCount * sizeof(struct TempoChange));
+    payload = data + FILE_HEADER_BYTES;
+    if (get32(header + offsetof(struct SongHeader, codeBytes))) {
+        phraseOpen(payload, 0, get32(header + offsetof(struct SongHeader, codeBytes)));
+    }
+    for (n = 0; n < song->length; n++) {
+        if (get32(header + offsetof(struct SongHeader, codeBytes))) {
+            song->events[n] = *phraseEvent(n);
+        } else {
+            song->events[n].onKeys = get32(payload + n * sizeof(struct SongEvent));
+            song->events[n].offKeys = get32(payload + n * sizeof(struct SongEvent) + 4);
+        }
+    }
+    for (n = 0; n < song->tempoCount; n++) {
+        song->tempos[n].beat = get32(payload + bytes + n * sizeof(struct TempoChange));
+        song->tempos[n].beatLength = get32(payload + bytes + n * sizeof(struct TempoChange) + 4);
+        song->tempos[n].start = get32(payload + bytes + n * sizeof(struct TempoChange) + 8);
+        song->tempos[n].startHigh = get32(payload + bytes + n * sizeof(struct TempoChange) + 12);
+    }
+    free(data);
+    return 1;
+}
+
+static void printKeys(FILE* out, const char* what, uint32_t keys) {
+    const char* separator = what;
+    int key;
+
+    for (key = 0; key < 24; key++) {
+        if (keys & KEY(key)) {
+            fprintf(out, "%s%d", separator, key);
+            separator = ",";
+        }
+    }
+}
+
+// One op a line, with what it does
+static void printOps(FILE* out, const struct Input* song) {
+    const struct SongEvent* event;
+    const struct Op* op;
+    uint32_t b;
+    int o, column, shift;
+
+    for (o = song->firstOp; o < song->firstOp + song->ops; o++) {
+        op = &ops[o];
+        fprintf(out, "    ");
+        column = 4;
+        for (b = 0; b < op->bytes; b++) {
+            column += fprintf(out, "0x%02X,%s", code[op->offset + b], b + 1 < op->bytes ? " " : "");
+        }
+        fprintf(out, "%*s// ", column < 44 ? 44 - column : 1, "");
+
+        if (code[op->offset] & PHRASE_CALL) {
+            shift = (code[op->offset] & PHRASE_SHIFT) - ((code[op->offset] & 0x10) << 1);
+            fprintf(out, "%lu-%lu", (unsigned long) get16(code + op->offset + 1),
+                (unsigned long) (get16(code + op->offset + 1) + get16(code + op->offset + 3)));
+            if (shift) {
+                fprintf(out, " %+d%s", shift, (code[op->offset] & PHRASE_LAYER) ? " layered" : "");
+            }
+            if (code[op->offset] & PHRASE_COUNT) {
+                fprintf(out, " x%d", code[op->offset + PHRASE_CALL_BYTES] + 1);
+            }
+        } else {
+            event = &events[op->event];
+            fprintf(out, "%d", EVENT_DELTA(event));
+            printKeys(out, " on ", event->onKeys & KEY_MASK);
+            printKeys(out, " off ", event->offKeys);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+static void emitTable(FILE* out, const char* name, const struct Input* songs, int count) {
+    int i, n;
+
+    fprintf(out, "// Generated by phrasepack, calls at the byte offsets on the right\n");
+    fprintf(out, "static const uint8_t %s[] = {\n", name);
+    for (i = 0; i < count; i++) {
+        fprintf(out, "    // %s, %lu-%lu\n", songs[i].title,
+            (unsigned long) songs[i].start, (unsigned long) songs[i].end);
+        printOps(out, &songs[i]);
+    }
+    fprintf(out, "};\n");
+
+    for (i = 0; i < count; i++) {
+        if (!songs[i].tempoCount) {
+            continue;
+        }
+        fprintf(out, "\n// Beat, microseconds per beat in Q24.8, start in Q.8 microseconds\n");
+        fprintf(out, "static const struct TempoChange %s_tempos%d[] = {\n", name, i);
+        for (n = 0; n < songs[i].tempoCount; n++) {
+            fprintf(out, "    { %lu, %lu, %lu, %lu }%s\n", (unsigned long) songs[i].tempos[n].beat,
+                (unsigned long) songs[i].tempos[n].beatLength,
+                (unsigned long) songs[i].tempos[n].start,
+                (unsigned long) songs[i].tempos[n].startHigh,
+                n + 1 < songs[i].tempoCount ? "," : "");
+        }
+        fprintf(out, "};\n");
+    }
+
+    fprintf(out, "\n// Library entries:\n");
+    for (i = 0; i < count; i++) {
+        fprintf(out, "//  SONG_CODE%s(\"%s\", %lu, %s, %lu, %lu, %d", songs[i].tempoCount ?
+            "_TEMPOS" : "", songs[i].title,
+            (unsigned long) get16(songs[i].header + offsetof(struct SongHeader, tempo)), name,
+            (unsigned long) songs[i].start, (unsigned long) songs[i].end, songs[i].length);
+        if (songs[i].tempoCount) {
+            fprintf(out, ", %s_tempos%d", name, i);
+        }
+        fprintf(out, ")%s\n", i + 1 < count ? "," : "");
+    }
+}
+
+// A .song file like midi2song -r writes, with the code word aligned in place
+// of the records
+static int writeSong(const char* dir, const struct Input* song, int index) {
+    static const uint8_t zeros[4];
+    uint8_t header[sizeof(struct SongHeader)], tempo[sizeof(struct TempoChange)];
+    const char* base = song->path ? strrchr(song->path, '/') : NULL;
+    char path[1024];
+    uint32_t bytes = song->end - song->start;
+    FILE* out;
+    int n;
+
+    if (song->path) {
+        snprintf(path, sizeof(path), "%s/%s", dir, base ? base + 1 : song->path);
+    } else {
+        snprintf(path, sizeof(path), "%s/builtin%d.song", dir, index);
+    }
+    memcpy(header, song->header, sizeof(header));
+    put32(header + offsetof(struct SongHeader, events), 0);
+    put32(header + offsetof(struct SongHeader, tempos), 0);
+    put32(header + offsetof(struct SongHeader, codeBytes), bytes);
+    put32(header + offsetof(struct SongHeader, barCount), 0);
+    put32(header + offsetof(struct SongHeader, bars), 0);
+
+    out = fopen(path, "wb");
+    if (!out) {
+        perror(path);
+        return 0;
+    }
+    fwrite(SONG_FILE_MAGIC, 1, 4, out);
+    fwrite(header, 1, sizeof(header), out);
+    fwrite(code + song->start, 1, bytes, out);
+    fwrite(zeros, 1, (4 - bytes % 4) % 4, out);
+    for (n = 0; n < song->tempoCount; n++) {
+        put32(tempo, song->tempos[n].beat);
+        put32(tempo + 4, song->tempos[n].beatLength);
+        put32(tempo + 8, song->tempos[n].start);
+        put32(tempo + 12, song->tempos[n].startHigh);
+        fwrite(tempo, 1, sizeof(tempo), out);
+    }
+    if (fclose(out)) {
+        perror(path);
+        return 0;
+    }
+    return 1;
+}
+
+static void report(const struct Input* song, int index) {
+    unsigned long table = song->length * sizeof(struct SongEvent);
+
+    printf("%2d %-32s %6d events %7lu bytes %6lu code %5.1fx  %d frames%s\n", index,
+        song->title, song->length, table,
+        (unsigned long) (song->end - song->start), (double) table / (song->end - song->start),
+        song->depth, song->end - song->start > table ? ", keep the table" : "");
+}
+
+int main(int argc, char** argv) {
+    const char* name = "phraseCode";
+    const char* outPath = NULL;
+    const char* dir = NULL;
+    struct Input* songs;
+    unsigned long table = 0, total = 0;
+    int builtIn = 0, count = 0, opt, i;
+    FILE* out;
+
+    songs = grow(NULL, (argc + numSongs) * sizeof(struct Input));
+    for (opt = 1; opt < argc; opt++) {
+        if (!strcmp(argv[opt], "-l")) {
+            builtIn = 1;
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-n")) {
+            name = argv[++opt];
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-c")) {
+            outPath = argv[++opt];
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-d")) {
+            dir = argv[++opt];
+        } else if (argv[opt][0] != '-') {
+            songs[count].path = argv[opt];
+            count++;
+        } else {
+            count = -1;
+            break;
+        }
+    }
+    if (count < 0 || (!builtIn && !count)) {
+        fprintf(stderr, "usage: %s [-l] [-n name] [-c out.c] [-d dir] [file.song...]\n", argv[0]);
+        return 2;
+    }
+
+    // Built-in songs go first, as in the library
+    if (builtIn) {
+        for (i = count - 1; i >= 0; i--) {
+            songs[numSongs + i].path = songs[i].path;
+        }
+        for (i = 0; i < numSongs; i++) {
+            loadBuiltIn(i, &songs[i]);
+        }
+        count += numSongs;
+    }
+    for (i = builtIn ? numSongs : 0; i < count; i++) {
+        if (!readSong(&songs[i])) {
+            return 1;
+        }
+    }
+
+    // One coder for the table, so songs share phrases; one per file otherwise
+    resetCoder();
+    for (i = 0; i < count; i++) {
+        if (dir) {
+            resetCoder();
+        }
+        encode(&songs[i]);
+        if (!verify(&songs[i]) || (dir && !writeSong(dir, &songs[i], i))) {
+            return 1;
+        }
+        report(&songs[i], i);
+        table += songs[i].length * sizeof(struct SongEvent);
+        total += songs[i].end - songs[i].start;
+    }
+
+    if (outPath) {
+        out = fopen(outPath, "w");
+        if (!out) {
+            perror(outPath);
+            return 1;
+        }
+        emitTable(out, name, songs, count);
+        if (fclose(out)) {
+            perror(outPath);
+            return 1;
+        }
+    }
+    printf("%d songs, %lu bytes of events in %lu bytes of code, %.1fx\n", count, table, total,
+        (double) table / total);
+
+    return 0;
+}
@@ -0,0 +1,474 @@
+//------------------------------------------------------------------------------
+// Seek and loop benchmark
+//
+// Plays a long random song through the real player as an event table with a
+// bar index, as phrase code with nested, repeated and transposed calls, and
+// as the table streamed from the SPI flash, on the DMA engine and stepped
+// from the scheduler, in virtual time as tools/sim.c does. Checks:
+//   - seek: playerSeek() to random bars, forward and back, each followed by
+//     a few bars of playing. The keys on the ports, from the moment of the
+//     seek, must be the song's from the start of the bar: the keys held
+//     there at once, then each change on its beat.
+//   - loop: playerLoop() over a run of bars set as the song starts. The
+//     ports must follow the song up to the end of the loop, then the loop
+//     again and again with no gap or stray key.
+// Changes within COALESCE microseconds are taken as one, as the scheduler
+// path writes the two ports a few cycles apart. It reports the host time per
+// seek, the best of -r runs. The table's index keeps it to one entry and a
+// scan of the bar, and the code's to a search and a scan of a few bars,
+// wherever in the song the bar is.
+//
+// Usage:
+//   seekbench [-n events] [-s seeks] [-r runs] [-S seed]
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o seekbench tools/seekbench.c source/player.c source/dmaplay.c source/phrase.c source/keys.c source/scheduler.c source/power.c source/songs.c source/spiflash.c source/stream.c tools/stubs/stubs.c tools/stubs/synth.c
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "STM32L1xx.h"
+#include "dmaplay.h"
+#include "keys.h"
+#include "phrase.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+#include "songs.h"
+#include "stubs.h"
+#include "synth.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define TEMPO           125 // 120000 microseconds a beat, no fraction
+#define BEAT_US         120000
+#define BAR_US          ((uint64_t) BEAT_US * PLAYER_BAR_BEATS)
+#define WINDOW_BARS     3 // Played after each seek
+#define LOOP_FROM       40
+#define LOOP_TO         47
+#define LOOP_PASSES     3
+#define COALESCE        50
+#define TOLERANCE       20 // Microseconds an edge may be late when stepped
+#define CHANGES_MAX     4096
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct Change {
+    uint64_t time; // Microseconds from the seek or song start
+    uint32_t keys; // Held from then on
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static int length = 4000;
+static int seeks = 500;
+static int runs = 3;
+
+static struct SongEvent* events; // The song as played, the code decoded
+static uint64_t* eventTimes; // Microseconds from the song start
+static uint32_t* heldAfter; // Keys held once each event has played
+static int lastBar; // Last bar with an event, from 1
+static struct SongBar* bars; // The table's bar index
+static uint32_t barCount;
+
+static struct Change observed[CHANGES_MAX];
+static int observedCount;
+static struct Change expected[CHANGES_MAX];
+static int expectedCount;
+static uint64_t origin; // Virtual microsecond observed times count from
+static uint32_t portB;
+static uint32_t portC;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static void put(uint8_t* code, uint32_t* size, uint32_t byte) {
+    code[(*size)++] = (uint8_t) byte;
+}
+
+// Random phrase code of length event ops, with calls back into runs of ops
+// already written. Calls can reach calls, so the decoded song is longer
+// than length; its first length events are played. Every event has a key,
+// raw, and mostly short deltas with a long rest now and then, so some bars
+// are empty and some events span several.
+static uint32_t buildCode(uint8_t* code) {
+    uint32_t* ops = malloc((length * 2 + 1) * sizeof(uint32_t));
+    uint32_t size = 0, delta, keys, first, last;
+    int written = 0, count = 0, op;
+
+    if (!ops) {
+        fprintf(stderr, "seekbench: out of memory\n");
+        exit(2);
+    }
+    while (written < length) {
+        ops[count++] = size;
+        if (count > 8 && synthRandom() % 4 == 0) {
+            last = 1 + synthRandom() % (count - 2);
+            first = last - 1 - synthRandom() % (last < 6 ? last : 6);
+            op = PHRASE_CALL | ((synthRandom() % 5) & PHRASE_SHIFT);
+            if (synthRandom() % 3 == 0) {
+                op = PHRASE_CALL | (32 - 1 - synthRandom() % 4); // Down a few keys
+            }
+            if (synthRandom() % 3 == 0) {
+                op |= PHRASE_COUNT;
+            }
+            if (synthRandom() % 4 == 0) {
+                op |= PHRASE_LAYER;
+            }
+            put(code, &size, op);
+            put(code, &size, ops[first] & 0xFF);
+            put(code, &size, ops[first] >> 8);
+            put(code, &size, (ops[last] - ops[first]) & 0xFF);
+            put(code, &size, (ops[last] - ops[first]) >> 8);
+            if (op & PHRASE_COUNT) {
+                put(code, &size, 1 + synthRandom() % 2);
+            }
+            continue;
+        }
+
+        delta = synthRandom() % 16 == 0 ? 16 + synthRandom() % 40 : synthRandom() % 5;
+        op = PHRASE_ON | PHRASE_OFF | (delta < PHRASE_DELTA ? delta : PHRASE_DELTA);
+        put(code, &size, op);
+        if (delta >= PHRASE_DELTA) {
+            put(code, &size, delta);
+        }
+        keys = (synthRandom() & synthRandom() & KEY_MASK) | KEY(synthRandom() % NUM_KEYS);
+        put(code, &size, PHRASE_RAW);
+        put(code, &size, keys & 0xFF);
+        put(code, &size, (keys >> 8) & 0xFF);
+        put(code, &size, keys >> 16);
+        keys = synthRandom() & synthRandom() & KEY_MASK;
+        put(code, &size, PHRASE_RAW);
+        put(code, &size, keys & 0xFF);
+        put(code, &size, (keys >> 8) & 0xFF);
+        put(code, &size, keys >> 16);
+        written++;
+    }
+    if (size > 0xFFFF) {
+        fprintf(stderr, "seekbench: %d events need more code than calls can reach\n", length);
+        exit(2);
+    }
+    free(ops);
+    return size;
+}
+
+// Places the table and its bar index in directory as song
+static struct SongHeader* buildTable(struct SongDirectory* directory, int song,
+    uint32_t offset) {
+    struct SongHeader* header = synthSong(directory, song, offset, (uint32_t) length);
+
+    strcpy(header->name, "Seek bench table");
+    synthTempo(header, TEMPO);
+    memcpy((uint8_t*) directory + header->events, events, length * sizeof(struct SongEvent));
+    header->barCount = barCount;
+    header->bars = header->events + length * sizeof(struct SongEvent);
+    memcpy((uint8_t*) directory + header->bars, bars, barCount * sizeof(struct SongBar));
+    return header;
+}
+
+// A songpack -e image of the table in hostFlash
+static void buildStream() {
+    uint32_t size = SYNTH_FIRST_SONG(1) + SYNTH_SONG_BYTES(length) +
+        barCount * sizeof(struct SongBar);
+
+    free(hostFlash);
+    hostFlash = (uint8_t*) synthDirectory(1, size);
+    hostFlashSize = size;
+    buildTable((struct SongDirectory*) hostFlash, 0, SYNTH_FIRST_SONG(1));
+}
+
+// A RAM directory of the table, then the code it was decoded from, and the
+// keys the song holds after each event. Each table is followed by its bar
+// index.
+static const struct SongDirectory* buildSongs() {
+    struct SongDirectory* directory = synthDirectory(2, SONG_DIR_SIZE);
+    struct SongHeader* header;
+    uint8_t* code = malloc(0x20000);
+    uint32_t offset, codeBytes, held = 0, on, off;
+    uint64_t beat = 0;
+    int i;
+
+    events = malloc(length * sizeof(struct SongEvent));
+    eventTimes = malloc(length * sizeof(uint64_t));
+    heldAfter = malloc(length * sizeof(uint32_t));
+    bars = malloc((length * 255 / PLAYER_BAR_BEATS + 1) * sizeof(struct SongBar));
+    if (!code || !events || !eventTimes || !heldAfter || !bars) {
+        fprintf(stderr, "seekbench: out of memory\n");
+        exit(2);
+    }
+
+    codeBytes = buildCode(code);
+    phraseOpen(code, 0, codeBytes);
+    for (i = 0; i < length; i++) {
+        events[i] = *phraseEvent(i);
+        beat += EVENT_DELTA(&events[i]);
+        off = events[i].offKeys & KEY_MASK;
+        on = events[i].onKeys & KEY_MASK & ~off;
+        held = (held & ~off) | on;
+        eventTimes[i] = beat * BEAT_US;
+        heldAfter[i] = held;
+    }
+    lastBar = (int) (beat / PLAYER_BAR_BEATS) + 1;
+    barCount = synthBars(events, (uint32_t) length, bars);
+
+    offset = SYNTH_FIRST_SONG(2);
+    header = buildTable(directory, 0, offset);
+    offset = header->bars + barCount * sizeof(struct SongBar);
+    header = synthSong(directory, 1, offset, (uint32_t) length);
+    strcpy(header->name, "Seek bench code");
+    synthTempo(header, TEMPO);
+    header->codeBytes = codeBytes;
+    memcpy((uint8_t*) directory + header->events, code, codeBytes);
+    free(code);
+
+    directory->size = header->events + codeBytes;
+    if (directory->size > SONG_DIR_SIZE) {
+        fprintf(stderr, "seekbench: %d events do not fit the directory\n", length);
+        exit(2);
+    }
+    return directory;
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Adds a change unless it holds what the last one did. One soon after the
+// last replaces it.
+static void append(struct Change* changes, int* count, uint64_t time, uint32_t keys) {
+    if (*count && time - changes[*count - 1].time < COALESCE) {
+        changes[*count - 1].keys = keys;
+        if (*count > 1 && changes[*count - 2].keys == keys) {
+            (*count)--;
+        }
+        return;
+    }
+    if (*count && changes[*count - 1].keys == keys) {
+        return;
+    }
+    if (*count == CHANGES_MAX) {
+        fprintf(stderr, "seekbench: too many changes\n");
+        exit(1);
+    }
+    changes[*count].time = time;
+    changes[*count].keys = keys;
+    (*count)++;
+}
+
+static void record(char port, uint32_t odr) {
+    if (port == 'B') {
+        portB = odr & 0xFFF;
+    } else if (port == 'C') {
+        portC = odr & 0xFFF;
+    } else {
+        return;
+    }
+    append(observed, &observedCount, hostMicros() - origin, portB | (portC << 12));
+}
+
+// Keys the song holds at from microseconds into it, then its changes up to
+// to, placed at offset
+static void expect(uint64_t from, uint64_t to, uint64_t offset) {
+    int low = 0, high = length - 1, middle;
+
+    while (low < high) {
+        middle = (low + high + 1) / 2;
+        if (eventTimes[middle] <= from) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    if (eventTimes[low] <= from) {
+        append(expected, &expectedCount, offset, heldAfter[low++]);
+    } else {
+        append(expected, &expectedCount, offset, 0);
+    }
+    for (; low < length && eventTimes[low] < to; low++) {
+        append(expected, &expectedCount, offset + eventTimes[low] - from, heldAfter[low]);
+    }
+}
+
+// Plays until the virtual clock reaches until
+static void playUntil(uint64_t until) {
+    while (hostMicros() < until) {
+        if (schedPoll()) {
+            if (!playerStep()) {
+                fprintf(stderr, "seekbench: song ended\n");
+                exit(1);
+            }
+        } else if (!hostStep()) {
+            fprintf(stderr, "seekbench: timer stopped\n");
+            exit(1);
+        }
+    }
+}
+
+// Observed changes before window against the expected ones
+static void compare(const char* what, int bar, uint64_t window) {
+    int i, late;
+
+    while (observedCount && observed[observedCount - 1].time >= window) {
+        observedCount--;
+    }
+    while (expectedCount && expected[expectedCount - 1].time >= window) {
+        expectedCount--;
+    }
+    for (i = 0; i < observedCount && i < expectedCount; i++) {
+        late = (int) (observed[i].time - expected[i].time);
+        if (observed[i].keys != expected[i].keys || late < 0 || late > TOLERANCE) {
+            break;
+        }
+    }
+    if (i < observedCount || i < expectedCount) {
+        fprintf(stderr, "seekbench: %s bar %d, change %d: ", what, bar, i);
+        if (i < observedCount) {
+            fprintf(stderr, "%06lx at %lu us", (unsigned long) observed[i].keys,
+                (unsigned long) observed[i].time);
+        } else {
+            fprintf(stderr, "none");
+        }
+        if (i < expectedCount) {
+            fprintf(stderr, ", song has %06lx at %lu us\n", (unsigned long) expected[i].keys,
+                (unsigned long) expected[i].time);
+        } else {
+            fprintf(stderr, ", song has none\n");
+        }
+        exit(1);
+    }
+}
+
+static void start(int song, int dma) {
+    hostReset();
+    powerInit();
+    schedInit();
+    dmaPlayInit();
+    playerInit();
+    playerUseDma = dma;
+    portB = 0;
+    portC = 0;
+    hostTrace = record;
+    if (!playerStart(numSongs + song)) {
+        fprintf(stderr, "seekbench: song %d does not load\n", song);
+        exit(1);
+    }
+}
+
+// Seeks to random bars, checking the bars after each. Returns the host
+// nanoseconds per seek.
+static double checkSeeks(int song, int dma) {
+    double spent = 0, began;
+    int s, bar;
+
+    synthSeed = 7;
+    start(song, dma);
+    for (s = 0; s < seeks; s++) {
+        bar = 1 + (int) (synthRandom() % (uint32_t) (lastBar - WINDOW_BARS - 1));
+        began = now();
+        playerSeek(bar);
+        spent += now() - began;
+
+        // A streamed song's seek takes virtual time reading the flash; the
+        // bar starts once it returns
+        observedCount = 0;
+        expectedCount = 0;
+        origin = hostMicros();
+        portB = hostGPIOB.ODR & 0xFFF;
+        portC = hostGPIOC.ODR & 0xFFF;
+        append(observed, &observedCount, 0, portB | (portC << 12));
+        playUntil(origin + WINDOW_BARS * BAR_US);
+
+        expect((bar - 1) * BAR_US, (bar - 1 + WINDOW_BARS) * BAR_US, 0);
+        compare("seek to", bar, WINDOW_BARS * BAR_US);
+    }
+    playerStop();
+    hostTrace = NULL;
+    return spent / seeks;
+}
+
+// Plays the loop LOOP_PASSES times from the song start
+static void checkLoop(int song, int dma) {
+    uint64_t from = (LOOP_FROM - 1) * BAR_US, to = LOOP_TO * BAR_US, end;
+    int p;
+
+    start(song, dma);
+    origin = hostMicros(); // After any read of the first block
+    observedCount = 0;
+    expectedCount = 0;
+    append(observed, &observedCount, 0, 0);
+    playerLoop(LOOP_FROM, LOOP_TO);
+    end = to + LOOP_PASSES * (to - from);
+    playUntil(origin + end);
+    playerStop();
+    hostTrace = NULL;
+
+    expect(0, to, 0);
+    for (p = 0; p < LOOP_PASSES; p++) {
+        expect(from, to, to + p * (to - from));
+    }
+    compare("loop to", LOOP_TO, end);
+}
+
+int main(int argc, char** argv) {
+    static const char* songs[] = { "table", "code", "stream" };
+    const struct SongDirectory* directory;
+    double ns, lowest[6];
+    int i, r, song, dma;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            length = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            seeks = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-S") && i + 1 < argc) {
+            synthSeed = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: seekbench [-n events] [-s seeks] [-r runs] [-S seed]\n");
+            return 2;
+        }
+    }
+    if (length < 2 || seeks < 1 || runs < 1) {
+        fprintf(stderr, "seekbench: need two events, a seek and a run\n");
+        return 2;
+    }
+
+    directory = buildSongs();
+    buildStream();
+    songsInit(directory);
+    if (lastBar < LOOP_TO + 2 || lastBar < WINDOW_BARS + 2) {
+        fprintf(stderr, "seekbench: %d bars are too few\n", lastBar);
+        return 2;
+    }
+
+    for (r = 0; r < runs; r++) {
+        for (i = 0; i < 6; i++) {
+            song = i / 2;
+            dma = i % 2 == 0;
+            ns = checkSeeks(song, dma);
+            if (!r || ns < lowest[i]) {
+                lowest[i] = ns;
+            }
+            if (!r) {
+                checkLoop(song, dma);
+            }
+        }
+    }
+
+    printf("%d events, %d bars, %d seeks and %d loop passes each\n", length, lastBar, seeks,
+        LOOP_PASSES);
+    printf("%-6s %-8s %12s\n", "song", "path", "ns/seek");
+    for (i = 0; i < 6; i++) {
+        printf("%-6s %-8s %12.1f\n", songs[i / 2], i % 2 == 0 ? "dma" : "stepped", lowest[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,343 @@
+//------------------------------------------------------------------------------
+// Song playback simulator
+//
+// Plays songs on the real player, scheduler and key code against the register
+// stubs. Virtual time jumps from one timer event to the next, so a song of
+// several minutes runs in well under a millisecond. Every key port change is
+// recorded as "<song> <us> <port> <odr>" and can be written out and diffed
+// against a golden trace. A song that leaves the DMA engine's timer blocked
+// at a zero reload, as two edges a tick apart would, fails with its time.
+//
+// Usage:
+//   sim [-p] [-d] [-t keys] [-s events]... [-S seed] [-f flash] [-l delays] [-r repeats] [-o trace] [-c golden]
+//
+//   -p  step every song from the scheduler, without the DMA engine. Both
+//       must give the same trace.
+//   -d  double every song an octave up, as mode 3 can
+//   -t  transpose every song by this many keys, as mode 3 can
+//   -s  add a synthetic song with this many random events (may be repeated).
+//       They are placed in a song directory in RAM after the built-in songs.
+//   -S  seed for the synthetic songs (default 1), the same seed gives the same
+//       songs on every host
+//   -f  SPI flash contents, such as a songpack -e image; its songs are
+//       streamed after all the others
+//   -l  load key delays: "pull release" in microseconds for keys 0-23, one
+//       pair per line. The trace then shows the early coil edges.
+//   -r  play the whole set this many times to measure speed (default 1)
+//   -o  write the trace of the first pass to a file ("-" for stdout)
+//   -c  compare the trace with a golden file, exit 1 on the first difference
+//
+// Golden traces are kept in tools/golden, each made from the repository root
+// by one of these, and checked with -c in place of -o, with and without -p:
+//   sim -o tools/golden/songs.txt
+//   sim -t 5 -d -o tools/golden/arranged.txt
+//   sim -l tools/golden/delays.txt -s 500 -o tools/golden/synthetic.txt
+// A change that should not move any key edge must leave all three matching.
+// One that does is committed with the traces it regenerates, so the diff
+// shows every edge it moved.
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o sim tools/sim.c source/player.c source/dmaplay.c source/phrase.c source/keys.c source/scheduler.c source/power.c source/songs.c source/spiflash.c source/stream.c tools/stubs/stubs.c tools/stubs/synth.c
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "STM32L1xx.h"
+#include "dmaplay.h"
+#include "keys.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+#include "songs.h"
+#include "spiflash.h"
+#include "stubs.h"
+#include "synth.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define MAX_SYNTHETIC   64
+#define KEY_PINS        0x00000FFF // Chip select and SPI2 share port B
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static FILE* traceFile; // Trace of the pass being recorded, NULL when not
+static int traceSong;
+static unsigned long traceChanges;
+static uint32_t tracedKeys[3];
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// Random chords at random spacing. Deltas of 0 stack several events on one
+// beat, as long notes split by midi2song do.
+static void addSyntheticSong(struct SongHeader* header, struct SongEvent* events, int length) {
+    uint32_t held = 0, on, off, delta;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        delta = i ? synthRandom() % 16 : 0;
+        synthChord(held, &on, &off);
+        if (i == length - 1) {
+            off = held; // End marker releases everything
+            on = 0;
+        }
+
+        held = (held & ~off) | on;
+        events[i].onKeys = (delta << 24) | on;
+        events[i].offKeys = off;
+    }
+
+    synthTempo(header, 60 + (int) (synthRandom() % 181));
+    sprintf(header->name, "Synthetic %d", length);
+}
+
+// A directory image in RAM laid out as songpack writes it for the flash.
+// Returns NULL when there are no synthetic songs.
+static const struct SongDirectory* buildDirectory(const int* lengths, int count) {
+    struct SongDirectory* directory;
+    struct SongHeader* header;
+    uint32_t size;
+    int i;
+
+    if (!count) {
+        return NULL;
+    }
+
+    size = SYNTH_FIRST_SONG(count);
+    for (i = 0; i < count; i++) {
+        size += SYNTH_SONG_BYTES(lengths[i]);
+    }
+    if (size > SONG_DIR_SIZE) {
+        fprintf(stderr, "sim: synthetic songs need %lu bytes, the directory holds %lu\n",
+            (unsigned long) size, (unsigned long) SONG_DIR_SIZE);
+        exit(2);
+    }
+
+    directory = synthDirectory(count, size);
+    size = SYNTH_FIRST_SONG(count);
+    for (i = 0; i < count; i++) {
+        header = synthSong(directory, i, size, (uint32_t) lengths[i]);
+        addSyntheticSong(header, (struct SongEvent*) ((uint8_t*) directory + header->events),
+            lengths[i]);
+        size += SYNTH_SONG_BYTES(lengths[i]);
+    }
+
+    return directory;
+}
+
+static void loadDelays(const char* path) {
+    unsigned long pull, release;
+    int k;
+    FILE* file = fopen(path, "r");
+
+    if (!file) {
+        perror(path);
+        exit(2);
+    }
+
+    for (k = 0; k < NUM_KEYS; k++) {
+        if (fscanf(file, "%lu %lu", &pull, &release) != 2 || pull > 0xFFFF || release > 0xFFFF) {
+            fprintf(stderr, "sim: %s needs %d pairs of delays under 65536 us\n", path, NUM_KEYS);
+            exit(2);
+        }
+        keyDelays[k].pull = (uint16_t) pull;
+        keyDelays[k].release = (uint16_t) release;
+    }
+
+    fclose(file);
+}
+
+static void trace(char port, uint32_t odr) {
+    odr &= KEY_PINS;
+    if (odr == tracedKeys[port - 'A']) {
+        return;
+    }
+
+    tracedKeys[port - 'A'] = odr;
+    traceChanges++;
+    if (traceFile) {
+        fprintf(traceFile, "%d %llu %c %04lx\n", traceSong,
+            (unsigned long long) hostMicros(), port, (unsigned long) odr);
+    }
+}
+
+// Play one song from reset to its end marker. Returns the virtual length.
+static uint64_t playSong(int index) {
+    hostReset();
+    powerInit();
+    schedInit();
+    dmaPlayInit();
+    playerInit();
+
+    traceSong = index;
+    playerStart(index);
+    while (1) {
+        if (schedPoll()) {
+            if (!playerStep()) {
+                break;
+            }
+        } else if (hostTim3Blocked()) {
+            fprintf(stderr, "sim: DMA timer blocked at a zero reload in song %d at %lu us\n",
+                index, (unsigned long) hostMicros());
+            exit(1);
+        } else if (!hostStep()) {
+            fprintf(stderr, "sim: timer stopped in song %d\n", index);
+            exit(1);
+        }
+    }
+    hostFlush();
+
+    return hostMicros();
+}
+
+// Line by line comparison, reports the first difference
+static int compareTrace(FILE* actual, const char* goldenPath) {
+    char want[128], got[128];
+    char* w;
+    char* g;
+    unsigned long line = 0;
+    FILE* golden = fopen(goldenPath, "r");
+
+    if (!golden) {
+        perror(goldenPath);
+        return 1;
+    }
+
+    rewind(actual);
+    do {
+        line++;
+        w = fgets(want, sizeof(want), golden);
+        g = fgets(got, sizeof(got), actual);
+        if ((w == NULL) != (g == NULL) || (w && strcmp(want, got))) {
+            printf("trace differs from %s at line %lu\n", goldenPath, line);
+            printf("  expected: %s", w ? want : "end of trace\n");
+            printf("  actual:   %s", g ? got : "end of trace\n");
+            fclose(golden);
+            return 1;
+        }
+    } while (w);
+
+    fclose(golden);
+    printf("trace matches %s (%lu lines)\n", goldenPath, line - 1);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    const char* outPath = NULL;
+    const char* goldenPath = NULL;
+    FILE* recorded = NULL;
+    struct SongData song;
+    int synthetic[MAX_SYNTHETIC];
+    int numSynthetic = 0, repeats = 1, i, pass, opt, errors = 0;
+    uint64_t simulated = 0;
+    clock_t start;
+    double wall;
+
+    for (opt = 1; opt < argc; opt++) {
+        if (!strcmp(argv[opt], "-p")) {
+            playerUseDma = 0;
+            continue;
+        }
+        if (!strcmp(argv[opt], "-d")) {
+            playerDouble = 1;
+            continue;
+        }
+        if (opt + 1 >= argc || argv[opt][0] != '-' || argv[opt][2]) {
+            fprintf(stderr, "usage: %s [-p] [-d] [-t keys] [-s events]... [-S seed] [-f flash] [-l delays] [-r repeats] [-o trace] [-c golden]\n", argv[0]);
+            return 2;
+        }
+
+        switch (argv[opt][1]) {
+        case 's':
+            i = atoi(argv[++opt]);
+            if (i < 1 || numSynthetic == MAX_SYNTHETIC) {
+                fprintf(stderr, "sim: bad synthetic song %s\n", argv[opt]);
+                return 2;
+            }
+            synthetic[numSynthetic++] = i;
+            break;
+        case 't':
+            playerTranspose = atoi(argv[++opt]);
+            break;
+        case 'S':
+            synthSeed = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        case 'f':
+            if (!hostFlashLoad(argv[++opt])) {
+                perror(argv[opt]);
+                return 2;
+            }
+            break;
+        case 'l':
+            loadDelays(argv[++opt]);
+            break;
+        case 'r':
+            repeats = atoi(argv[++opt]);
+            break;
+        case 'o':
+            outPath = argv[++opt];
+            break;
+        case 'c':
+            goldenPath = argv[++opt];
+            break;
+        default:
+            fprintf(stderr, "sim: unknown option %s\n", argv[opt]);
+            return 2;
+        }
+    }
+
+    // After all options so -S applies wherever it was given
+    spiFlashInit();
+    songsInit(buildDirectory(synthetic, numSynthetic));
+
+    if (outPath && !strcmp(outPath, "-")) {
+        if (goldenPath) {
+            fprintf(stderr, "sim: -c needs -o to name a file\n");
+            return 2;
+        }
+        recorded = stdout;
+    } else if (outPath) {
+        recorded = fopen(outPath, "w+");
+    } else if (goldenPath) {
+        recorded = tmpfile();
+    }
+    if ((outPath || goldenPath) && !recorded) {
+        perror(outPath ? outPath : "tmpfile");
+        return 2;
+    }
+
+    hostTrace = trace;
+    start = clock();
+    for (pass = 0; pass < repeats; pass++) {
+        traceFile = pass == 0 ? recorded : NULL;
+        for (i = 0; i < songCount(); i++) {
+            simulated += playSong(i);
+        }
+    }
+    wall = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    if (recorded != stdout) {
+        for (i = 0; i < songCount() && songLoad(i, &song); i++) {
+            printf("%2d %-40s %6d events %5d bpm\n", i, song.name, song.length, song.tempo);
+        }
+        printf("%d passes, %lu key port changes\n", repeats, traceChanges);
+        printf("simulated %.3f s in %.3f s wall", simulated / 1e6, wall);
+        if (wall > 0) {
+            printf(", %.0fx real time", simulated / 1e6 / wall);
+        }
+        printf("\n");
+    }
+
+    if (goldenPath) {
+        fflush(recorded);
+        errors = compareTrace(recorded, goldenPath);
+    }
+    if (recorded && recorded != stdout) {
+        fclose(recorded);
+    }
+
+    return errors;
+}
@@ -0,0 +1,285 @@
+//------------------------------------------------------------------------------
+// Song directory packer
+//
+// Packs the .song files written by midi2song -r, or by phrasepack -d as phrase
+// code, into one directory image (see
+// source/songs.h) to be flashed at SONG_DIR_ADDRESS, apart from the firmware,
+// or with -e to be written at the start of the external SPI flash. The songs
+// follow the ones built into songs.c, in the order given here. Reports the
+// flash each song takes, the keys it uses and what is left of the region.
+// The start of each tempo change is summed again as it is packed, and an
+// event table is given an index of its bars so a seek reads one entry.
+//
+// Usage:
+//   songpack [-e] -o image.bin file.song...
+//
+// Flashing, for example with the ST-LINK utility:
+//   ST-LINK_CLI -P image.bin 0x08020000
+// An -e image goes on the SPI part with any 25-series programmer.
+//
+// Build:
+//   gcc -O2 -Isource -o songpack tools/songpack.c
+//------------------------------------------------------------------------------
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "songs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define SONG_FILE_MAGIC     "PMSG"
+#define FILE_HEADER_BYTES   (4 + sizeof(struct SongHeader))
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct Input {
+    const char* path;
+    uint8_t* data; // File contents, header at data + 4
+    uint32_t length; // Events
+    uint32_t bytes; // Of the events or phrase code, word aligned
+    uint32_t tempoCount; // Tempo changes, after the events
+    uint32_t barCount; // Bar index entries, after the tempo changes
+    uint32_t offset; // Of the SongHeader in the image
+
+};
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static uint32_t get16(const uint8_t* p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t* p) {
+    return get16(p) | (get16(p + 2) << 16);
+}
+
+static void put16(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t) value;
+    p[1] = (uint8_t) (value >> 8);
+}
+
+static void put32(uint8_t* p, uint32_t value) {
+    put16(p, value);
+    put16(p + 2, value >> 16);
+}
+
+// Sums the start of each of count changes from the header's beatLength and
+// the changes before it, so the image is right whatever wrote the file.
+// Returns 0 for changes out of order or with no length.
+static int setStarts(uint8_t* tempos, uint32_t count, uint32_t beatLength) {
+    uint8_t* change;
+    uint64_t start = 0;
+    uint32_t beat = 0, i;
+
+    for (i = 0; i < count; i++) {
+        change = tempos + i * sizeof(struct TempoChange);
+        if (get32(change + offsetof(struct TempoChange, beat)) < beat ||
+            !get32(change + offsetof(struct TempoChange, beatLength))) {
+            return 0;
+        }
+        start += (uint64_t) (get32(change + offsetof(struct TempoChange, beat)) - beat) *
+            beatLength;
+        put32(change + offsetof(struct TempoChange, start), (uint32_t) start);
+        put32(change + offsetof(struct TempoChange, startHigh), (uint32_t) (start >> 32));
+        beat = get32(change + offsetof(struct TempoChange, beat));
+        beatLength = get32(change + offsetof(struct TempoChange, beatLength));
+    }
+    return 1;
+}
+
+// Indexes the bars of length events from the first to the last event's, as
+// songs.h lays SongBar out, into bars unless it is NULL. Returns how many.
+static uint32_t indexBars(const uint8_t* events, uint32_t length, uint8_t* bars) {
+    const uint8_t* event;
+    uint32_t i, bar = 0, beat = 0, held = 0, off;
+
+    for (i = 0; i < length; i++) {
+        event = events + i * sizeof(struct SongEvent);
+        beat += get32(event + offsetof(struct SongEvent, onKeys)) >> 24;
+        for (; bar * BEATS_PER_BAR <= beat; bar++) {
+            if (bars) {
+                put32(bars + bar * sizeof(struct SongBar) + offsetof(struct SongBar, event), i);
+                put32(bars + bar * sizeof(struct SongBar) + offsetof(struct SongBar, held),
+                    held | (beat - bar * BEATS_PER_BAR) << 24);
+            }
+        }
+        off = get32(event + offsetof(struct SongEvent, offKeys)) & KEY_MASK;
+        held = (held & ~off) |
+            (get32(event + offsetof(struct SongEvent, onKeys)) & KEY_MASK & ~off);
+    }
+    return bar;
+}
+
+// Reads one .song file and checks it against the layout in songs.h
+static int readSong(struct Input* song) {
+    const uint8_t* header;
+    long size;
+    FILE* file = fopen(song->path, "rb");
+
+    if (!file) {
+        perror(song->path);
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    song->data = malloc(size > 0 ? size : 1);
+    if (!song->data || fread(song->data, 1, size, file) != (size_t) size) {
+        fprintf(stderr, "songpack: cannot read %s\n", song->path);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    header = song->data + 4;
+    if (size < (long) FILE_HEADER_BYTES || memcmp(song->data, SONG_FILE_MAGIC, 4)) {
+        fprintf(stderr, "songpack: %s is not a song file from midi2song -r\n", song->path);
+        return 0;
+    }
+
+    song->length = get32(header + offsetof(struct SongHeader, length));
+    song->tempoCount = get32(header + offsetof(struct SongHeader, tempoCount));
+    song->bytes = get32(header + offsetof(struct SongHeader, codeBytes));
+    if (song->bytes) {
+        song->bytes = (song->bytes + 3) & ~3UL;
+    } else if (song->length <= (uint32_t) size / sizeof(struct SongEvent)) {
+        song->bytes = song->length * sizeof(struct SongEvent);
+    }
+    if (!song->length || !song->bytes || !get16(header + offsetof(struct SongHeader, tempo)) ||
+        song->tempoCount > (uint32_t) size / sizeof(struct TempoChange) ||
+        (unsigned long) (size - FILE_HEADER_BYTES) != song->bytes +
+        song->tempoCount * sizeof(struct TempoChange) ||
+        !setStarts(song->data + FILE_HEADER_BYTES + song->bytes, song->tempoCount,
+        get32(header + offsetof(struct SongHeader, beatLength)))) {
+        fprintf(stderr, "songpack: %s is damaged\n", song->path);
+        return 0;
+    }
+
+    // Phrase code would need a decoder mark per bar to start one
+    song->barCount = get32(header + offsetof(struct SongHeader, codeBytes)) ? 0 :
+        indexBars(song->data + FILE_HEADER_BYTES, song->length, NULL);
+    return 1;
+}
+
+int main(int argc, char** argv) {
+    const char* outPath = NULL;
+    struct Input* songs;
+    uint8_t* image;
+    uint8_t* header;
+    uint32_t size, events, bytes, tempos, limit = SONG_DIR_SIZE;
+    int count = 0, opt, i;
+    FILE* out;
+
+    songs = malloc(argc * sizeof(struct Input));
+    if (!songs) {
+        fprintf(stderr, "songpack: out of memory\n");
+        return 2;
+    }
+    for (opt = 1; opt < argc; opt++) {
+        if (opt + 1 < argc && !strcmp(argv[opt], "-o")) {
+            outPath = argv[++opt];
+        } else if (!strcmp(argv[opt], "-e")) {
+            limit = SONG_SPI_SIZE;
+        } else if (argv[opt][0] != '-') {
+            songs[count++].path = argv[opt];
+        } else {
+            count = 0;
+            break;
+        }
+    }
+    if (!outPath || !count) {
+        fprintf(stderr, "usage: %s [-e] -o image.bin file.song...\n", argv[0]);
+        return 2;
+    }
+    if (count > 0xFFFF) {
+        fprintf(stderr, "songpack: at most 65535 songs\n");
+        return 2;
+    }
+
+    // Lay out the headers, events, tempo changes and bar indexes; all are
+    // multiples of four bytes
+    size = sizeof(struct SongDirectory) + count * sizeof(uint32_t);
+    for (i = 0; i < count; i++) {
+        if (!readSong(&songs[i])) {
+            return 1;
+        }
+        if (limit == SONG_SPI_SIZE && get32(songs[i].data + 4 +
+            offsetof(struct SongHeader, codeBytes))) {
+            fprintf(stderr, "songpack: %s is phrase code, which cannot be streamed\n",
+                songs[i].path);
+            return 1;
+        }
+        songs[i].offset = size;
+        if (songs[i].bytes > limit - sizeof(struct SongHeader) ||
+            songs[i].tempoCount > limit / sizeof(struct TempoChange) ||
+            songs[i].barCount > limit / sizeof(struct SongBar)) {
+            size = limit + 1;
+            break;
+        }
+        size += sizeof(struct SongHeader) + songs[i].bytes +
+            songs[i].tempoCount * sizeof(struct TempoChange) +
+            songs[i].barCount * sizeof(struct SongBar);
+        if (size > limit) {
+            break;
+        }
+    }
+    if (size > limit) {
+        fprintf(stderr, "songpack: %s does not fit in the %lu byte directory\n",
+            songs[i].path, (unsigned long) limit);
+        return 1;
+    }
+
+    image = calloc(size, 1);
+    if (!image) {
+        fprintf(stderr, "songpack: out of memory\n");
+        return 2;
+    }
+    put32(image + offsetof(struct SongDirectory, magic), SONG_DIR_MAGIC);
+    put16(image + offsetof(struct SongDirectory, version), SONG_DIR_VERSION);
+    put16(image + offsetof(struct SongDirectory, count), (uint32_t) count);
+    put32(image + offsetof(struct SongDirectory, size), size);
+
+    for (i = 0; i < count; i++) {
+        header = image + songs[i].offset;
+        events = songs[i].offset + sizeof(struct SongHeader);
+        put32(image + sizeof(struct SongDirectory) + i * sizeof(uint32_t), songs[i].offset);
+        memcpy(header, songs[i].data + 4, sizeof(struct SongHeader));
+        header[SONG_NAME_BYTES - 1] = 0;
+        put32(header + offsetof(struct SongHeader, events), events);
+        bytes = songs[i].bytes;
+        tempos = songs[i].tempoCount * sizeof(struct TempoChange);
+        put32(header + offsetof(struct SongHeader, tempos),
+            songs[i].tempoCount ? events + bytes : 0);
+        memcpy(image + events, songs[i].data + FILE_HEADER_BYTES, bytes + tempos);
+        put32(header + offsetof(struct SongHeader, barCount), songs[i].barCount);
+        put32(header + offsetof(struct SongHeader, bars),
+            songs[i].barCount ? events + bytes + tempos : 0);
+        if (songs[i].barCount) {
+            indexBars(image + events, songs[i].length, image + events + bytes + tempos);
+        }
+
+        printf("%2d %-32s %6lu events %3lu tempos %5lu bars %7lu bytes  keys %2d-%2d\n", i,
+            (const char*) header, (unsigned long) songs[i].length,
+            (unsigned long) songs[i].tempoCount, (unsigned long) songs[i].barCount,
+            (unsigned long) (sizeof(struct SongHeader) + bytes + tempos +
+            songs[i].barCount * sizeof(struct SongBar)),
+            header[offsetof(struct SongHeader, lowKey)], header[offsetof(struct SongHeader, highKey)]);
+        free(songs[i].data);
+    }
+
+    out = fopen(outPath, "wb");
+    if (!out || fwrite(image, 1, size, out) != size || fclose(out)) {
+        perror(outPath);
+        return 1;
+    }
+    printf("%d songs, %lu of %lu bytes, %lu free\n", count, (unsigned long) size,
+        (unsigned long) limit, (unsigned long) (limit - size));
+
+    free(image);
+    free(songs);
+    return 0;
+}
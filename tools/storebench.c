@@ -0,0 +1,216 @@
+//------------------------------------------------------------------------------
+// Saved state check and endurance report
+//
+// Runs source/store.c on the data EEPROM model of the register stubs and
+// checks two things:
+//   - power lost after each number of words of a save: the record loaded at
+//     the next boot must be the one before or, if the save returned, the new
+//     one, and the save after must land.
+//   - random saves, a fifth of them the same as the last, each loaded back
+//     as it was, with a power cycle every few saves. One the same as the last
+//     must program nothing.
+// Then reports the words programmed per save, the time the core stalls for
+// them, the words read at boot, how evenly they wear, and how many saves, and
+// years at -d saves a day, the most worn word takes to reach its rated
+// endurance.
+// Exits 1 on the first failure.
+//
+// Usage:
+//   storebench [-n saves] [-d saves_per_day] [-S seed]
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o storebench tools/storebench.c source/store.c tools/stubs/stubs.c
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "STM32L1xx.h"
+#include "store.h"
+#include "stubs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define SAVES           100000
+#define PER_DAY         50 // A long practice day of pauses and song changes
+#define REBOOT_EVERY    97 // Saves between power cycles
+#define TORN_TRIALS     2000
+#define CORE_HZ         32000000.0
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static uint32_t seed = 1;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static uint32_t nextRandom() {
+    seed = seed * 1103515245 + 12345;
+    return seed >> 8;
+}
+
+// Any state the firmware can save
+static void randomState(struct StoreState* state) {
+    state->songID = (int) (nextRandom() % 16);
+    state->mode = (int) (nextRandom() % 4);
+    state->arrangement = (int) (nextRandom() % 4);
+    state->speed = 25 + (int) (nextRandom() % 376);
+    state->paused = (int) (nextRandom() & 1);
+    state->beat = state->paused ? (nextRandom() << 7 ^ nextRandom()) & 0x7FFFFFFF : 0;
+}
+
+static int same(const struct StoreState* a, const struct StoreState* b) {
+    return a->songID == b->songID && a->mode == b->mode && a->arrangement == b->arrangement &&
+        a->speed == b->speed && a->paused == b->paused && a->beat == b->beat;
+}
+
+static void fail(const char* what, unsigned long save) {
+    fprintf(stderr, "storebench: %s at save %lu\n", what, save);
+    exit(1);
+}
+
+// The EEPROM keeps its contents; the firmware starts over
+static void powerCycle() {
+    hostReset();
+    storeInit();
+}
+
+static unsigned long totalWrites() {
+    unsigned long total = 0;
+    int i;
+
+    for (i = 0; i < HOST_EEPROM_BYTES / 4; i++) {
+        total += hostEepromWrites[i];
+    }
+    return total;
+}
+
+// Loads back what was saved, and nothing from an erased EEPROM
+static void checkTorn() {
+    struct StoreState before, after, next, loaded;
+    int trial, cut, saved;
+
+    hostEepromErase();
+    powerCycle();
+    if (storeLoad(&loaded)) {
+        fail("erased EEPROM loads", 0);
+    }
+
+    randomState(&before);
+    if (!storeSave(&before)) {
+        fail("first save failed", 0);
+    }
+    for (trial = 0; trial < TORN_TRIALS; trial++) {
+        do {
+            randomState(&after);
+        } while (same(&after, &before));
+
+        cut = trial % (STORE_RECORD_WORDS + 1);
+        hostEepromCut = cut;
+        saved = storeSave(&after);
+        hostEepromCut = -1;
+
+        powerCycle();
+        if (!storeLoad(&loaded)) {
+            fail("torn save lost every record", (unsigned long) trial);
+        }
+        if (saved && !same(&loaded, &after)) {
+            fail("completed save not loaded", (unsigned long) trial);
+        }
+        if (!same(&loaded, &after) && !same(&loaded, &before)) {
+            fail("torn save loaded as neither record", (unsigned long) trial);
+        }
+
+        randomState(&next);
+        if (!storeSave(&next)) {
+            fail("save after a torn one failed", (unsigned long) trial);
+        }
+        powerCycle();
+        if (!storeLoad(&loaded) || !same(&loaded, &next)) {
+            fail("save after a torn one not loaded", (unsigned long) trial);
+        }
+        before = next;
+    }
+    printf("%d saves cut short, each loaded as the record before or after\n", TORN_TRIALS);
+}
+
+int main(int argc, char** argv) {
+    struct StoreState state, last, loaded;
+    unsigned long saves = SAVES, perDay = PER_DAY, save, repeats = 0, writes, worst = 0;
+    unsigned long worn = 0;
+    uint64_t stalled = 0, start;
+    double mean, lifetime;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            saves = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+            perDay = strtoul(argv[++i], NULL, 0);
+        } else if (!strcmp(argv[i], "-S") && i + 1 < argc) {
+            seed = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: storebench [-n saves] [-d saves_per_day] [-S seed]\n");
+            return 2;
+        }
+    }
+    if (!saves || !perDay) {
+        fprintf(stderr, "storebench: need a save and a save a day\n");
+        return 2;
+    }
+
+    checkTorn();
+
+    hostEepromErase();
+    powerCycle();
+    memset(&last, 0, sizeof(last));
+    for (save = 0; save < saves; save++) {
+        if (save && nextRandom() % 5 == 0) {
+            state = last;
+            repeats++;
+        } else {
+            randomState(&state);
+        }
+
+        writes = storeWrites;
+        start = hostCycles;
+        if (!storeSave(&state)) {
+            fail("save failed", save);
+        }
+        stalled += hostCycles - start;
+        if (save && same(&state, &last) && storeWrites != writes) {
+            fail("save of the same state programmed", save);
+        }
+        last = state;
+
+        if (save % REBOOT_EVERY == 0) {
+            powerCycle();
+        }
+        if (!storeLoad(&loaded) || !same(&loaded, &state)) {
+            fail("saved state not loaded", save);
+        }
+    }
+
+    for (i = 0; i < HOST_EEPROM_BYTES / 4; i++) {
+        if (hostEepromWrites[i] > worst) {
+            worst = hostEepromWrites[i];
+        }
+        if (hostEepromWrites[i]) {
+            worn++;
+        }
+    }
+    mean = (double) totalWrites() / (HOST_EEPROM_BYTES / 4);
+    lifetime = (double) STORE_ENDURANCE * saves / worst;
+
+    printf("%lu saves, %lu the same as the last\n", saves, repeats);
+    printf("words programmed     %10.2f per save, %.2f ms stalled\n",
+        (double) totalWrites() / saves, stalled / CORE_HZ * 1000 / saves);
+    printf("boot reads           %10d words in %d slots\n",
+        (int) (STORE_SLOTS * STORE_RECORD_WORDS), (int) STORE_SLOTS);
+    printf("writes per word      %10lu worst, %.1f mean over %lu of %d words\n", worst, mean,
+        worn, HOST_EEPROM_BYTES / 4);
+    printf("endurance            %10.0f saves, %.0f years at %lu a day\n", lifetime,
+        lifetime / perDay / 365.0, perDay);
+    return 0;
+}
@@ -0,0 +1,236 @@
+//------------------------------------------------------------------------------
+// SPI flash streaming benchmark
+//
+// Runs the stream and the player against the SPI flash model in the stubs,
+// in virtual time, for every song in the flash. Two figures per song:
+//   - read: every event is taken from the stream in order as fast as the
+//     core allows, spending -e cycles on each. This is the sustained rate the
+//     backend can feed; underruns here mean the core outruns the flash.
+//   - play: the song is played through the real player with the cycle model
+//     of tools/jitter.c. Underruns here are late notes.
+// Both report the worst time to read one block and the worst wait for one.
+//
+// The flash is a songpack -e image given with -f, or with -s a set of
+// synthetic songs packed into one in memory. Dense synthetic songs (-t for a
+// fast tempo, -z for the share of events stacked on one beat) show where
+// playback starts to underrun.
+//
+// Usage:
+//   streambench -f flash [-e event_cycles] [-i irq_cycles] [-m loop_cycles]
+//   streambench -s events... [-S seed] [-t bpm] [-z stacked_percent] [...]
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o streambench tools/streambench.c source/player.c source/dmaplay.c source/phrase.c source/keys.c source/scheduler.c source/power.c source/songs.c source/spiflash.c source/stream.c tools/stubs/stubs.c tools/stubs/synth.c
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "STM32L1xx.h"
+#include "keys.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+#include "songs.h"
+#include "spiflash.h"
+#include "stream.h"
+#include "stubs.h"
+#include "synth.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define MAX_SYNTHETIC   64
+#define EVENT_CYCLES    150 // fetchEvents() on one event with a few keys
+#define IRQ_CYCLES      60
+#define LOOP_CYCLES     100
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// A songpack -e image in hostFlash. stacked is the percentage of events that
+// share the beat of the one before.
+static void buildFlash(const int* lengths, int count, int tempo, int stacked) {
+    struct SongHeader* header;
+    struct SongEvent* events;
+    uint32_t size, held, on, off, delta;
+    int i, e;
+
+    size = SYNTH_FIRST_SONG(count);
+    for (i = 0; i < count; i++) {
+        size += SYNTH_SONG_BYTES(lengths[i]);
+    }
+    if (size > SONG_SPI_SIZE) {
+        fprintf(stderr, "streambench: synthetic songs need %lu bytes, the flash holds %lu\n",
+            (unsigned long) size, (unsigned long) SONG_SPI_SIZE);
+        exit(2);
+    }
+
+    free(hostFlash);
+    hostFlash = (uint8_t*) synthDirectory(count, size);
+    hostFlashSize = size;
+
+    size = SYNTH_FIRST_SONG(count);
+    for (i = 0; i < count; i++) {
+        header = synthSong((struct SongDirectory*) hostFlash, i, size, (uint32_t) lengths[i]);
+        events = (struct SongEvent*) (hostFlash + header->events);
+
+        held = 0;
+        for (e = 0; e < lengths[i]; e++) {
+            delta = e && (int) (synthRandom() % 100) >= stacked ? 1 : 0;
+            synthChord(held, &on, &off);
+            if (e == lengths[i] - 1) {
+                off = held;
+                on = 0;
+            }
+            held = (held & ~off) | on;
+            events[e].onKeys = (delta << 24) | on;
+            events[e].offKeys = off;
+        }
+
+        sprintf(header->name, "Dense %d", lengths[i]);
+        synthTempo(header, tempo);
+        size += SYNTH_SONG_BYTES(lengths[i]);
+    }
+}
+
+static void printRow(const char* what, const char* name, int events, double seconds) {
+    double perMicro = SystemCoreClock / 1e6;
+
+    printf("%-5s %-28s %7d %10.0f %9lu %9.1f %9.1f\n", what, name, events,
+        seconds > 0 ? events / seconds : 0, (unsigned long) streamStats.underruns,
+        streamStats.worstRefill / perMicro, streamStats.worstWait / perMicro);
+}
+
+// Every event in order with eventCycles of work each, no player
+static void readSong(const struct SongData* song, uint32_t eventCycles) {
+    uint64_t start;
+    int i;
+
+    hostReset();
+    powerInit();
+    start = hostCycles;
+    streamOpen(song);
+    for (i = 0; i < song->length; i++) {
+        streamEvent(i);
+        hostSpend(eventCycles);
+    }
+
+    printRow("read", song->name, song->length, (hostCycles - start) / (double) SystemCoreClock);
+}
+
+static void playSong(int index, const char* name, int length, uint32_t irqCycles,
+    uint32_t loopCycles) {
+    uint64_t start;
+
+    hostReset();
+    hostIrqCycles = irqCycles;
+    powerInit();
+    schedInit();
+    playerInit();
+
+    start = hostCycles;
+    playerStart(index);
+    while (1) {
+        if (schedPoll()) {
+            hostSpend(loopCycles);
+            if (!playerStep()) {
+                break;
+            }
+        } else if (!hostStep()) {
+            fprintf(stderr, "streambench: timer stopped in song %d\n", index);
+            exit(1);
+        }
+    }
+    hostIrqCycles = 0;
+
+    printRow("play", name, length, (hostCycles - start) / (double) SystemCoreClock);
+}
+
+int main(int argc, char** argv) {
+    struct SongData song;
+    char name[SONG_NAME_BYTES];
+    int synthetic[MAX_SYNTHETIC];
+    uint32_t eventCycles = EVENT_CYCLES, irqCycles = IRQ_CYCLES, loopCycles = LOOP_CYCLES;
+    int numSynthetic = 0, tempo = 240, stacked = 50, flash = 0, opt, i, length;
+
+    for (opt = 1; opt < argc; opt++) {
+        if (opt + 1 >= argc || argv[opt][0] != '-' || argv[opt][2]) {
+            fprintf(stderr, "usage: %s -f flash [-e event_cycles] [-i irq_cycles] [-m loop_cycles]\n"
+                "       %s -s events... [-S seed] [-t bpm] [-z stacked_percent] [...]\n",
+                argv[0], argv[0]);
+            return 2;
+        }
+
+        switch (argv[opt][1]) {
+        case 'f':
+            if (!hostFlashLoad(argv[++opt])) {
+                perror(argv[opt]);
+                return 2;
+            }
+            flash = 1;
+            break;
+        case 's':
+            i = atoi(argv[++opt]);
+            if (i < 1 || numSynthetic == MAX_SYNTHETIC) {
+                fprintf(stderr, "streambench: bad synthetic song %s\n", argv[opt]);
+                return 2;
+            }
+            synthetic[numSynthetic++] = i;
+            break;
+        case 'S':
+            synthSeed = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        case 't':
+            tempo = atoi(argv[++opt]);
+            break;
+        case 'z':
+            stacked = atoi(argv[++opt]);
+            break;
+        case 'e':
+            eventCycles = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        case 'i':
+            irqCycles = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        case 'm':
+            loopCycles = (uint32_t) strtoul(argv[++opt], NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "streambench: unknown option %s\n", argv[opt]);
+            return 2;
+        }
+    }
+
+    if (flash == !!numSynthetic || tempo < 1 || tempo > 0xFFFF) {
+        fprintf(stderr, "streambench: give either -f or -s, and a tempo from 1 to 65535\n");
+        return 2;
+    }
+    if (numSynthetic) {
+        buildFlash(synthetic, numSynthetic, tempo, stacked);
+    }
+
+    hostReset();
+    powerInit();
+    spiFlashInit();
+    songsInit(NULL);
+    if (songCount() == numSongs) {
+        fprintf(stderr, "streambench: no song directory in the flash\n");
+        return 1;
+    }
+
+    printf("%-5s %-28s %7s %10s %9s %9s %9s\n", "", "song", "events", "events/s",
+        "underruns", "refill us", "wait us");
+    for (i = numSongs; i < songCount(); i++) {
+        if (!songLoad(i, &song)) {
+            printf("song %d is damaged\n", i);
+            continue;
+        }
+        strcpy(name, song.name);
+        length = song.length;
+
+        readSong(&song, eventCycles);
+        playSong(i, name, length, irqCycles, loopCycles);
+    }
+
+    return 0;
+}
@@ -0,0 +1,381 @@
+//------------------------------------------------------------------------------
+// Host stand-in for the Keil STM32L1xx device header
+//
+// Peripheral register blocks are plain structs in RAM (defined in stubs.c) so
+// the firmware modules in ../../source compile and run unchanged on a PC. Only
+// the registers and bits the firmware touches are modelled.
+//------------------------------------------------------------------------------
+#ifndef STM32L1XX_H
+#define STM32L1XX_H
+
+#include <stdint.h>
+
+#define __IO volatile
+#define __INLINE inline
+
+//------------------------------------------------------------------------------
+// Interrupt Numbers
+//------------------------------------------------------------------------------
+typedef enum {
+    SysTick_IRQn    = -1,
+    EXTI0_IRQn      = 6,
+    EXTI1_IRQn      = 7,
+    EXTI2_IRQn      = 8,
+    EXTI3_IRQn      = 9,
+    DMA1_Channel3_IRQn = 13,
+    DMA1_Channel4_IRQn = 14,
+    DMA1_Channel5_IRQn = 15,
+    TIM2_IRQn       = 28,
+    USART1_IRQn     = 37
+} IRQn_Type;
+
+//------------------------------------------------------------------------------
+// Register Blocks
+//------------------------------------------------------------------------------
+typedef struct {
+    __IO uint32_t MODER;
+    __IO uint32_t OTYPER;
+    __IO uint32_t OSPEEDR;
+    __IO uint32_t PUPDR;
+    __IO uint32_t IDR;
+    __IO uint32_t ODR;
+    __IO uint32_t BSRR;
+    __IO uint32_t LCKR;
+    __IO uint32_t AFR[2];
+} GPIO_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR;
+    __IO uint32_t ICSCR;
+    __IO uint32_t CFGR;
+    __IO uint32_t CIR;
+    __IO uint32_t AHBRSTR;
+    __IO uint32_t APB2RSTR;
+    __IO uint32_t APB1RSTR;
+    __IO uint32_t AHBENR;
+    __IO uint32_t APB2ENR;
+    __IO uint32_t APB1ENR;
+} RCC_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR;
+    __IO uint32_t CSR;
+} PWR_TypeDef;
+
+typedef struct {
+    __IO uint32_t MEMRMP;
+    __IO uint32_t PMC;
+    __IO uint32_t EXTICR[4];
+} SYSCFG_TypeDef;
+
+typedef struct {
+    __IO uint32_t CPUID;
+    __IO uint32_t ICSR;
+    __IO uint32_t VTOR;
+    __IO uint32_t AIRCR;
+    __IO uint32_t SCR;
+    __IO uint32_t CCR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t DHCSR;
+    __IO uint32_t DCRSR;
+    __IO uint32_t DCRDR;
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO union {
+        __IO uint8_t u8;
+        __IO uint16_t u16;
+        __IO uint32_t u32;
+    } PORT[32];
+    __IO uint32_t TER;
+    __IO uint32_t TPR;
+    __IO uint32_t TCR;
+} ITM_Type;
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t LOAD;
+    __IO uint32_t VAL;
+    __IO uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct {
+    __IO uint32_t IMR;
+    __IO uint32_t EMR;
+    __IO uint32_t RTSR;
+    __IO uint32_t FTSR;
+    __IO uint32_t SWIER;
+    __IO uint32_t PR;
+} EXTI_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t SMCR;
+    __IO uint32_t DIER;
+    __IO uint32_t SR;
+    __IO uint32_t EGR;
+    __IO uint32_t CCMR1;
+    __IO uint32_t CCMR2;
+    __IO uint32_t CCER;
+    __IO uint32_t CNT;
+    __IO uint32_t PSC;
+    __IO uint32_t ARR;
+    __IO uint32_t RESERVED12;
+    __IO uint32_t CCR1;
+    __IO uint32_t CCR2;
+    __IO uint32_t CCR3;
+    __IO uint32_t CCR4;
+} TIM_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t SR;
+    __IO uint32_t DR;
+    __IO uint32_t CRCPR;
+    __IO uint32_t RXCRCR;
+    __IO uint32_t TXCRCR;
+} SPI_TypeDef;
+
+typedef struct {
+    __IO uint32_t SR;
+    __IO uint32_t DR;
+    __IO uint32_t BRR;
+    __IO uint32_t CR1;
+    __IO uint32_t CR2;
+    __IO uint32_t CR3;
+    __IO uint32_t GTPR;
+} USART_TypeDef;
+
+// Addresses are pointer sized so the host can hold its 64-bit ones
+typedef struct {
+    __IO uint32_t CCR;
+    __IO uint32_t CNDTR;
+    __IO uintptr_t CPAR;
+    __IO uintptr_t CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+    __IO uint32_t ISR;
+    __IO uint32_t IFCR;
+} DMA_TypeDef;
+
+typedef struct {
+    __IO uint32_t ACR;
+    __IO uint32_t PECR;
+    __IO uint32_t PDKEYR;
+    __IO uint32_t PEKEYR;
+    __IO uint32_t PRGKEYR;
+    __IO uint32_t OPTKEYR;
+    __IO uint32_t SR;
+    __IO uint32_t OBR;
+    __IO uint32_t WRPR;
+} FLASH_TypeDef;
+
+extern GPIO_TypeDef hostGPIOA, hostGPIOB, hostGPIOC;
+extern RCC_TypeDef hostRCC;
+extern PWR_TypeDef hostPWR;
+extern SYSCFG_TypeDef hostSYSCFG;
+extern EXTI_TypeDef hostEXTI;
+extern TIM_TypeDef hostTIM2, hostTIM3;
+extern SysTick_Type hostSysTick;
+extern SCB_Type hostSCB;
+extern CoreDebug_Type hostCoreDebug;
+extern DWT_Type hostDWT;
+extern ITM_Type hostITM;
+extern SPI_TypeDef hostSPI1, hostSPI2;
+extern USART_TypeDef hostUSART1;
+extern DMA_TypeDef hostDMA1;
+extern FLASH_TypeDef hostFLASH;
+extern uint8_t hostEeprom[];
+extern DMA_Channel_TypeDef hostDMA1Channel2, hostDMA1Channel3, hostDMA1Channel4,
+    hostDMA1Channel5, hostDMA1Channel6;
+
+// Every GPIO access goes through hostGpio() first so a previous BSRR write is
+// applied to ODR. RCC ready flags follow their enable bits and DWT->CYCCNT
+// follows virtual time. Status registers are rc_w0 on the part; every TIM2
+// access goes through hostTim2() so a previous "SR = ~flag" write clears the
+// flag.
+// hostDma1() applies IFCR writes the same way, and hostSpi2() clocks a byte
+// written to DR through the SPI flash model. hostTim3() loads ARR at once
+// unless ARPE is set and applies a UG write. hostNvm() takes the words
+// stored to the data EEPROM since the last FLASH access as programmed, or
+// puts them back if it is locked.
+GPIO_TypeDef* hostGpio(GPIO_TypeDef* port);
+RCC_TypeDef* hostRcc(void);
+DWT_Type* hostDwt(void);
+TIM_TypeDef* hostTim2(void);
+TIM_TypeDef* hostTim3(void);
+SPI_TypeDef* hostSpi2(void);
+DMA_TypeDef* hostDma1(void);
+FLASH_TypeDef* hostNvm(void);
+
+#define GPIOA   (hostGpio(&hostGPIOA))
+#define GPIOB   (hostGpio(&hostGPIOB))
+#define GPIOC   (hostGpio(&hostGPIOC))
+#define RCC     (hostRcc())
+#define PWR     (&hostPWR)
+#define SYSCFG  (&hostSYSCFG)
+#define EXTI    (&hostEXTI)
+#define TIM2    (hostTim2())
+#define TIM3    (hostTim3())
+#define SysTick (&hostSysTick)
+#define SCB     (&hostSCB)
+#define CoreDebug (&hostCoreDebug)
+#define DWT     (hostDwt())
+#define ITM     (&hostITM)
+#define SPI1    (&hostSPI1)
+#define SPI2    (hostSpi2())
+#define USART1  (&hostUSART1)
+#define DMA1    (hostDma1())
+#define DMA1_Channel2 (&hostDMA1Channel2)
+#define DMA1_Channel3 (&hostDMA1Channel3)
+#define DMA1_Channel4 (&hostDMA1Channel4)
+#define DMA1_Channel5 (&hostDMA1Channel5)
+#define DMA1_Channel6 (&hostDMA1Channel6)
+#define FLASH   (hostNvm())
+
+#define DATA_EEPROM_BASE ((uintptr_t) hostEeprom)
+#define DATA_EEPROM_END (DATA_EEPROM_BASE + 0x0FFF) // 4 KB, as the STM32L100RC
+
+//------------------------------------------------------------------------------
+// Bit Definitions
+//------------------------------------------------------------------------------
+#define RCC_CR_HSEON            ((uint32_t)0x00010000)
+#define RCC_CR_HSERDY           ((uint32_t)0x00020000)
+#define RCC_CR_PLLON            ((uint32_t)0x01000000)
+#define RCC_CR_PLLRDY           ((uint32_t)0x02000000)
+#define RCC_CFGR_SW             ((uint32_t)0x00000003)
+#define RCC_CFGR_SW_PLL         ((uint32_t)0x00000003)
+#define RCC_CFGR_SWS            ((uint32_t)0x0000000C)
+#define RCC_CFGR_SWS_PLL        ((uint32_t)0x0000000C)
+#define RCC_AHBENR_GPIOAEN      ((uint32_t)0x00000001)
+#define RCC_AHBENR_GPIOBEN      ((uint32_t)0x00000002)
+#define RCC_AHBENR_DMA1EN       ((uint32_t)0x01000000)
+#define RCC_APB1ENR_TIM2EN      ((uint32_t)0x00000001)
+#define RCC_APB1ENR_TIM3EN      ((uint32_t)0x00000002)
+#define RCC_APB1ENR_SPI2EN      ((uint32_t)0x00004000)
+#define RCC_APB1ENR_PWREN       ((uint32_t)0x10000000)
+#define RCC_APB2ENR_SYSCFGEN    ((uint32_t)0x00000001)
+#define RCC_APB2ENR_SPI1EN      ((uint32_t)0x00001000)
+#define RCC_APB2ENR_USART1EN    ((uint32_t)0x00004000)
+
+#define PWR_CR_LPSDSR   ((uint32_t)0x00000001)
+#define PWR_CR_PDDS     ((uint32_t)0x00000002)
+#define PWR_CR_CWUF     ((uint32_t)0x00000004)
+#define PWR_CR_ULP      ((uint32_t)0x00000200)
+#define PWR_CR_FWU      ((uint32_t)0x00000400)
+
+#define SCB_SCR_SLEEPDEEP_Msk           ((uint32_t)0x00000004)
+#define CoreDebug_DEMCR_TRCENA_Msk      ((uint32_t)0x01000000)
+#define DWT_CTRL_CYCCNTENA_Msk          ((uint32_t)0x00000001)
+#define ITM_TCR_ITMENA_Msk              ((uint32_t)0x00000001)
+
+#define EXTI_IMR_MR0    ((uint32_t)0x00000001)
+#define EXTI_IMR_MR1    ((uint32_t)0x00000002)
+#define EXTI_IMR_MR2    ((uint32_t)0x00000004)
+#define EXTI_IMR_MR3    ((uint32_t)0x00000008)
+#define EXTI_PR_PR0     ((uint32_t)0x00000001)
+#define EXTI_PR_PR1     ((uint32_t)0x00000002)
+#define EXTI_PR_PR2     ((uint32_t)0x00000004)
+#define EXTI_PR_PR3     ((uint32_t)0x00000008)
+
+#define SysTick_CTRL_ENABLE_Msk     ((uint32_t)0x00000001)
+#define SysTick_CTRL_TICKINT_Msk    ((uint32_t)0x00000002)
+#define SysTick_CTRL_CLKSOURCE_Msk  ((uint32_t)0x00000004)
+
+#define TIM_CR1_CEN     ((uint32_t)0x0001)
+#define TIM_CR1_URS     ((uint32_t)0x0004)
+#define TIM_CR1_ARPE    ((uint32_t)0x0080)
+#define TIM_DIER_UIE    ((uint32_t)0x0001)
+#define TIM_DIER_CC1IE  ((uint32_t)0x0002)
+#define TIM_DIER_UDE    ((uint32_t)0x0100)
+#define TIM_DIER_CC1DE  ((uint32_t)0x0200)
+#define TIM_DIER_CC3DE  ((uint32_t)0x0800)
+#define TIM_SR_UIF      ((uint32_t)0x0001)
+#define TIM_SR_CC1IF    ((uint32_t)0x0002)
+#define TIM_EGR_UG      ((uint32_t)0x0001)
+
+#define SPI_CR1_MSTR    ((uint32_t)0x0004)
+#define SPI_CR1_BR      ((uint32_t)0x0038)
+#define SPI_CR1_BR_0    ((uint32_t)0x0008)
+#define SPI_CR1_SPE     ((uint32_t)0x0040)
+#define SPI_CR1_SSI     ((uint32_t)0x0100)
+#define SPI_CR1_SSM     ((uint32_t)0x0200)
+#define SPI_CR1_RXONLY  ((uint32_t)0x0400)
+#define SPI_CR2_RXDMAEN ((uint32_t)0x0001)
+#define SPI_CR2_TXDMAEN ((uint32_t)0x0002)
+#define SPI_SR_RXNE     ((uint32_t)0x0001)
+#define SPI_SR_TXE      ((uint32_t)0x0002)
+#define SPI_SR_BSY      ((uint32_t)0x0080)
+
+#define USART_SR_FE     ((uint32_t)0x0002)
+#define USART_SR_NE     ((uint32_t)0x0004)
+#define USART_SR_ORE    ((uint32_t)0x0008)
+#define USART_SR_IDLE   ((uint32_t)0x0010)
+#define USART_SR_RXNE   ((uint32_t)0x0020)
+#define USART_SR_TC     ((uint32_t)0x0040)
+#define USART_SR_TXE    ((uint32_t)0x0080)
+#define USART_CR1_RE    ((uint32_t)0x0004)
+#define USART_CR1_TE    ((uint32_t)0x0008)
+#define USART_CR1_IDLEIE ((uint32_t)0x0010)
+#define USART_CR1_RXNEIE ((uint32_t)0x0020)
+#define USART_CR1_UE    ((uint32_t)0x2000)
+#define USART_CR3_DMAR  ((uint32_t)0x0040)
+
+#define DMA_CCR1_EN     ((uint32_t)0x0001)
+#define DMA_CCR1_TCIE   ((uint32_t)0x0002)
+#define DMA_CCR1_HTIE   ((uint32_t)0x0004)
+#define DMA_CCR1_DIR    ((uint32_t)0x0010)
+#define DMA_CCR1_CIRC   ((uint32_t)0x0020)
+#define DMA_CCR1_MINC   ((uint32_t)0x0080)
+#define DMA_CCR1_PSIZE_1 ((uint32_t)0x0200)
+#define DMA_CCR1_MSIZE_1 ((uint32_t)0x0800)
+#define DMA_CCR1_PL     ((uint32_t)0x3000)
+#define DMA_ISR_GIF3    ((uint32_t)0x00000100)
+#define DMA_ISR_TCIF3   ((uint32_t)0x00000200)
+#define DMA_ISR_HTIF3   ((uint32_t)0x00000400)
+#define DMA_ISR_GIF4    ((uint32_t)0x00001000)
+#define DMA_ISR_TCIF4   ((uint32_t)0x00002000)
+#define DMA_ISR_GIF5    ((uint32_t)0x00010000)
+#define DMA_ISR_TCIF5   ((uint32_t)0x00020000)
+#define DMA_ISR_HTIF5   ((uint32_t)0x00040000)
+#define DMA_IFCR_CGIF2  ((uint32_t)0x00000010)
+#define DMA_IFCR_CGIF3  ((uint32_t)0x00000100)
+#define DMA_IFCR_CGIF4  ((uint32_t)0x00001000)
+#define DMA_IFCR_CGIF5  ((uint32_t)0x00010000)
+#define DMA_IFCR_CGIF6  ((uint32_t)0x00100000)
+
+#define FLASH_PECR_PELOCK ((uint32_t)0x00000001)
+#define FLASH_SR_BSY    ((uint32_t)0x00000001)
+#define FLASH_SR_EOP    ((uint32_t)0x00000002)
+#define FLASH_SR_WRPERR ((uint32_t)0x00000100)
+#define FLASH_SR_PGAERR ((uint32_t)0x00000200)
+#define FLASH_SR_SIZERR ((uint32_t)0x00000400)
+
+//------------------------------------------------------------------------------
+// Core Functions
+//------------------------------------------------------------------------------
+extern uint32_t SystemCoreClock;
+
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn);
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority);
+void __enable_irq(void);
+void __disable_irq(void);
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t priMask);
+void __WFI(void);
+uint32_t SysTick_Config(uint32_t ticks);
+
+#endif
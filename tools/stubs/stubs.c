@@ -0,0 +1,892 @@
+//------------------------------------------------------------------------------
+// Host peripheral stubs
+//
+// Register blocks live in RAM. TIM2 and SysTick are emulated in virtual time:
+// hostStep() jumps straight to the next timer event and runs its interrupt
+// handler, so no real time passes between events. Handlers the program does
+// not link default to empty weak functions, as in the startup file.
+//
+// Output pin changes are reported through hostTrace, stamped with the virtual
+// time at which the firmware made them.
+//
+// Firmware code takes no time unless a cycle model is given: hostIrqCycles is
+// charged before each interrupt handler runs and hostSpend() charges the time
+// of a stretch of main loop code, taking any interrupts that fall inside it.
+//
+// SPI2 talks to a model of a NOR flash whose contents come from a file, with
+// PB12 as chip select. Bytes the CPU writes to DR are taken as the command
+// and address and cost no time; a DMA receive takes eight SPI clocks a byte
+// and its data lands in memory when it completes. Only the read command
+// (0x03) returns data, anything else reads as all ones.
+//
+// SPI1 feeds a chain of 74HC595 latches, the first byte out ending up in the
+// farthest. A DMA1 channel 3 transmit takes eight SPI clocks a byte and
+// shifts its data in when it completes, after which the SPI is idle. A rising
+// edge on PB6 copies the shift registers to hostChain.
+//
+// TIM3 runs in virtual time too. Each update asks DMA1 for a word on channel
+// 3, and on channels 6 and 2 when compares 1 and 3 are at zero and so match
+// with it; a channel moves one word from memory to its peripheral, raising
+// its half and full transfer flags. Only channel 3 has an interrupt.
+//
+// Bytes given to hostUartSend() reach USART1 back to back, ten bit times each
+// at the rate BRR sets, and DMA1 channel 5 stores them as they land, or DR
+// takes them when DMA is off. The line goes idle one character after the
+// last. The IDLE and RXNE flags are cleared once the USART1 handler has run
+// rather than by the SR and DR reads. The transmitter is always ready and
+// what is written to send is dropped.
+//
+// The data EEPROM is hostEeprom, erased to zeros, and keeps its contents
+// across hostReset() as the part does across a power cycle. Words the
+// firmware stores there are taken as programmed at its next FLASH access,
+// each costing the part's word program time and counted in
+// hostEepromWrites. While PECR is locked, or once hostEepromCut more words
+// have been programmed, they are put back as they were.
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "STM32L1xx.h"
+#include "stubs.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define HOST_SPI_IDLE   0xFFFF0000 // DR holds no byte written by the CPU
+#define HOST_SPI_CS     0x00001000 // PB12
+#define HOST_CHAIN_LATCH 0x00000040 // PB6
+#define HOST_FLASH_READ 0x03
+#define HOST_UART_QUEUE 4096 // Bytes sent but not yet landed
+#define HOST_PEKEY1     0x89ABCDEF
+#define HOST_PEKEY2     0x02030405
+#define HOST_NVM_UNWRITTEN 0x80000000
+#define HOST_EEPROM_WORD_CYCLES 104960 // 3.28 ms at 32 MHz, erase and program
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+GPIO_TypeDef hostGPIOA, hostGPIOB, hostGPIOC;
+RCC_TypeDef hostRCC;
+PWR_TypeDef hostPWR;
+SYSCFG_TypeDef hostSYSCFG;
+EXTI_TypeDef hostEXTI;
+TIM_TypeDef hostTIM2, hostTIM3;
+SysTick_Type hostSysTick;
+SCB_Type hostSCB;
+CoreDebug_Type hostCoreDebug;
+DWT_Type hostDWT;
+ITM_Type hostITM; // Never enabled, as with no debugger attached
+SPI_TypeDef hostSPI1 = { 0, 0, SPI_SR_TXE, 0, 0, 0, 0 };
+SPI_TypeDef hostSPI2 = { 0, 0, 0, HOST_SPI_IDLE, 0, 0, 0 };
+USART_TypeDef hostUSART1;
+DMA_TypeDef hostDMA1;
+DMA_Channel_TypeDef hostDMA1Channel2, hostDMA1Channel3, hostDMA1Channel4,
+    hostDMA1Channel5, hostDMA1Channel6;
+
+uint32_t SystemCoreClock = 32000000;
+uint64_t hostCycles;
+uint32_t hostIrqCycles;
+void (*hostTrace)(char port, uint32_t odr);
+uint8_t* hostFlash;
+uint32_t hostFlashSize;
+uint8_t hostChain[HOST_CHAIN_BYTES];
+void (*hostLatch)(void);
+FLASH_TypeDef hostFLASH;
+uint8_t hostEeprom[HOST_EEPROM_BYTES];
+uint32_t hostEepromWrites[HOST_EEPROM_BYTES / 4];
+int hostEepromCut = -1;
+
+static uint32_t hostTim2Flags;
+static uint32_t hostTim2Phase; // Core cycles into the current timer tick
+static uint32_t hostTim3Phase;
+static uint32_t hostTim3Top; // Reload in use; ARR is its preload with ARPE set
+static uint32_t hostDmaLength[8]; // Of each channel's transfer, 0 until seen
+static uint32_t hostTraced[3]; // Last ODR reported for GPIOA-C
+static int hostTickPending;
+static uint32_t hostDmaFlags;
+static uint64_t hostDmaLeft; // Cycles until the running receive ends, 0 if none
+static int hostDmaPending;
+static uint64_t hostDma3Left; // Cycles until the running transmit ends, 0 if none
+static int hostDma3Pending;
+static uint8_t hostChainShift[HOST_CHAIN_BYTES]; // Index 0 is the nearest latch
+static int hostSpiBytes; // Clocked since chip select went low
+static uint32_t hostSpiCommand;
+static uint32_t hostSpiAddress;
+static uint8_t hostUartBytes[HOST_UART_QUEUE];
+static int hostUartHead;
+static int hostUartCount;
+static uint64_t hostUartLeft; // Cycles until the next byte or idle, 0 if none
+static int hostUartBusy; // A byte has landed since the line was last idle
+static uint32_t hostUartRing; // Length of the circular transfer, 0 until seen
+static int hostUartPending;
+static int hostDma5Pending;
+static uint8_t hostEepromShadow[HOST_EEPROM_BYTES]; // As last programmed
+static int hostPeKeys; // PEKEYR writes of the unlock sequence so far
+static uint32_t hostNvmFlags;
+
+//------------------------------------------------------------------------------
+// Default Interrupt Handlers
+//------------------------------------------------------------------------------
+__attribute__((weak)) void TIM2_IRQHandler(void) { }
+__attribute__((weak)) void SysTick_Handler(void) { }
+__attribute__((weak)) void DMA1_Channel3_IRQHandler(void) { }
+__attribute__((weak)) void DMA1_Channel4_IRQHandler(void) { }
+__attribute__((weak)) void DMA1_Channel5_IRQHandler(void) { }
+__attribute__((weak)) void USART1_IRQHandler(void) { }
+
+//------------------------------------------------------------------------------
+// Core Functions
+//------------------------------------------------------------------------------
+void NVIC_EnableIRQ(IRQn_Type IRQn) { (void) IRQn; }
+void NVIC_DisableIRQ(IRQn_Type IRQn) { (void) IRQn; }
+void NVIC_ClearPendingIRQ(IRQn_Type IRQn) { (void) IRQn; }
+void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority) { (void) IRQn; (void) priority; }
+void __enable_irq(void) { }
+void __disable_irq(void) { }
+uint32_t __get_PRIMASK(void) { return 0; }
+void __set_PRIMASK(uint32_t priMask) { (void) priMask; }
+
+void __WFI(void) {
+    hostStep();
+}
+
+uint32_t SysTick_Config(uint32_t ticks) {
+    SysTick->LOAD = ticks - 1;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk |
+        SysTick_CTRL_ENABLE_Msk;
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+void hostReset() {
+    hostCycles = 0;
+    hostTim2Flags = 0;
+    hostTim2Phase = 0;
+    hostTIM3.CR1 = 0;
+    hostTIM3.DIER = 0;
+    hostTim3Phase = 0;
+    hostTim3Top = 0;
+    memset(hostDmaLength, 0, sizeof(hostDmaLength));
+    hostTickPending = 0;
+    hostDmaFlags = 0;
+    hostDmaLeft = 0;
+    hostDmaPending = 0;
+    hostSpiBytes = 0;
+    hostSPI2.DR = HOST_SPI_IDLE;
+    hostDma3Left = 0;
+    hostDma3Pending = 0;
+    hostSPI1.CR1 = 0;
+    hostSPI1.CR2 = 0;
+    hostDMA1Channel2.CCR = 0;
+    hostDMA1Channel3.CCR = 0;
+    hostDMA1Channel4.CCR = 0;
+    hostDMA1Channel5.CCR = 0;
+    hostDMA1Channel6.CCR = 0;
+    hostUSART1.CR1 = 0;
+    hostUSART1.SR = USART_SR_TXE | USART_SR_TC;
+    hostUartHead = 0;
+    hostUartCount = 0;
+    hostUartLeft = 0;
+    hostUartBusy = 0;
+    hostUartRing = 0;
+    hostUartPending = 0;
+    hostDma5Pending = 0;
+    hostGPIOA.IDR = 0x0000000F; // Buttons idle high
+    hostFLASH.PECR = FLASH_PECR_PELOCK;
+    hostFLASH.PEKEYR = 0;
+    hostFLASH.SR = HOST_NVM_UNWRITTEN;
+    hostPeKeys = 0;
+    hostNvmFlags = 0;
+    memset(hostChainShift, 0xFF, sizeof(hostChainShift)); // Latches power up anyhow
+    memset(hostChain, 0xFF, sizeof(hostChain));
+    hostTraced[0] = hostGPIOA.ODR;
+    hostTraced[1] = hostGPIOB.ODR;
+    hostTraced[2] = hostGPIOC.ODR;
+}
+
+// Apply pending BSRR writes so they are reported before time moves on
+void hostFlush() {
+    hostGpio(&hostGPIOA);
+    hostGpio(&hostGPIOB);
+    hostGpio(&hostGPIOC);
+}
+
+// BSRR is write-only: the low half sets ODR bits, the high half clears them,
+// and set wins when both are given
+GPIO_TypeDef* hostGpio(GPIO_TypeDef* port) {
+    int index = port == &hostGPIOA ? 0 : port == &hostGPIOB ? 1 : 2;
+    uint32_t before = port->ODR;
+    int i;
+
+    if (port->BSRR) {
+        port->ODR = (port->ODR & ~(port->BSRR >> 16)) | (port->BSRR & 0xFFFF);
+        port->BSRR = 0;
+    }
+    if (port == &hostGPIOB && (port->ODR & ~before & HOST_CHAIN_LATCH)) {
+        for (i = 0; i < HOST_CHAIN_BYTES; i++) {
+            hostChain[i] = hostChainShift[i];
+        }
+        if (hostLatch) {
+            hostLatch();
+        }
+    }
+    if (port == &hostGPIOB && (port->ODR & HOST_SPI_CS)) {
+        hostSpiBytes = 0; // Deselected, the next byte is a command
+    }
+    if (port->ODR != hostTraced[index]) {
+        hostTraced[index] = port->ODR;
+        if (hostTrace) {
+            hostTrace((char) ('A' + index), port->ODR);
+        }
+    }
+
+    return port;
+}
+
+// Oscillators and the clock switch are ready as soon as they are asked for
+RCC_TypeDef* hostRcc() {
+    uint32_t ready = 0;
+    if (hostRCC.CR & RCC_CR_HSEON) {
+        ready |= RCC_CR_HSERDY;
+    }
+    if (hostRCC.CR & RCC_CR_PLLON) {
+        ready |= RCC_CR_PLLRDY;
+    }
+    hostRCC.CR = (hostRCC.CR & ~(RCC_CR_HSERDY | RCC_CR_PLLRDY)) | ready;
+    hostRCC.CFGR = (hostRCC.CFGR & ~RCC_CFGR_SWS) | ((hostRCC.CFGR & RCC_CFGR_SW) << 2);
+    return &hostRCC;
+}
+
+DWT_Type* hostDwt() {
+    if (hostDWT.CTRL & DWT_CTRL_CYCCNTENA_Msk) {
+        hostDWT.CYCCNT = (uint32_t) hostCycles;
+    }
+    return &hostDWT;
+}
+
+// TIMx->SR is rc_w0: the firmware writes ~flag to clear a flag. A RAM register
+// keeps the inverted value, so fold the last write back into the real flags.
+TIM_TypeDef* hostTim2() {
+    hostTim2Flags &= hostTIM2.SR;
+    hostTIM2.SR = hostTim2Flags;
+    return &hostTIM2;
+}
+
+TIM_TypeDef* hostTim3() {
+    if (!(hostTIM3.CR1 & TIM_CR1_ARPE)) {
+        hostTim3Top = hostTIM3.ARR & 0xFFFF;
+    }
+    if (hostTIM3.EGR & TIM_EGR_UG) {
+        hostTIM3.EGR = 0;
+        hostTIM3.CNT = 0;
+        hostTim3Phase = 0;
+        hostTim3Top = hostTIM3.ARR & 0xFFFF;
+    }
+    return &hostTIM3;
+}
+
+// A byte written to DR goes to the flash; its reply is not needed
+SPI_TypeDef* hostSpi2() {
+    uint32_t byte = hostSPI2.DR;
+
+    if (byte != HOST_SPI_IDLE) {
+        hostSPI2.DR = HOST_SPI_IDLE;
+        hostGpio(&hostGPIOB);
+        if (!(hostGPIOB.ODR & HOST_SPI_CS)) {
+            if (hostSpiBytes == 0) {
+                hostSpiCommand = byte & 0xFF;
+                hostSpiAddress = 0;
+            } else if (hostSpiBytes < 4) {
+                hostSpiAddress = (hostSpiAddress << 8) | (byte & 0xFF);
+            } else {
+                hostSpiAddress++;
+            }
+            hostSpiBytes++;
+        }
+    }
+
+    hostSPI2.SR = SPI_SR_TXE | SPI_SR_RXNE;
+    return &hostSPI2;
+}
+
+// IFCR is write-only; clearing a channel's global flag clears all four
+DMA_TypeDef* hostDma1() {
+    uint32_t clear = hostDMA1.IFCR;
+
+    clear |= (clear & 0x11111111) * 0xF;
+    hostDmaFlags &= ~clear;
+    hostDMA1.IFCR = 0;
+    hostDMA1.ISR = hostDmaFlags;
+    return &hostDMA1;
+}
+
+// SR flags are rc_w1. SR is left with HOST_NVM_UNWRITTEN set, a bit reserved
+// on the part, so a write is told by it having gone. PEKEYR takes the two
+// keys in turn to clear PELOCK; anything else starts the sequence over.
+FLASH_TypeDef* hostNvm() {
+    uint32_t* words = (uint32_t*) hostEeprom;
+    uint32_t* shadow = (uint32_t*) hostEepromShadow;
+    int i;
+
+    if (!(hostFLASH.SR & HOST_NVM_UNWRITTEN)) {
+        hostNvmFlags &= ~hostFLASH.SR;
+    }
+    if (hostFLASH.PEKEYR) {
+        if (hostPeKeys == 0 && hostFLASH.PEKEYR == HOST_PEKEY1) {
+            hostPeKeys = 1;
+        } else if (hostPeKeys == 1 && hostFLASH.PEKEYR == HOST_PEKEY2) {
+            hostFLASH.PECR &= ~FLASH_PECR_PELOCK;
+            hostPeKeys = 0;
+        } else {
+            hostPeKeys = 0;
+        }
+        hostFLASH.PEKEYR = 0;
+    }
+
+    for (i = 0; i < HOST_EEPROM_BYTES / 4; i++) {
+        if (words[i] == shadow[i]) {
+            continue;
+        }
+        if (hostFLASH.PECR & FLASH_PECR_PELOCK) {
+            words[i] = shadow[i];
+            hostNvmFlags |= FLASH_SR_WRPERR;
+            continue;
+        }
+        if (!hostEepromCut) {
+            words[i] = shadow[i];
+            continue;
+        }
+        if (hostEepromCut > 0) {
+            hostEepromCut--;
+        }
+        shadow[i] = words[i];
+        hostEepromWrites[i]++;
+        hostNvmFlags |= FLASH_SR_EOP;
+        hostSpend(HOST_EEPROM_WORD_CYCLES);
+    }
+
+    hostFLASH.SR = hostNvmFlags | HOST_NVM_UNWRITTEN;
+    return &hostFLASH;
+}
+
+// Erased and unworn, as a new part
+void hostEepromErase() {
+    memset(hostEeprom, 0, sizeof(hostEeprom));
+    memset(hostEepromShadow, 0, sizeof(hostEepromShadow));
+    memset(hostEepromWrites, 0, sizeof(hostEepromWrites));
+    hostEepromCut = -1;
+}
+
+int hostFlashLoad(const char* path) {
+    long size;
+    FILE* file = fopen(path, "rb");
+
+    if (!file) {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+
+    free(hostFlash);
+    hostFlash = malloc(size > 0 ? size : 1);
+    hostFlashSize = 0;
+    if (!hostFlash || fread(hostFlash, 1, size, file) != (size_t) size) {
+        fclose(file);
+        return 0;
+    }
+    hostFlashSize = (uint32_t) size;
+
+    fclose(file);
+    return 1;
+}
+
+// Core cycles until the running SPI receive completes, 0 if there is none.
+// A receive starts once its channel and the SPI request are both enabled.
+static uint64_t dmaNext() {
+    DMA_Channel_TypeDef* rx = &hostDMA1Channel4;
+
+    if (!hostDmaLeft && (rx->CCR & DMA_CCR1_EN) && rx->CNDTR &&
+        (hostSPI2.CR2 & SPI_CR2_RXDMAEN)) {
+        hostDmaLeft = (uint64_t) rx->CNDTR * 8 * (2UL << ((hostSPI2.CR1 & SPI_CR1_BR) >> 3));
+    }
+    return hostDmaLeft;
+}
+
+// Never called past the event dmaNext() reported
+static void dmaAdvance(uint64_t cycles) {
+    DMA_Channel_TypeDef* rx = &hostDMA1Channel4;
+    uint8_t* buffer;
+    uint32_t i;
+    int selected;
+
+    if (!hostDmaLeft) {
+        return;
+    }
+    hostDmaLeft -= cycles;
+    if (hostDmaLeft) {
+        return;
+    }
+
+    hostGpio(&hostGPIOB);
+    selected = !(hostGPIOB.ODR & HOST_SPI_CS) && hostSpiCommand == HOST_FLASH_READ &&
+        hostSpiBytes >= 4;
+    buffer = (uint8_t*) rx->CMAR;
+    for (i = 0; i < rx->CNDTR; i++) {
+        buffer[i] = selected && hostSpiAddress < hostFlashSize ? hostFlash[hostSpiAddress] : 0xFF;
+        hostSpiAddress++;
+    }
+    hostSpiBytes += rx->CNDTR;
+
+    rx->CNDTR = 0;
+    hostDma1(); // Apply the last IFCR write before raising new flags
+    hostDmaFlags |= DMA_ISR_GIF4 | DMA_ISR_TCIF4;
+    hostDMA1.ISR = hostDmaFlags;
+    if (rx->CCR & DMA_CCR1_TCIE) {
+        hostDmaPending = 1;
+    }
+}
+
+// Core cycles until the running SPI1 transmit completes, 0 if there is none
+static uint64_t dma3Next() {
+    DMA_Channel_TypeDef* tx = &hostDMA1Channel3;
+
+    if (!hostDma3Left && (tx->CCR & DMA_CCR1_EN) && tx->CNDTR &&
+        (hostSPI1.CR1 & SPI_CR1_SPE) && (hostSPI1.CR2 & SPI_CR2_TXDMAEN)) {
+        hostDma3Left = (uint64_t) tx->CNDTR * 8 * (2UL << ((hostSPI1.CR1 & SPI_CR1_BR) >> 3));
+    }
+    return hostDma3Left;
+}
+
+// Never called past the event dma3Next() reported
+static void dma3Advance(uint64_t cycles) {
+    DMA_Channel_TypeDef* tx = &hostDMA1Channel3;
+    const uint8_t* buffer;
+    uint32_t i;
+    int j;
+
+    if (!hostDma3Left) {
+        return;
+    }
+    hostDma3Left -= cycles;
+    if (hostDma3Left) {
+        return;
+    }
+
+    buffer = (const uint8_t*) tx->CMAR;
+    for (i = 0; i < tx->CNDTR; i++) {
+        for (j = HOST_CHAIN_BYTES - 1; j > 0; j--) {
+            hostChainShift[j] = hostChainShift[j - 1];
+        }
+        hostChainShift[0] = buffer[i];
+    }
+
+    tx->CNDTR = 0;
+    hostDma1();
+    hostDmaFlags |= DMA_ISR_GIF3 | DMA_ISR_TCIF3;
+    hostDMA1.ISR = hostDmaFlags;
+    if (tx->CCR & DMA_CCR1_TCIE) {
+        hostDma3Pending = 1;
+    }
+}
+
+// One word of a memory to peripheral transfer on channel number. The length
+// is taken from CNDTR at the first word after the channel was found off.
+static void dmaWord(DMA_Channel_TypeDef* channel, int number) {
+    uint32_t shift = 4 * (number - 1), flags = 0;
+    const uint32_t* memory;
+
+    if (!(channel->CCR & DMA_CCR1_EN) || !channel->CNDTR) {
+        hostDmaLength[number] = 0;
+        return;
+    }
+    if (!hostDmaLength[number] || channel->CNDTR > hostDmaLength[number]) {
+        hostDmaLength[number] = channel->CNDTR;
+    }
+
+    memory = (const uint32_t*) channel->CMAR;
+    *(volatile uint32_t*) channel->CPAR = memory[hostDmaLength[number] - channel->CNDTR];
+    channel->CNDTR--;
+    if (channel->CNDTR == hostDmaLength[number] / 2) {
+        flags = DMA_ISR_HTIF3;
+    }
+    if (!channel->CNDTR) {
+        flags = DMA_ISR_TCIF3;
+        if (channel->CCR & DMA_CCR1_CIRC) {
+            channel->CNDTR = hostDmaLength[number];
+        }
+    }
+    if (!flags) {
+        return;
+    }
+
+    hostDma1();
+    hostDmaFlags |= ((flags | DMA_ISR_GIF3) >> 8) << shift;
+    hostDMA1.ISR = hostDmaFlags;
+    if (number == 3 && (channel->CCR & (flags == DMA_ISR_TCIF3 ? DMA_CCR1_TCIE : DMA_CCR1_HTIE))) {
+        hostDma3Pending = 1;
+    }
+}
+
+// Queue bytes on the USART1 line. Returns how many fit.
+int hostUartSend(const uint8_t* bytes, int count) {
+    int i;
+
+    for (i = 0; i < count && hostUartCount < HOST_UART_QUEUE; i++) {
+        hostUartBytes[(hostUartHead + hostUartCount) % HOST_UART_QUEUE] = bytes[i];
+        hostUartCount++;
+    }
+    return i;
+}
+
+// Bytes sent that have not landed yet
+int hostUartQueued() {
+    return hostUartCount;
+}
+
+// Core cycles until the next byte lands or the line goes idle, 0 if neither.
+// A disabled receiver drops what is sent to it.
+static uint64_t uartNext() {
+    uint32_t enabled = USART_CR1_UE | USART_CR1_RE;
+
+    if (!(hostDMA1Channel5.CCR & DMA_CCR1_EN)) {
+        hostUartRing = 0;
+    }
+    if ((hostUSART1.CR1 & enabled) != enabled) {
+        hostUartCount = 0;
+        hostUartLeft = 0;
+        hostUartBusy = 0;
+        return 0;
+    }
+
+    if (!hostUartLeft && (hostUartCount || hostUartBusy)) {
+        hostUartLeft = (uint64_t) 10 * (hostUSART1.BRR ? hostUSART1.BRR : 1);
+    }
+    return hostUartLeft;
+}
+
+// The byte goes to the channel 5 buffer when DMA is on, else to DR
+static void uartLand(uint8_t byte) {
+    DMA_Channel_TypeDef* rx = &hostDMA1Channel5;
+
+    hostUartBusy = 1;
+    if (!(hostUSART1.CR3 & USART_CR3_DMAR) || !(rx->CCR & DMA_CCR1_EN) || !rx->CNDTR) {
+        hostUSART1.DR = byte;
+        hostUSART1.SR |= USART_SR_RXNE;
+        if (hostUSART1.CR1 & USART_CR1_RXNEIE) {
+            hostUartPending = 1;
+        }
+        return;
+    }
+
+    if (!hostUartRing) {
+        hostUartRing = rx->CNDTR;
+    }
+    ((uint8_t*) rx->CMAR)[hostUartRing - rx->CNDTR] = byte;
+    rx->CNDTR--;
+
+    hostDma1();
+    if (rx->CNDTR == hostUartRing / 2) {
+        hostDmaFlags |= DMA_ISR_GIF5 | DMA_ISR_HTIF5;
+        hostDma5Pending |= !!(rx->CCR & DMA_CCR1_HTIE);
+    }
+    if (!rx->CNDTR) {
+        hostDmaFlags |= DMA_ISR_GIF5 | DMA_ISR_TCIF5;
+        hostDma5Pending |= !!(rx->CCR & DMA_CCR1_TCIE);
+        if (rx->CCR & DMA_CCR1_CIRC) {
+            rx->CNDTR = hostUartRing;
+        }
+    }
+    hostDMA1.ISR = hostDmaFlags;
+}
+
+// Never called past the event uartNext() reported
+static void uartAdvance(uint64_t cycles) {
+    if (!hostUartLeft) {
+        return;
+    }
+    hostUartLeft -= cycles;
+    if (hostUartLeft) {
+        return;
+    }
+
+    if (hostUartCount) {
+        uartLand(hostUartBytes[hostUartHead]);
+        hostUartHead = (hostUartHead + 1) % HOST_UART_QUEUE;
+        hostUartCount--;
+    } else {
+        hostUartBusy = 0;
+        hostUSART1.SR |= USART_SR_IDLE;
+        if (hostUSART1.CR1 & USART_CR1_IDLEIE) {
+            hostUartPending = 1;
+        }
+    }
+}
+
+// Core cycles until the next TIM2 update or enabled compare match, 0 if the
+// counter is stopped
+static uint64_t tim2Next() {
+    TIM_TypeDef* tim = TIM2;
+    uint32_t top, count, ticks, toCompare;
+
+    if (!(tim->CR1 & TIM_CR1_CEN)) {
+        return 0;
+    }
+
+    top = tim->ARR & 0xFFFF;
+    count = tim->CNT & 0xFFFF;
+    ticks = top - count + 1;
+    if ((tim->DIER & TIM_DIER_CC1IE) && tim->CCR1 <= top) {
+        if (tim->CCR1 > count) {
+            toCompare = tim->CCR1 - count;
+        } else {
+            toCompare = tim->CCR1 + top + 1 - count;
+        }
+        if (toCompare < ticks) {
+            ticks = toCompare;
+        }
+    }
+
+    return (uint64_t) ticks * (tim->PSC + 1) - hostTim2Phase;
+}
+
+// Never called past the event tim2Next() reported
+static void tim2Advance(uint64_t cycles) {
+    TIM_TypeDef* tim = TIM2;
+    uint32_t top = tim->ARR & 0xFFFF;
+    uint32_t count = tim->CNT & 0xFFFF;
+    uint64_t total;
+
+    if (!(tim->CR1 & TIM_CR1_CEN)) {
+        return;
+    }
+
+    total = hostTim2Phase + cycles;
+    hostTim2Phase = (uint32_t) (total % (tim->PSC + 1));
+    count += (uint32_t) (total / (tim->PSC + 1));
+    if (count > top) {
+        count -= top + 1;
+        hostTim2Flags |= TIM_SR_UIF;
+    }
+    if (count == tim->CCR1 && hostTim2Phase == 0) {
+        hostTim2Flags |= TIM_SR_CC1IF;
+    }
+    tim->CNT = count;
+    tim->SR = hostTim2Flags;
+}
+
+// Core cycles until the next TIM3 update, 0 if the counter is stopped. It is
+// also blocked while the reload in use is zero, as the hardware's is, so a
+// song compiled with two edges a tick apart stops there with its keys held.
+static uint64_t tim3Next() {
+    TIM_TypeDef* tim = TIM3;
+
+    if (!(tim->CR1 & TIM_CR1_CEN) || !hostTim3Top) {
+        return 0;
+    }
+    return (uint64_t) (hostTim3Top - (tim->CNT & 0xFFFF) + 1) * (tim->PSC + 1) - hostTim3Phase;
+}
+
+// Never called past the event tim3Next() reported. The update loads the
+// preloaded reload before the DMA requests it raises write a new one.
+static void tim3Advance(uint64_t cycles) {
+    TIM_TypeDef* tim = TIM3;
+    uint32_t count = tim->CNT & 0xFFFF;
+    uint64_t total;
+
+    if (!(tim->CR1 & TIM_CR1_CEN) || !hostTim3Top) {
+        return;
+    }
+
+    total = hostTim3Phase + cycles;
+    hostTim3Phase = (uint32_t) (total % (tim->PSC + 1));
+    count += (uint32_t) (total / (tim->PSC + 1));
+    tim->CNT = count;
+    if (count <= hostTim3Top) {
+        return;
+    }
+
+    tim->CNT = 0;
+    hostTim3Top = tim->ARR & 0xFFFF;
+    if (tim->DIER & TIM_DIER_UDE) {
+        dmaWord(&hostDMA1Channel3, 3);
+    }
+    if ((tim->DIER & TIM_DIER_CC1DE) && tim->CCR1 == 0) {
+        dmaWord(&hostDMA1Channel6, 6);
+    }
+    if ((tim->DIER & TIM_DIER_CC3DE) && tim->CCR3 == 0) {
+        dmaWord(&hostDMA1Channel2, 2);
+    }
+    hostFlush();
+}
+
+static uint64_t sysTickNext() {
+    uint32_t enabled = SysTick_CTRL_ENABLE_Msk | SysTick_CTRL_TICKINT_Msk;
+    if ((SysTick->CTRL & enabled) != enabled) {
+        return 0;
+    }
+
+    return SysTick->VAL ? SysTick->VAL : SysTick->LOAD + 1;
+}
+
+// Returns 1 when the counter reached zero
+static int sysTickAdvance(uint64_t cycles) {
+    uint64_t remaining = sysTickNext();
+    if (!remaining) {
+        return 0;
+    }
+
+    if (cycles < remaining) {
+        SysTick->VAL = (uint32_t) (remaining - cycles);
+        return 0;
+    }
+
+    SysTick->VAL = 0; // Reloads on the next clock, LOAD + 1 cycles per tick
+    return 1;
+}
+
+// Core cycles until the next timer, DMA or USART event, 0 if nothing is
+// running
+static uint64_t nextEvent() {
+    uint64_t next = tim2Next();
+    uint64_t play = tim3Next();
+    uint64_t tick = sysTickNext();
+    uint64_t dma = dmaNext();
+    uint64_t chain = dma3Next();
+    uint64_t uart = uartNext();
+
+    if (!next || (play && play < next)) {
+        next = play;
+    }
+    if (!next || (tick && tick < next)) {
+        next = tick;
+    }
+    if (!next || (dma && dma < next)) {
+        next = dma;
+    }
+    if (!next || (chain && chain < next)) {
+        next = chain;
+    }
+    if (!next || (uart && uart < next)) {
+        next = uart;
+    }
+    return next;
+}
+
+// Move virtual time forward, latching timer flags without taking interrupts
+static void advance(uint64_t cycles) {
+    uint64_t next;
+
+    while (cycles) {
+        next = nextEvent();
+        if (!next || next > cycles) {
+            next = cycles;
+        }
+
+        hostCycles += next;
+        tim2Advance(next);
+        tim3Advance(next);
+        dmaAdvance(next);
+        dma3Advance(next);
+        uartAdvance(next);
+        if (sysTickAdvance(next)) {
+            hostTickPending = 1;
+        }
+        cycles -= next;
+    }
+}
+
+// Take the pending interrupts, TIM2 first as it has the higher priority.
+// Returns 1 if a handler ran.
+static int service() {
+    int taken = 0;
+
+    if (TIM2->DIER & hostTim2Flags & (TIM_DIER_UIE | TIM_DIER_CC1IE)) {
+        advance(hostIrqCycles);
+        TIM2_IRQHandler();
+        taken = 1;
+    }
+    if (hostDma3Pending) {
+        hostDma3Pending = 0;
+        advance(hostIrqCycles);
+        DMA1_Channel3_IRQHandler();
+        taken = 1;
+    }
+    if (hostDmaPending) {
+        hostDmaPending = 0;
+        advance(hostIrqCycles);
+        DMA1_Channel4_IRQHandler();
+        taken = 1;
+    }
+    if (hostDma5Pending) {
+        hostDma5Pending = 0;
+        advance(hostIrqCycles);
+        DMA1_Channel5_IRQHandler();
+        taken = 1;
+    }
+    if (hostUartPending) {
+        hostUartPending = 0;
+        advance(hostIrqCycles);
+        USART1_IRQHandler();
+        hostUSART1.SR &= ~(USART_SR_IDLE | USART_SR_RXNE);
+        taken = 1;
+    }
+    if (hostTickPending) {
+        hostTickPending = 0;
+        advance(hostIrqCycles);
+        SysTick_Handler();
+        taken = 1;
+    }
+
+    return taken;
+}
+
+// Advance virtual time to the next timer, DMA or USART event and service it.
+// Returns 0 if nothing is left that could wake the core.
+int hostStep() {
+    uint64_t next;
+
+    hostFlush();
+    if (service()) {
+        return 1;
+    }
+
+    next = nextEvent();
+    if (!next) {
+        return 0;
+    }
+
+    advance(next);
+    service();
+    return 1;
+}
+
+// Run main loop code that takes this many cycles; interrupts preempt it
+void hostSpend(uint64_t cycles) {
+    uint64_t next;
+
+    hostFlush();
+    while (cycles) {
+        next = nextEvent();
+        if (!next || next > cycles) {
+            next = cycles;
+        }
+
+        advance(next);
+        cycles -= next;
+        service();
+    }
+}
+
+// Virtual time in microseconds
+uint64_t hostMicros() {
+    return hostCycles / (SystemCoreClock / 1000000);
+}
+
+// TIM3 is counting but blocked at a zero reload, and never updates again
+int hostTim3Blocked() {
+    return (hostTIM3.CR1 & TIM_CR1_CEN) && !hostTim3Top;
+}
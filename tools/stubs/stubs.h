@@ -0,0 +1,41 @@
+//------------------------------------------------------------------------------
+// Host peripheral stubs
+//------------------------------------------------------------------------------
+#ifndef STUBS_H
+#define STUBS_H
+
+#include <stdint.h>
+
+#define HOST_CHAIN_BYTES 32 // Shift register latches on SPI1, up to 256 outputs
+#define HOST_EEPROM_BYTES 4096
+
+extern uint64_t hostCycles; // Virtual core clock cycles since hostReset()
+extern uint32_t hostIrqCycles; // Cycle model: entry, handler and exit
+extern void (*hostTrace)(char port, uint32_t odr); // Called on each ODR change
+extern uint8_t* hostFlash; // SPI flash contents, all ones past hostFlashSize
+extern uint32_t hostFlashSize;
+extern uint8_t hostChain[HOST_CHAIN_BYTES]; // Latched outputs, bit n%8 of byte n/8
+extern void (*hostLatch)(void); // Called on each latch pulse
+extern uint32_t hostEepromWrites[HOST_EEPROM_BYTES / 4]; // Programs of each word
+extern int hostEepromCut; // Words programmed before the power fails, -1 never
+
+
+void TIM2_IRQHandler(void);
+void SysTick_Handler(void);
+void DMA1_Channel3_IRQHandler(void);
+void DMA1_Channel4_IRQHandler(void);
+void DMA1_Channel5_IRQHandler(void);
+void USART1_IRQHandler(void);
+
+void hostReset(void);
+void hostFlush(void);
+int hostStep(void);
+void hostSpend(uint64_t cycles);
+uint64_t hostMicros(void);
+int hostTim3Blocked(void);
+int hostFlashLoad(const char* path);
+void hostEepromErase(void);
+int hostUartSend(const uint8_t* bytes, int count);
+int hostUartQueued(void);
+
+#endif
@@ -0,0 +1,74 @@
+//------------------------------------------------------------------------------
+// Synthetic songs for the host tools, see synth.h
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include "STM32L1xx.h"
+#include "keys.h"
+#include "songs.h"
+#include "synth.h"
+
+uint32_t synthSeed = 1;
+
+uint32_t synthRandom() {
+    synthSeed = synthSeed * 1103515245 + 12345;
+    return synthSeed >> 8;
+}
+
+// Lets go of a random part of held and presses a few keys not held, as a
+// chord change
+void synthChord(uint32_t held, uint32_t* on, uint32_t* off) {
+    *off = held & synthRandom();
+    *on = synthRandom() & synthRandom() & KEY_MASK & ~held;
+}
+
+// A zeroed image of size bytes with its directory filled in; the songs start
+// at SYNTH_FIRST_SONG(count)
+struct SongDirectory* synthDirectory(int count, uint32_t size) {
+    struct SongDirectory* directory = calloc(size, 1);
+
+    if (!directory) {
+        fprintf(stderr, "synth: out of memory\n");
+        exit(2);
+    }
+    directory->magic = SONG_DIR_MAGIC;
+    directory->version = SONG_DIR_VERSION;
+    directory->count = (uint16_t) count;
+    directory->size = size;
+    return directory;
+}
+
+// Places song at offset with length events right after its header, over the
+// song keys. Its name and tempo are left to the caller.
+struct SongHeader* synthSong(struct SongDirectory* directory, int song, uint32_t offset,
+    uint32_t length) {
+    struct SongHeader* header = (struct SongHeader*) ((uint8_t*) directory + offset);
+
+    ((uint32_t*) (directory + 1))[song] = offset;
+    header->lowKey = 0;
+    header->highKey = NUM_KEYS - 1;
+    header->length = length;
+    header->events = offset + sizeof(struct SongHeader);
+    return header;
+}
+
+// Fills in bars as songpack indexes a song's events, returning how many
+uint32_t synthBars(const struct SongEvent* events, uint32_t length, struct SongBar* bars) {
+    uint32_t e, bar = 0, beat = 0, held = 0, off;
+
+    for (e = 0; e < length; e++) {
+        beat += (uint32_t) EVENT_DELTA(&events[e]);
+        for (; bar * BEATS_PER_BAR <= beat; bar++) {
+            bars[bar].event = e;
+            bars[bar].held = held | (beat - bar * BEATS_PER_BAR) << 24;
+        }
+        off = events[e].offKeys & KEY_MASK;
+        held = (held & ~off) | (events[e].onKeys & KEY_MASK & ~off);
+    }
+    return bar;
+}
+
+void synthTempo(struct SongHeader* header, int bpm) {
+    header->tempo = (uint16_t) bpm;
+    header->beatLength = BEAT_LENGTH(bpm);
+}
@@ -0,0 +1,32 @@
+//------------------------------------------------------------------------------
+// Synthetic songs for the host tools
+//
+// One small LCG serves every tool, so nothing depends on the C library's
+// rand() and a seed given with -S repeats a run exactly. Songs are built as
+// directory images in RAM, laid out as songpack writes them: the caller sizes
+// the image, places each song and fills in its events, often with the random
+// chord changes synthChord() makes, and may give it the bar index
+// synthBars() makes.
+//------------------------------------------------------------------------------
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <stdint.h>
+#include "songs.h"
+
+#define SYNTH_FIRST_SONG(count) \
+    ((uint32_t) (sizeof(struct SongDirectory) + (count) * sizeof(uint32_t)))
+#define SYNTH_SONG_BYTES(length) \
+    ((uint32_t) (sizeof(struct SongHeader) + (length) * sizeof(struct SongEvent)))
+
+extern uint32_t synthSeed; // 1 unless a tool sets it
+
+uint32_t synthRandom(void);
+void synthChord(uint32_t held, uint32_t* on, uint32_t* off);
+struct SongDirectory* synthDirectory(int count, uint32_t size);
+struct SongHeader* synthSong(struct SongDirectory* directory, int song, uint32_t offset,
+    uint32_t length);
+uint32_t synthBars(const struct SongEvent* events, uint32_t length, struct SongBar* bars);
+void synthTempo(struct SongHeader* header, int bpm);
+
+#endif
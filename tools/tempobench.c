@@ -0,0 +1,451 @@
+//------------------------------------------------------------------------------
+// Live tempo benchmark
+//
+// Plays a long synthetic song with a tempo map through the real player,
+// taking every edge straight from playerNextEdge() as the DMA engine would,
+// at a fixed speed and then with setSpeed() called every few edges. A last
+// run plays it on the DMA engine in virtual time, as tools/sim.c does, with
+// the same changes. Checks:
+//   - fixed: every edge against its ideal time, the written tempo map summed
+//     in double and scaled by the speed. The player rounds a segment's beat
+//     length once, so the bound grows by a microsecond every 512 beats into
+//     a segment.
+//   - live: every gap between two edges is the written gap at the speed
+//     before the change or the one after it, so nothing jumps or stalls
+//     when the speed changes, whether the edges were still to be queued or
+//     already compiled by the engine.
+//   - close: with each key driven a microsecond earlier than the one below
+//     it, events put edges a microsecond apart and a change from a slow
+//     speed to a fast one squeezes those already queued together. Stepped
+//     and on the engine, the song must play to its end with no two edges
+//     closer than PLAYER_EDGE_GAP, as a zero reload blocks the timer.
+// For each but the engine it reports the host time per edge, the best of -r
+// runs. Timing a beat is the same single multiply at any speed, so the fixed
+// rows should match the 100% one within noise; the live row also pays for
+// the setSpeed() calls, a few divisions each.
+//
+// Usage:
+//   tempobench [-n events] [-r runs] [-e edges_per_change] [-S seed]
+//
+// Build:
+//   gcc -O2 -Itools/stubs -Isource -o tempobench tools/tempobench.c source/player.c source/dmaplay.c source/phrase.c source/keys.c source/scheduler.c source/power.c source/songs.c source/spiflash.c source/stream.c tools/stubs/stubs.c tools/stubs/synth.c
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "STM32L1xx.h"
+#include "dmaplay.h"
+#include "keys.h"
+#include "player.h"
+#include "power.h"
+#include "scheduler.h"
+#include "songs.h"
+#include "stubs.h"
+#include "synth.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define TEMPO_CHANGES   16
+#define LIVE_RUN        0 // Speeds given for the runs with live changes
+#define LIVE_DMA        -1
+#define SPEEDS          ((int) (sizeof(speeds) / sizeof(speeds[0])))
+#define CLOSE_DELAY     1000 // Key k is driven CLOSE_DELAY + k us early
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static const int speeds[] = { 100, 50, 75, 150, 200, 400, LIVE_RUN, LIVE_DMA };
+static const int liveSpeeds[] = { 100, 130, 70, 200, 25, 400, 90 };
+
+static int length = 12000;
+static int runs = 50;
+static int perChange = 8;
+
+static double* written; // Ideal time of each event's beat at 100%, microseconds
+static uint32_t* beats; // Beats into its tempo segment
+static uint32_t* times;
+static int* changedAt; // Speed in effect once i edges were taken
+static int edgeCount;
+static uint64_t lastEdge; // Virtual microsecond of the last edge recorded
+static uint64_t closest; // Fewest microseconds between two edges recorded
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+// One song in a RAM directory. Every event is on a beat of its own and
+// toggles a key, so each makes exactly one edge with no key delays that
+// shows on the ports, and the edges line up across speeds.
+static const struct SongDirectory* buildSong() {
+    struct SongDirectory* directory;
+    struct SongHeader* header;
+    struct SongEvent* events;
+    struct TempoChange* tempos;
+    uint32_t size, held = 0, on, off, delta, beat = 0, segmentBeat = 0;
+    uint32_t lengths[TEMPO_CHANGES + 1];
+    uint32_t changes[TEMPO_CHANGES + 1];
+    uint64_t start = 0;
+    double time = 0;
+    int i, t = 0;
+
+    size = SYNTH_FIRST_SONG(1) + SYNTH_SONG_BYTES(length) +
+        TEMPO_CHANGES * sizeof(struct TempoChange);
+    written = malloc(length * sizeof(double));
+    beats = malloc(length * sizeof(uint32_t));
+    if (!written || !beats || size > SONG_DIR_SIZE) {
+        fprintf(stderr, "tempobench: %d events do not fit the directory\n", length);
+        exit(2);
+    }
+
+    directory = synthDirectory(1, size);
+    header = synthSong(directory, 0, SYNTH_FIRST_SONG(1), (uint32_t) length);
+    header->tempoCount = TEMPO_CHANGES;
+    header->tempos = header->events + length * sizeof(struct SongEvent);
+    events = (struct SongEvent*) ((uint8_t*) directory + header->events);
+    tempos = (struct TempoChange*) ((uint8_t*) directory + header->tempos);
+
+    // Changes spread evenly over the song's beats, about four per event
+    lengths[0] = BEAT_LENGTH(60 + synthRandom() % 181);
+    changes[0] = 0;
+    for (i = 1; i <= TEMPO_CHANGES; i++) {
+        changes[i] = (uint32_t) i * (uint32_t) length * 4 / (TEMPO_CHANGES + 1);
+        lengths[i] = BEAT_LENGTH(40 + synthRandom() % 221);
+        start += (uint64_t) (changes[i] - changes[i - 1]) * lengths[i - 1];
+        tempos[i - 1].beat = changes[i];
+        tempos[i - 1].beatLength = lengths[i];
+        tempos[i - 1].start = (uint32_t) start;
+        tempos[i - 1].startHigh = (uint32_t) (start >> 32);
+    }
+
+    for (i = 0; i < length; i++) {
+        delta = i ? 1 + synthRandom() % 7 : 0;
+        synthChord(held, &on, &off);
+        if (held & KEY(i % NUM_KEYS)) {
+            off |= KEY(i % NUM_KEYS);
+        } else {
+            on |= KEY(i % NUM_KEYS);
+        }
+        if (i == length - 1) {
+            off = held;
+        }
+        held = (held & ~off) | on;
+        events[i].onKeys = (delta << 24) | on;
+        events[i].offKeys = off;
+
+        while (delta--) {
+            time += lengths[t] / 256.0;
+            beat++;
+            if (t < TEMPO_CHANGES && beat == changes[t + 1]) {
+                t++;
+                segmentBeat = beat;
+            }
+        }
+        written[i] = time;
+        beats[i] = beat - segmentBeat;
+    }
+
+    strcpy(header->name, "Tempo bench");
+    header->tempo = 120;
+    header->beatLength = lengths[0];
+    return directory;
+}
+
+static double now() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// An edge is one or both ports changing at a virtual time
+static void record(char port, uint32_t odr) {
+    (void) port;
+    (void) odr;
+    if (edgeCount && hostMicros() == lastEdge) {
+        return;
+    }
+    if (edgeCount < length) {
+        times[edgeCount] = (uint32_t) hostMicros();
+    }
+    lastEdge = hostMicros();
+    edgeCount++;
+}
+
+static void recordClose(char port, uint32_t odr) {
+    (void) port;
+    (void) odr;
+    if (edgeCount && hostMicros() == lastEdge) {
+        return;
+    }
+    if (edgeCount && hostMicros() - lastEdge < closest) {
+        closest = hostMicros() - lastEdge;
+    }
+    lastEdge = hostMicros();
+    edgeCount++;
+}
+
+// Plays the song with close key delays and the live changes, each made once
+// the edge before it is on the ports. Returns the fewest microseconds
+// between two edges.
+static uint64_t playClose(int dma) {
+    int live = 0, taken = 0, k;
+
+    for (k = 0; k < NUM_KEYS; k++) {
+        keyDelays[k].pull = (uint16_t) (CLOSE_DELAY + k);
+        keyDelays[k].release = (uint16_t) (CLOSE_DELAY + k);
+    }
+    hostReset();
+    powerInit();
+    schedInit();
+    dmaPlayInit();
+    playerInit();
+    playerUseDma = dma;
+    setSpeed(liveSpeeds[0]);
+
+    edgeCount = 0;
+    closest = ~(uint64_t) 0;
+    hostTrace = recordClose;
+    playerStart(numSongs);
+    while (1) {
+        for (; taken < edgeCount; taken++) {
+            if ((taken + 1) % perChange == 0) {
+                live = (live + 1) % (int) (sizeof(liveSpeeds) / sizeof(liveSpeeds[0]));
+                setSpeed(liveSpeeds[live]);
+            }
+        }
+        if (schedPoll()) {
+            if (!playerStep()) {
+                break;
+            }
+        } else if (hostTim3Blocked()) {
+            fprintf(stderr, "tempobench: DMA timer blocked at a zero reload at %lu us\n",
+                (unsigned long) hostMicros());
+            exit(1);
+        } else if (!hostStep()) {
+            fprintf(stderr, "tempobench: timer stopped\n");
+            exit(1);
+        }
+    }
+    hostTrace = NULL;
+    memset(keyDelays, 0, sizeof(keyDelays));
+
+    if (closest < PLAYER_EDGE_GAP) {
+        fprintf(stderr, "tempobench: %s edges %lu us apart with close key delays\n",
+            dma ? "dma" : "stepped", (unsigned long) closest);
+        exit(1);
+    }
+    return closest;
+}
+
+// Plays the song on the DMA engine with the live changes, each made once
+// the edge before it is on the ports
+static void playDma() {
+    int live = 0, taken = 0;
+
+    hostReset();
+    powerInit();
+    schedInit();
+    dmaPlayInit();
+    playerInit();
+    playerUseDma = 1;
+    setSpeed(liveSpeeds[0]);
+    changedAt[0] = liveSpeeds[0];
+
+    edgeCount = 0;
+    hostTrace = record;
+    playerStart(numSongs);
+    while (1) {
+        for (; taken < edgeCount && taken < length; taken++) {
+            if ((taken + 1) % perChange == 0) {
+                live = (live + 1) % (int) (sizeof(liveSpeeds) / sizeof(liveSpeeds[0]));
+                setSpeed(liveSpeeds[live]);
+            }
+            if (taken + 1 < length) {
+                changedAt[taken + 1] = liveSpeeds[live];
+            }
+        }
+        if (schedPoll()) {
+            if (!playerStep()) {
+                break;
+            }
+        } else if (!hostStep()) {
+            fprintf(stderr, "tempobench: timer stopped\n");
+            exit(1);
+        }
+    }
+    hostTrace = NULL;
+
+    if (edgeCount != length) {
+        fprintf(stderr, "tempobench: %d edges on the ports for %d events\n", edgeCount, length);
+        exit(1);
+    }
+}
+
+// Takes every edge of the song at speed, or with live changes. Returns the
+// host nanoseconds per edge.
+static double drain(int speed) {
+    struct KeySet onKeys, offKeys;
+    double start, spent;
+    int live = 0;
+
+    hostReset();
+    powerInit();
+    schedInit();
+    playerInit();
+    playerUseDma = 0;
+    setSpeed(speed == LIVE_RUN ? liveSpeeds[0] : speed);
+    changedAt[0] = speed == LIVE_RUN ? liveSpeeds[0] : speed;
+
+    edgeCount = 0;
+    start = now();
+    playerStart(numSongs);
+    while (playerNextEdge(&times[edgeCount], &onKeys, &offKeys)) {
+        edgeCount++;
+        if (speed == LIVE_RUN && edgeCount % perChange == 0) {
+            live = (live + 1) % (int) (sizeof(liveSpeeds) / sizeof(liveSpeeds[0]));
+            setSpeed(liveSpeeds[live]);
+        }
+        if (edgeCount < length) {
+            changedAt[edgeCount] = liveSpeeds[live];
+        }
+    }
+    spent = now() - start;
+    playerStop();
+
+    if (edgeCount != length) {
+        fprintf(stderr, "tempobench: %d edges for %d events\n", edgeCount, length);
+        exit(1);
+    }
+    return spent / edgeCount;
+}
+
+// Worst microseconds from the ideal times, or -1 past the bound
+static double checkFixed(int speed) {
+    double ideal, error, worst = 0;
+    uint64_t whole;
+    int i;
+
+    for (i = 0; i < edgeCount; i++) {
+        // Times wrap at 32 bits, as they do on the board
+        ideal = written[i] * 100 / speed;
+        whole = (uint64_t) ideal;
+        error = (double) (int32_t) (times[i] - (uint32_t) whole) - (ideal - whole);
+        if (error < 0) {
+            error = -error;
+        }
+        if (error > 1 + beats[i] / 512.0) {
+            fprintf(stderr, "tempobench: edge %d at %lu us, ideal %.3f at %d%%\n",
+                i, (unsigned long) times[i], ideal, speed);
+            return -1;
+        }
+        if (error > worst) {
+            worst = error;
+        }
+    }
+    return worst;
+}
+
+// The next edge keeps its time when the speed changes, so each gap is the
+// written one at the speed set before its first edge was due. An edge taken
+// ahead edges early is rounded to a microsecond by each change it waits
+// through, and a slower speed after that magnifies the rounding.
+static double checkLive(int ahead) {
+    double gap, scaled, error, worst = 0;
+    int i, waits = 1 + ahead / perChange;
+
+    for (i = 1; i < edgeCount; i++) {
+        if ((int32_t) (times[i] - times[i - 1]) < 0) {
+            fprintf(stderr, "tempobench: edge %d goes back in time\n", i);
+            return -1;
+        }
+        gap = (double) (times[i] - times[i - 1]);
+        scaled = (written[i] - written[i - 1]) * 100 / changedAt[i - 1];
+        error = gap > scaled ? gap - scaled : scaled - gap;
+        if (error > 2 + beats[i] / 512.0 + (double) waits * PLAYER_SPEED_MAX / changedAt[i - 1]) {
+            fprintf(stderr, "tempobench: gap before edge %d is %.0f us, %.0f at %d%%\n",
+                i, gap, scaled, changedAt[i - 1]);
+            return -1;
+        }
+        if (error > worst) {
+            worst = error;
+        }
+    }
+    return worst;
+}
+
+int main(int argc, char** argv) {
+    const struct SongDirectory* directory;
+    double ns, lowest[SPEEDS], worst[SPEEDS];
+    uint64_t stepped, dma;
+    int i, r;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            length = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-e") && i + 1 < argc) {
+            perChange = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-S") && i + 1 < argc) {
+            synthSeed = (uint32_t) strtoul(argv[++i], NULL, 0);
+        } else {
+            fprintf(stderr, "usage: tempobench [-n events] [-r runs] [-e edges_per_change] [-S seed]\n");
+            return 2;
+        }
+    }
+    if (length < 2 || runs < 1 || perChange < 1) {
+        fprintf(stderr, "tempobench: need two events, a run and an edge per change\n");
+        return 2;
+    }
+
+    directory = buildSong();
+    times = malloc(length * sizeof(uint32_t));
+    changedAt = malloc(length * sizeof(int));
+    if (!times || !changedAt) {
+        fprintf(stderr, "tempobench: out of memory\n");
+        return 2;
+    }
+    songsInit(directory);
+
+    // Checked on the first round. Rounds go through every speed in turn, so
+    // noise on the host spreads over all of them alike.
+    for (r = 0; r < runs; r++) {
+        for (i = 0; i < SPEEDS - 1; i++) {
+            ns = drain(speeds[i]);
+            if (!r || ns < lowest[i]) {
+                lowest[i] = ns;
+            }
+            if (!r) {
+                worst[i] = speeds[i] == LIVE_RUN ? checkLive(0) : checkFixed(speeds[i]);
+                if (worst[i] < 0) {
+                    return 1;
+                }
+            }
+        }
+    }
+    playDma();
+    worst[SPEEDS - 1] = checkLive(DMA_PLAY_SLOTS + 3);
+    if (worst[SPEEDS - 1] < 0) {
+        return 1;
+    }
+    stepped = playClose(0);
+    dma = playClose(1);
+
+    printf("%-10s %8s %10s %8s %12s\n", "speed", "edges", "ns/edge", "vs 100%", "worst us");
+    for (i = 0; i < SPEEDS; i++) {
+        if (speeds[i] == LIVE_DMA) {
+            printf("dma/%-6d %8d %10s %8s %12.3f\n", perChange, length, "-", "-", worst[i]);
+            continue;
+        }
+        if (speeds[i] == LIVE_RUN) {
+            printf("live/%-5d", perChange);
+        } else {
+            printf("%4d%%     ", speeds[i]);
+        }
+        printf(" %8d %10.1f %7.2fx %12.3f\n", length, lowest[i], lowest[i] / lowest[0], worst[i]);
+    }
+    printf("close keys: edges at least %lu us apart stepped, %lu us on the engine\n",
+        (unsigned long) stepped, (unsigned long) dma);
+    return 0;
+}
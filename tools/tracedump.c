@@ -0,0 +1,307 @@
+//------------------------------------------------------------------------------
+// Tracepoint decoder
+//
+// Turns the records of a firmware built with TRACE defined (see
+// source/trace.h) into per-point cycle statistics. Input is either a binary
+// dump of traceLog saved from the debugger, with -s a raw SWO capture of the
+// ITM stream, or with -u a capture of what a firmware also built with
+// TRACE_UART drains out of USART1 with no debugger, saved from a serial
+// adapter on PA9 at 1000000 baud, 8N1 (on Linux, "stty -F /dev/ttyUSB0
+// 1000000 raw" then cat it to a file). That holds the same packets, but the
+// capture may start partway through a drain, so bytes before the first sync
+// packet are skipped; the zero bytes an adapter reads from the break between
+// drains are skipped as ITM sync. -H adds a power of two histogram for each
+// point and -t prints every record.
+//
+// Besides the time spent in each point it reports how long each player step
+// waited after the TIM2 interrupt that released it, which is the stall seen by
+// a note when a button handler or the main loop is busy.
+//
+// Usage:
+//   tracedump [-s | -u] [-H] [-t] [-f core_hz] file
+//
+// Build:
+//   gcc -O2 -Isource -o tracedump tools/tracedump.c
+//------------------------------------------------------------------------------
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+//------------------------------------------------------------------------------
+// Defines
+//------------------------------------------------------------------------------
+#define NUM_POINTS      12
+#define STALL           NUM_POINTS // Extra row for TIM2 entry to step entry
+#define CYCLE_MASK      0x00FFFFFF
+#define BUCKETS         24
+#define SYNC_ZEROS      5 // Then 0x80; no packet holds that many zeros in a row
+
+//------------------------------------------------------------------------------
+// Structs
+//------------------------------------------------------------------------------
+struct Samples {
+    uint32_t* cycles;
+    int count;
+    int size;
+
+};
+
+//------------------------------------------------------------------------------
+// Global Variables
+//------------------------------------------------------------------------------
+static const char* pointNames[NUM_POINTS + 1] = {
+    "EXTI0 song button", "EXTI1 mode button", "EXTI2 play button",
+    "EXTI3 stop button", "TIM2 scheduler", "SysTick debounce",
+    "handleButtons", "playerStep", "updateKeys", "deactivateAllKeys",
+    "livePoll", "USART1 serial input", "TIM2 entry to playerStep"
+};
+
+static struct Samples samples[NUM_POINTS + 1];
+static uint32_t entered[NUM_POINTS];
+static int pending[NUM_POINTS];
+static uint32_t lastTim2;
+static int tim2Seen;
+static int printRecords;
+static unsigned long records, unmatched;
+
+//------------------------------------------------------------------------------
+// Functions
+//------------------------------------------------------------------------------
+static void addSample(int row, uint32_t cycles) {
+    struct Samples* s = &samples[row];
+    if (s->count == s->size) {
+        s->size = s->size ? s->size * 2 : 256;
+        s->cycles = realloc(s->cycles, s->size * sizeof(uint32_t));
+        if (!s->cycles) {
+            fprintf(stderr, "tracedump: out of memory\n");
+            exit(2);
+        }
+    }
+    s->cycles[s->count++] = cycles;
+}
+
+// Cycle fields are 24 bits, so differences are taken modulo 2^24. Handlers
+// of one point never nest, so one open entry per point is enough.
+static void decode(uint32_t record) {
+    int point = (int) ((record >> 24) & ~TRACE_ENTRY);
+    int entry = (record >> 24) & TRACE_ENTRY;
+    uint32_t cycle = record & CYCLE_MASK;
+
+    records++;
+    if (printRecords) {
+        printf("%08lx %-5s %s\n", (unsigned long) cycle, entry ? "enter" : "exit",
+            point < NUM_POINTS ? pointNames[point] : "unknown");
+    }
+    if (point >= NUM_POINTS) {
+        unmatched++;
+        return;
+    }
+
+    if (entry) {
+        entered[point] = cycle;
+        pending[point] = 1;
+        if (point == TRACE_TIM2) {
+            lastTim2 = cycle;
+            tim2Seen = 1;
+        } else if (point == TRACE_STEP && tim2Seen) {
+            addSample(STALL, (cycle - lastTim2) & CYCLE_MASK);
+            tim2Seen = 0;
+        }
+    } else if (pending[point]) {
+        addSample(point, (cycle - entered[point]) & CYCLE_MASK);
+        pending[point] = 0;
+    } else {
+        unmatched++;
+    }
+}
+
+static uint32_t readWord(const unsigned char* bytes) {
+    return (uint32_t) bytes[0] | ((uint32_t) bytes[1] << 8) |
+        ((uint32_t) bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+// traceLog as it sits in RAM: head, tail, lost, then the ring
+static int decodeDump(const unsigned char* data, long length) {
+    uint32_t head, lost, size, start, i;
+
+    if (length < 16 || length % 4) {
+        fprintf(stderr, "tracedump: not a traceLog dump\n");
+        return 1;
+    }
+
+    head = readWord(data);
+    lost = readWord(data + 8);
+    size = (uint32_t) (length / 4 - 3);
+    start = head > size ? head - size : 0;
+    for (i = start; i != head; i++) {
+        decode(readWord(data + 12 + 4 * (i % size)));
+    }
+
+    printf("%lu records written, %lu not drained in time\n",
+        (unsigned long) head, (unsigned long) lost);
+    return 0;
+}
+
+// ITM software source packets: a header byte holding the port in bits 7:3
+// and the payload size in bits 1:0, then the payload. Bytes with bits 1:0
+// clear are sync, overflow or timestamp packets and carry nothing we need.
+static int decodeSwo(const unsigned char* data, long length) {
+    static const int sizes[4] = { 0, 1, 2, 4 };
+    long i = 0;
+    int size, port;
+    uint32_t value;
+
+    while (i < length) {
+        size = sizes[data[i] & 0x03];
+        port = data[i] >> 3;
+        i++;
+        if (!size) {
+            // Timestamp packets continue while bit 7 is set
+            while ((data[i - 1] & 0x80) && i < length && (data[i] & 0x80)) {
+                i++;
+            }
+            continue;
+        }
+        if (i + size > length) {
+            break;
+        }
+
+        value = size == 4 ? readWord(data + i) : 0;
+        if (port == TRACE_PORT && size == 4) {
+            decode(value);
+        }
+        i += size;
+    }
+
+    return 0;
+}
+
+// Offset just past the first sync packet, or the length if there is none
+static long findSync(const unsigned char* data, long length) {
+    long i;
+    int zeros = 0;
+
+    for (i = 0; i < length; i++) {
+        if (data[i] == 0x80 && zeros >= SYNC_ZEROS) {
+            return i + 1;
+        }
+        zeros = data[i] == 0x00 ? zeros + 1 : 0;
+    }
+    return length;
+}
+
+static int compareCycles(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(double coreHz, int histogram) {
+    struct Samples* s;
+    double sum;
+    int row, i, bucket, counts[BUCKETS];
+
+    printf("%-26s %7s %8s %9s %8s %8s %9s\n", "cycles", "count", "min",
+        "mean", "p99", "max", "max us");
+    for (row = 0; row <= NUM_POINTS; row++) {
+        s = &samples[row];
+        if (!s->count) {
+            continue;
+        }
+
+        qsort(s->cycles, s->count, sizeof(uint32_t), compareCycles);
+        sum = 0;
+        for (i = 0; i < s->count; i++) {
+            sum += s->cycles[i];
+        }
+        printf("%-26s %7d %8lu %9.1f %8lu %8lu %9.2f\n", pointNames[row],
+            s->count, (unsigned long) s->cycles[0], sum / s->count,
+            (unsigned long) s->cycles[(s->count * 99 + 99) / 100 - 1],
+            (unsigned long) s->cycles[s->count - 1],
+            s->cycles[s->count - 1] * 1e6 / coreHz);
+
+        if (!histogram) {
+            continue;
+        }
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < s->count; i++) {
+            for (bucket = 0; bucket < BUCKETS - 1 && (s->cycles[i] >> bucket) > 1; bucket++) {
+            }
+            counts[bucket]++;
+        }
+        for (bucket = 0; bucket < BUCKETS; bucket++) {
+            if (counts[bucket]) {
+                printf("    %8lu+ %7d\n", bucket ? 1UL << bucket : 0UL, counts[bucket]);
+            }
+        }
+    }
+
+    if (unmatched) {
+        printf("%lu records without a matching entry\n", unmatched);
+    }
+}
+
+int main(int argc, char** argv) {
+    const char* path = NULL;
+    unsigned char* data;
+    double coreHz = 32000000;
+    int swo = 0, uart = 0, histogram = 0, opt, error;
+    long length, start;
+    FILE* file;
+
+    for (opt = 1; opt < argc; opt++) {
+        if (!strcmp(argv[opt], "-s")) {
+            swo = 1;
+        } else if (!strcmp(argv[opt], "-u")) {
+            uart = 1;
+        } else if (!strcmp(argv[opt], "-H")) {
+            histogram = 1;
+        } else if (!strcmp(argv[opt], "-t")) {
+            printRecords = 1;
+        } else if (opt + 1 < argc && !strcmp(argv[opt], "-f")) {
+            coreHz = atof(argv[++opt]);
+        } else if (argv[opt][0] != '-' && !path) {
+            path = argv[opt];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (!path || (swo && uart)) {
+        fprintf(stderr, "usage: %s [-s | -u] [-H] [-t] [-f core_hz] file\n", argv[0]);
+        return 2;
+    }
+
+    file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    rewind(file);
+    data = malloc(length ? length : 1);
+    if (!data || fread(data, 1, length, file) != (size_t) length) {
+        fprintf(stderr, "tracedump: cannot read %s\n", path);
+        return 1;
+    }
+    fclose(file);
+
+    if (uart) {
+        start = findSync(data, length);
+        if (start == length) {
+            fprintf(stderr, "tracedump: no sync packet in %s\n", path);
+            return 1;
+        }
+        error = decodeSwo(data + start, length - start);
+    } else {
+        error = swo ? decodeSwo(data, length) : decodeDump(data, length);
+    }
+    if (!error) {
+        report(coreHz, histogram);
+    }
+
+    free(data);
+    return error;
+}